@@ -0,0 +1,386 @@
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _MSC_VER
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "types.h"
+#include "ArenaAlloc.h"
+#include "animation_commands.h"
+#include "Manifest.h"
+#include "animExporter.h"
+#include "Hash.h"
+#include "AnimDb.h"
+
+#define AnimDbAlign(offset) (((offset) + 7) & ~7ULL)
+
+static bool
+isLastCommand(s32 cmdId) {
+    return (cmdId == AnimCmd_End)
+        || (cmdId == AnimCmd_JumpBack)
+        || (cmdId == AnimCmd_SetIdAndVariant);
+}
+
+// Replace the 'jumpTarget' pointers inside the copy of the DynTable image
+// with the distance from each jump command to its target.
+static void
+makeJumpsRelative(DynTable* dynTable, u32 animCount, u8* copy) {
+    u8* base = (u8*)dynTable->animations;
+    
+    for (u32 animId = 0; animId < animCount; animId++) {
+        DynTableAnim* anim = &dynTable->animations[animId];
+        
+        // Aliases share the commands of the animation they point to
+        if (anim->offsetVariants <= 0)
+            continue;
+        
+        s32* variantOffsets = (s32*)OffsetPointer(&anim->offsetVariants);
+        
+        for (u16 variantId = 0; variantId < dynTable->variantCounts[animId]; variantId++) {
+            DynTableAnimCmd* cmd = (DynTableAnimCmd*)OffsetPointer(&variantOffsets[variantId]);
+            
+            for (;; cmd++) {
+                if (cmd->cmd.id == AnimCmd_JumpBack) {
+                    AnimDbCmd* dbCmd = (AnimDbCmd*)(copy + ((u8*)cmd - base));
+                    u8* target = cmd->cmd._exJump.jumpTarget;
+                    
+                    dbCmd->jump.targetOffset = (target) ? (s64)(target - (u8*)cmd) : 0;
+                }
+                
+                if (isLastCommand(cmd->cmd.id))
+                    break;
+            }
+        }
+    }
+}
+
+// Puts the whole file together inside of 'arena' and returns its size.
+// 'dynTable' has to be the start of an image of 'tableSize' bytes, as created by 'createDynamicAnimTable'.
+u64
+animDbBuild(MemArena* arena, u8** fileData, u64 romHash, u32 exporterVersion, eGame game,
+            DynTable* dynTable, u64 tableSize, u32 animCount, LabelStrings* labels, u64 stringsSize) {
+    AnimDbHeader header = { 0 };
+    memcpy(header.magic, ANIM_DB_MAGIC, sizeof(header.magic));
+    header.version         = ANIM_DB_VERSION;
+    header.headerSize      = sizeof(AnimDbHeader);
+    header.romHash         = romHash;
+    header.game            = game;
+    header.animCount       = animCount;
+    header.cmdSize         = sizeof(AnimDbCmd);
+    header.exporterVersion = exporterVersion;
+    
+    header.tableOffset        = AnimDbAlign(sizeof(AnimDbHeader));
+    header.tableSize          = tableSize;
+    header.labelOffsetsOffset = AnimDbAlign(header.tableOffset + tableSize);
+    header.labelCount         = labels->count;
+    header.stringsOffset      = AnimDbAlign(header.labelOffsetsOffset + labels->count * sizeof(s32));
+    header.stringsSize        = stringsSize;
+    
+    u64 fileSize = header.stringsOffset + stringsSize;
+    
+    // The padding stays zeroed.
+    u8* image = memArenaPushArray(arena, u8, fileSize);
+    
+    memcpy(image + header.tableOffset, dynTable->animations, tableSize);
+    memcpy(image + header.labelOffsetsOffset, labels->offsets, labels->count * sizeof(s32));
+    memcpy(image + header.stringsOffset, labels->strings, stringsSize);
+    
+    // The pointers only have meaning inside of this process, so they get written relative.
+    makeJumpsRelative(dynTable, animCount, image + header.tableOffset);
+    
+    header.payloadHash = hash64(image + sizeof(AnimDbHeader), fileSize - sizeof(AnimDbHeader), 0);
+    memcpy(image, &header, sizeof(header));
+    
+    *fileData = image;
+    return fileSize;
+}
+
+// The file gets written under a temporary name first and renamed at the end,
+// so readers never see a partially written database.
+bool
+animDbWrite(const char* path, u64 romHash, u32 exporterVersion, eGame game,
+            DynTable* dynTable, u64 tableSize, u32 animCount, LabelStrings* labels, u64 stringsSize) {
+    MemArena scratch;
+    memArenaInit(&scratch);
+    
+    u8* image;
+    u64 fileSize = animDbBuild(&scratch, &image, romHash, exporterVersion, game,
+                               dynTable, tableSize, animCount, labels, stringsSize);
+    
+    char* tempPath = memArenaPushArray(&scratch, char, strlen(path) + sizeof(".tmp"));
+    sprintf(tempPath, "%s.tmp", path);
+    
+    bool success = FALSE;
+    FILE* file = fopen(tempPath, "wb");
+    if (file) {
+        success = (fwrite(image, 1, fileSize, file) == fileSize);
+        success = (fclose(file) == 0) && success;
+        
+#ifdef _MSC_VER
+        // rename() doesn't replace existing files on Windows
+        if (success)
+            remove(path);
+#endif
+        success = success && (rename(tempPath, path) == 0);
+        
+        if (!success)
+            remove(tempPath);
+    }
+    
+    if (!success)
+        fprintf(stderr, "Could not write '%s'. Code: %d\n", path, errno);
+    
+    memArenaFree(&scratch);
+    return success;
+}
+
+static bool
+animDbContains(const AnimDb* db, const void* pointer, u64 size) {
+    const u8* bytes = pointer;
+    return (bytes >= db->data) && (size <= db->size) && ((u64)(bytes - db->data) <= db->size - size);
+}
+
+static bool
+sectionIsValid(const AnimDb* db, u64 offset, u64 size) {
+    return (offset <= db->size) && (size <= db->size - offset);
+}
+
+// Checks the header and sets up the pointers into 'data'.
+// 'data' has to stay valid until the database is closed.
+bool
+animDbOpenMemory(AnimDb* db, u8* data, u64 size) {
+    db->data = data;
+    db->size = size;
+    
+    const AnimDbHeader* header = (const AnimDbHeader*)data;
+    if ((size < sizeof(AnimDbHeader))
+        || memcmp(header->magic, ANIM_DB_MAGIC, sizeof(header->magic))
+        || (header->version != ANIM_DB_VERSION)
+        || (header->headerSize != sizeof(AnimDbHeader))
+        || (header->cmdSize != sizeof(AnimDbCmd))) {
+        return FALSE;
+    }
+    
+    u64 tableHeadSize = (u64)header->animCount * (sizeof(DynTableAnim) + sizeof(u16));
+    if (!sectionIsValid(db, header->tableOffset, header->tableSize)
+        || (tableHeadSize > header->tableSize)
+        || (header->labelCount > size / sizeof(s32))
+        || !sectionIsValid(db, header->labelOffsetsOffset, header->labelCount * sizeof(s32))
+        || !sectionIsValid(db, header->stringsOffset, header->stringsSize)
+        || (header->stringsSize == 0)
+        || (data[header->stringsOffset + header->stringsSize - 1] != '\0')) {
+        return FALSE;
+    }
+    
+    db->header        = header;
+    db->animations    = (const DynTableAnim*)(data + header->tableOffset);
+    db->variantCounts = (const u16*)(data + header->tableOffset + header->animCount * sizeof(DynTableAnim));
+    db->labelOffsets  = (const s32*)(data + header->labelOffsetsOffset);
+    db->strings       = (const char*)(data + header->stringsOffset);
+    
+    return TRUE;
+}
+
+bool
+animDbOpen(AnimDb* db, const char* path) {
+    memset(db, 0, sizeof(*db));
+    
+#ifdef _MSC_VER
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return FALSE;
+    
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || (fileSize.QuadPart <= 0)) {
+        CloseHandle(file);
+        return FALSE;
+    }
+    
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    void* memory = NULL;
+    if (mapping) {
+        memory = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        
+        // The view keeps the mapping alive.
+        CloseHandle(mapping);
+    }
+    CloseHandle(file);
+    
+    if (memory == NULL)
+        return FALSE;
+    
+    u64 size = fileSize.QuadPart;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return FALSE;
+    
+    struct stat fileInfo;
+    if ((fstat(fd, &fileInfo) != 0) || (fileInfo.st_size <= 0)) {
+        close(fd);
+        return FALSE;
+    }
+    
+    void* memory = mmap(NULL, fileInfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    
+    // The mapping keeps its own reference to the file.
+    close(fd);
+    
+    if (memory == MAP_FAILED)
+        return FALSE;
+    
+    u64 size = fileInfo.st_size;
+#endif
+    
+    db->isMapped = TRUE;
+    
+    if (!animDbOpenMemory(db, memory, size)) {
+        animDbClose(db);
+        return FALSE;
+    }
+    
+    return TRUE;
+}
+
+void
+animDbClose(AnimDb* db) {
+    if (db->isMapped && db->data) {
+#ifdef _MSC_VER
+        UnmapViewOfFile(db->data);
+#else
+        munmap(db->data, db->size);
+#endif
+    }
+    
+    memset(db, 0, sizeof(*db));
+}
+
+// Aliases store the distance to the entry they share the variants with in elements, not bytes.
+static const DynTableAnim*
+resolveAlias(const AnimDb* db, u32 animId) {
+    if (animId >= db->header->animCount)
+        return NULL;
+    
+    const DynTableAnim* anim = &db->animations[animId];
+    if (anim->offsetVariants < 0) {
+        s64 targetId = (s64)animId + anim->offsetVariants;
+        if (targetId < 0)
+            return NULL;
+        
+        anim = &db->animations[targetId];
+    }
+    
+    return anim;
+}
+
+u16
+animDbVariantCount(const AnimDb* db, u32 animId) {
+    if (animId >= db->header->animCount)
+        return 0;
+    
+    return db->variantCounts[animId];
+}
+
+// Returns the first command of the variant, or NULL if it doesn't exist.
+// The commands of a variant follow each other until 'animDbIsLastCommand' returns TRUE.
+const AnimDbCmd*
+animDbVariant(const AnimDb* db, u32 animId, u16 variantId) {
+    const DynTableAnim* anim = resolveAlias(db, animId);
+    
+    if ((anim == NULL) || (anim->offsetVariants <= 0) || (variantId >= animDbVariantCount(db, animId)))
+        return NULL;
+    
+    const s32* variantOffset = (const s32*)OffsetPointer(&anim->offsetVariants) + variantId;
+    if (!animDbContains(db, variantOffset, sizeof(s32)))
+        return NULL;
+    
+    const AnimDbCmd* cmd = (const AnimDbCmd*)OffsetPointer(variantOffset);
+    if (!animDbContains(db, cmd, sizeof(AnimDbCmd)))
+        return NULL;
+    
+    return cmd;
+}
+
+// Returns the command a jump command jumps to, or NULL.
+const AnimDbCmd*
+animDbJumpTarget(const AnimDbCmd* cmd) {
+    if ((cmd->cmd.id != AnimCmd_JumpBack) || (cmd->jump.targetOffset == 0))
+        return NULL;
+    
+    return (const AnimDbCmd*)((const u8*)cmd + cmd->jump.targetOffset);
+}
+
+const char*
+animDbString(const AnimDb* db, StringId id) {
+    if (id >= db->header->labelCount)
+        return NULL;
+    
+    s32 offset = db->labelOffsets[id];
+    if ((offset < 0) || ((u64)offset >= db->header->stringsSize))
+        return NULL;
+    
+    return &db->strings[offset];
+}
+
+// Checks that the content wasn't changed since it was written (e.g. a write that was cut off).
+bool
+animDbVerify(const AnimDb* db) {
+    u64 payloadSize = db->size - sizeof(AnimDbHeader);
+    return hash64(db->data + sizeof(AnimDbHeader), payloadSize, 0) == db->header->payloadHash;
+}
+
+// The table image gets placed at the start of 'tableArena' and the strings at the start of the string arenas,
+// so all of them should be empty.
+void
+animDbRestore(const AnimDb* db, MemArena* tableArena, DynTable* dynTable,
+              MemArena* stringArena, MemArena* stringOffsetArena, LabelStrings* labels) {
+    const AnimDbHeader* header = db->header;
+    u8* table = memArenaAddMemory(tableArena, db->data + header->tableOffset, header->tableSize);
+    
+    dynTable->animations    = (DynTableAnim*)table;
+    dynTable->variantCounts = (u16*)(table + header->animCount * sizeof(DynTableAnim));
+    
+    // Turn the distances of the jumps back into pointers
+    for (u32 animId = 0; animId < header->animCount; animId++) {
+        for (u16 variantId = 0; variantId < animDbVariantCount(db, animId); variantId++) {
+            // Aliases lead to the same commands, those are only converted once.
+            if (db->animations[animId].offsetVariants < 0)
+                break;
+            
+            const AnimDbCmd* dbCmd = animDbVariant(db, animId, variantId);
+            if (dbCmd == NULL)
+                continue;
+            
+            for (;; dbCmd++) {
+                if (dbCmd->cmd.id == AnimCmd_JumpBack) {
+                    DynTableAnimCmd* cmd = (DynTableAnimCmd*)(table + ((u8*)dbCmd - (db->data + header->tableOffset)));
+                    const AnimDbCmd* target = animDbJumpTarget(dbCmd);
+                    
+                    cmd->cmd._exJump.jumpTarget = (target)
+                        ? table + ((u8*)target - (db->data + header->tableOffset))
+                        : NULL;
+                }
+                
+                if (animDbIsLastCommand(dbCmd))
+                    break;
+            }
+        }
+    }
+    
+    labels->count   = header->labelCount;
+    labels->offsets = memArenaAddMemory(stringOffsetArena, (void*)db->labelOffsets, header->labelCount * sizeof(s32));
+    labels->strings = memArenaAddMemory(stringArena, (void*)db->strings, header->stringsSize);
+}
+
+bool
+animDbIsLastCommand(const AnimDbCmd* cmd) {
+    return isLastCommand(cmd->cmd.id);
+}
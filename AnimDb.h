@@ -0,0 +1,99 @@
+#ifndef GUARD_ANIM_DB_H
+#define GUARD_ANIM_DB_H
+
+// Binary dump of the decoded animations (DynTable + variantCounts + LabelStrings).
+// Everything inside of it is addressed with offsets, so tools can map the file
+// and read it in place, without parsing the generated C/asm.
+//
+// Needs "types.h", "animation_commands.h" and "animExporter.h" (with its "Manifest.h") to be included before.
+
+#define ANIM_DB_MAGIC   "SAANIMDB"
+#define ANIM_DB_VERSION 2
+
+// +--------------------------------------+
+// |  AnimDbHeader                        |
+// +--------------------------------------+
+// |  DynTable image, as described above  |
+// |  'createDynamicAnimTable', with      |
+// |  AnimDbCmd instead of DynTableAnimCmd|
+// +--------------------------------------+
+// |  s32[labelCount] string offsets      |
+// +--------------------------------------+
+// |  char[] label strings                |
+// +--------------------------------------+
+// All sections start 8-byte aligned, all offsets are relative to the start of the file.
+typedef struct {
+    char magic[8];
+    u32 version;
+    u32 headerSize;
+    
+    u64 romHash;    // hash64() of the whole ROM file, with seed 0
+    u32 game;       // eGame
+    u32 animCount;
+    u32 cmdSize;    // sizeof(AnimDbCmd), to detect incompatible builds
+    u32 exporterVersion; // EXPORTER_VERSION of the exporter that decoded the animations
+    
+    u64 tableOffset;
+    u64 tableSize;
+    u64 labelOffsetsOffset;
+    u64 labelCount;
+    u64 stringsOffset;
+    u64 stringsSize;
+    
+    u64 payloadHash; // hash64() of everything behind the header
+} AnimDbHeader;
+
+// A DynTableAnimCmd with the 'jumpTarget' pointer of jump commands
+// replaced by the distance (in bytes) from the command to its target.
+// 0 means the target couldn't be resolved.
+typedef struct {
+    u32 flags;
+    StringId label;
+    RomPointer address;
+    RomPointer jmpTarget;
+    union {
+        ACmd cmd;
+        
+        struct {
+            s32 cmdId;
+            s32 offset;
+            s64 targetOffset;
+        } jump;
+    };
+} AnimDbCmd;
+
+typedef struct {
+    u8 *data;
+    u64 size;
+    bool isMapped;
+    
+    const AnimDbHeader *header;
+    const DynTableAnim *animations;
+    const u16 *variantCounts;
+    const s32 *labelOffsets;
+    const char *strings;
+} AnimDb;
+
+// Writing
+u64 animDbBuild(MemArena *arena, u8 **fileData, u64 romHash, u32 exporterVersion, eGame game,
+                DynTable *dynTable, u64 tableSize, u32 animCount, LabelStrings *labels, u64 stringsSize);
+bool animDbWrite(const char *path, u64 romHash, u32 exporterVersion, eGame game,
+                 DynTable *dynTable, u64 tableSize, u32 animCount, LabelStrings *labels, u64 stringsSize);
+
+// Reading
+bool animDbOpen(AnimDb *db, const char *path);
+bool animDbOpenMemory(AnimDb *db, u8 *data, u64 size);
+void animDbClose(AnimDb *db);
+bool animDbVerify(const AnimDb *db);
+
+// Copies the database back into arenas, as if the animations were just decoded
+void animDbRestore(const AnimDb *db, MemArena *tableArena, DynTable *dynTable,
+                   MemArena *stringArena, MemArena *stringOffsetArena, LabelStrings *labels);
+
+u16 animDbVariantCount(const AnimDb *db, u32 animId);
+const AnimDbCmd *animDbVariant(const AnimDb *db, u32 animId, u16 variantId);
+const AnimDbCmd *animDbJumpTarget(const AnimDbCmd *cmd);
+const char *animDbString(const AnimDb *db, StringId id);
+bool animDbIsLastCommand(const AnimDbCmd *cmd);
+
+#endif //GUARD_ANIM_DB_H
@@ -0,0 +1,306 @@
+#include <string.h>
+#include <stdio.h>
+
+#include "types.h"
+#include "ArenaAlloc.h"
+#include "Hash.h"
+#include "Manifest.h"
+#include "animation_commands.h"
+#include "animExporter.h"
+#include "AnimVm.h"
+
+// Slots of the loop detection, twice as many as there can be segments
+#define ANIM_TIMELINE_SLOT_COUNT (2 * ANIM_VM_MAX_SEGMENTS)
+
+const DynTableAnimCmd*
+animVmGetVariant(const DynTable* dynTable, u32 animCount, u32 animId, u32 variantId) {
+    if ((animId >= animCount) || (variantId >= dynTable->variantCounts[animId]))
+        return NULL;
+    
+    // Aliases hold the distance to their animation in entries, not in bytes
+    const DynTableAnim* anim = &dynTable->animations[animId];
+    while (anim->offsetVariants < 0)
+        anim += anim->offsetVariants;
+    
+    if (anim->offsetVariants == 0)
+        return NULL;
+    
+    const s32* variantOffsets = (const s32*)OffsetPointer(&anim->offsetVariants);
+    return (const DynTableAnimCmd*)OffsetPointer(&variantOffsets[variantId]);
+}
+
+void
+animVmInit(AnimVm* vm, const DynTable* dynTable, u32 animCount, u16 animId, u16 variantId) {
+    memset(vm, 0, sizeof(*vm));
+    vm->dynTable  = dynTable;
+    vm->animCount = animCount;
+    vm->cmd       = animVmGetVariant(dynTable, animCount, animId, variantId);
+    vm->animId    = animId;
+    vm->variantId = variantId;
+    vm->state.animId = animId;
+    
+    animVmNextFrame(vm, &vm->ticksLeft);
+}
+
+static void
+setHitbox(AnimVmState* state, const Hitbox* hitbox) {
+    if ((hitbox->index < 0) || (hitbox->index >= ANIM_VM_HITBOX_COUNT))
+        return;
+    
+    AnimVmHitbox* box = &state->hitboxes[hitbox->index];
+    u8 bit = 1 << hitbox->index;
+    
+    // A hitbox without any size removes it
+    if ((hitbox->left == 0) && (hitbox->top == 0) && (hitbox->right == 0) && (hitbox->bottom == 0)) {
+        memset(box, 0, sizeof(*box));
+        state->hitboxMask &= ~bit;
+    } else {
+        box->left   = hitbox->left;
+        box->top    = hitbox->top;
+        box->right  = hitbox->right;
+        box->bottom = hitbox->bottom;
+        state->hitboxMask |= bit;
+    }
+}
+
+bool
+animVmNextFrame(AnimVm* vm, u32* ticks) {
+    AnimVmState* state = &vm->state;
+    vm->tileBytes    = 0;
+    vm->paletteBytes = 0;
+    
+    for (u32 executed = 0; vm->cmd != NULL; executed++) {
+        if (executed == ANIM_VM_MAX_COMMANDS) {
+            vm->cmd = NULL;
+            vm->isTruncated = TRUE;
+            break;
+        }
+        
+        const DynTableAnimCmd* cmd = vm->cmd;
+        s32 id = cmd->cmd.id;
+        
+        if (id >= 0) {
+            state->frameIndex = cmd->cmd._display.frameIndex;
+            vm->frameCmd = cmd;
+            vm->cmd = cmd + 1;
+            
+            // Frames that are shown for 0 ticks get replaced before the screen gets updated
+            if (cmd->cmd._display.displayForNFrames > 0) {
+                *ticks = cmd->cmd._display.displayForNFrames;
+                return TRUE;
+            }
+            
+            continue;
+        }
+        
+        switch (id) {
+        case AnimCmd_GetTiles: {
+            state->tileIndex = cmd->cmd._tiles.tileIndex;
+            state->hasTiles  = TRUE;
+                
+            // 8bpp tiles have a negative index
+            u32 tileSize = (state->tileIndex < 0) ? TILE_SIZE_8BPP : TILE_SIZE_4BPP;
+            vm->tileBytes += cmd->cmd._tiles.numTilesToCopy * tileSize;
+            vm->cmd++;
+        } break;
+            
+        case AnimCmd_GetPalette: {
+            state->paletteId = cmd->cmd._pal.palId;
+            vm->paletteBytes += cmd->cmd._pal.numColors * sizeof(u16);
+            vm->cmd++;
+        } break;
+            
+        case AnimCmd_AddHitbox: {
+            setHitbox(state, &cmd->cmd._hitbox.hitbox);
+            vm->cmd++;
+        } break;
+            
+        case AnimCmd_TranslateSprite: {
+            state->translateX = (s16)cmd->cmd._translate.x;
+            state->translateY = (s16)cmd->cmd._translate.y;
+            vm->cmd++;
+        } break;
+            
+        // Jumps that couldn't be resolved stop the sprite, like 'End'
+        case AnimCmd_JumpBack: {
+            vm->cmd = cmd->cmd._exJump.jumpTarget;
+        } break;
+            
+        case AnimCmd_SetIdAndVariant: {
+            u16 animId    = cmd->cmd._animId.animId;
+            u16 variantId = cmd->cmd._animId.variant;
+                
+            vm->cmd = animVmGetVariant(vm->dynTable, vm->animCount, animId, variantId);
+            vm->animId    = animId;
+            vm->variantId = variantId;
+            state->animId = animId;
+        } break;
+            
+        case AnimCmd_End: {
+            vm->cmd = NULL;
+        } break;
+            
+        default: {
+            // Sounds, priorities and the like don't change the state.
+            // Anything that isn't a command at all ends the variant, like in 'iterateAllCommandsFused'.
+            if (id < AnimCmd_12)
+                vm->cmd = NULL;
+            else
+                vm->cmd++;
+        } break;
+        }
+    }
+    
+    return FALSE;
+}
+
+void
+animVmStep(AnimVm* vm) {
+    vm->tick++;
+    
+    if (vm->ticksLeft > 1) {
+        vm->ticksLeft--;
+    } else if (!animVmNextFrame(vm, &vm->ticksLeft)) {
+        vm->ticksLeft = 0;
+    }
+}
+
+u32
+animTimelineBuild(MemArena* arena, const DynTable* dynTable, u32 animCount, u16 animId, u16 variantId,
+                  AnimTimeline* timeline) {
+    u64 checkpoint = memArenaCheckpoint(arena);
+    
+    // Open addressing over the segments, by the animation, variant and 'Display' command they start with.
+    // Each slot holds the index of a segment + 1 (0 = empty).
+    u32* slots = memArenaPushArray(arena, u32, ANIM_TIMELINE_SLOT_COUNT);
+    u64* keys  = memArenaPushArrayNoZero(arena, u64, ANIM_VM_MAX_SEGMENTS * 2);
+    
+    AnimTimelineSegment* segments = NULL;
+    u32 segmentCount = 0;
+    u32 tick = 0;
+    
+    timeline->kind = ANIM_TIMELINE_ENDS;
+    timeline->loopSegment = 0;
+    timeline->loopTileBytes    = 0;
+    timeline->loopPaletteBytes = 0;
+    
+    AnimVm vm;
+    animVmInit(&vm, dynTable, animCount, animId, variantId);
+    
+    for (u32 ticks = vm.ticksLeft; ticks > 0;) {
+        u64 key[2] = {
+            (u64)(size_t)vm.frameCmd,
+            ((u64)vm.animId << 16) | vm.variantId,
+        };
+        u32 slot = (u32)hash64(key, sizeof(key), 0) & (ANIM_TIMELINE_SLOT_COUNT - 1);
+        bool isRepeating = FALSE;
+        
+        // The same command can start segments with different states, the state decides whether it repeats.
+        for (; slots[slot] != 0; slot = (slot + 1) & (ANIM_TIMELINE_SLOT_COUNT - 1)) {
+            u32 index = slots[slot] - 1;
+            
+            if ((keys[index * 2] == key[0]) && (keys[index * 2 + 1] == key[1])
+                && !memcmp(&segments[index].state, &vm.state, sizeof(AnimVmState))) {
+                timeline->kind = ANIM_TIMELINE_LOOPS;
+                timeline->loopSegment = index;
+                timeline->loopTileBytes    = vm.tileBytes;
+                timeline->loopPaletteBytes = vm.paletteBytes;
+                isRepeating = TRUE;
+                break;
+            }
+        }
+        
+        if (isRepeating)
+            break;
+        
+        if ((segmentCount == ANIM_VM_MAX_SEGMENTS) || (tick + ticks < tick)) {
+            timeline->kind = ANIM_TIMELINE_TRUNCATED;
+            break;
+        }
+        
+        // Nothing else gets pushed in the meantime, so the segments stay contiguous.
+        AnimTimelineSegment* segment = memArenaPushArrayNoZero(arena, AnimTimelineSegment, 1);
+        if (segments == NULL)
+            segments = segment;
+        
+        segment->startTick    = tick;
+        segment->tileBytes    = vm.tileBytes;
+        segment->paletteBytes = vm.paletteBytes;
+        segment->state        = vm.state;
+        
+        keys[segmentCount * 2]     = key[0];
+        keys[segmentCount * 2 + 1] = key[1];
+        slots[slot] = ++segmentCount;
+        tick += ticks;
+        
+        if (!animVmNextFrame(&vm, &ticks))
+            ticks = 0;
+    }
+    
+    if (vm.isTruncated)
+        timeline->kind = ANIM_TIMELINE_TRUNCATED;
+    
+    // Only the segments stay, where the loop detection started
+    memArenaRestore(arena, checkpoint);
+    
+    u64 size = segmentCount * sizeof(AnimTimelineSegment);
+    timeline->segments = (segmentCount > 0) ? memArenaReserveNoZero(arena, size) : NULL;
+    if (segmentCount > 0)
+        memmove(timeline->segments, segments, size);
+    
+    timeline->segmentCount = segmentCount;
+    timeline->totalTicks   = tick;
+    return segmentCount;
+}
+
+u32
+animTimelineFind(const AnimTimeline* timeline, u32 tick) {
+    const AnimTimelineSegment* segments = timeline->segments;
+    
+    if (tick >= timeline->totalTicks) {
+        if (timeline->kind != ANIM_TIMELINE_LOOPS)
+            return timeline->segmentCount - 1;
+        
+        u32 loopStart = segments[timeline->loopSegment].startTick;
+        tick = loopStart + (tick - loopStart) % (timeline->totalTicks - loopStart);
+    }
+    
+    // Last segment that starts at or before 'tick'
+    u32 low = 0;
+    u32 high = timeline->segmentCount - 1;
+    while (low < high) {
+        u32 middle = low + (high - low + 1) / 2;
+        
+        if (segments[middle].startTick <= tick)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    
+    return low;
+}
+
+u64
+animTimelineFileBuild(MemArena* arena, u8** fileData, const AnimTimelineVariant* variants, u32 variantCount,
+                      const AnimTimelineSegment* segments, u32 segmentCount) {
+    AnimTimelineHeader header = { 0 };
+    memcpy(header.magic, ANIM_TIMELINE_MAGIC, sizeof(header.magic));
+    header.version        = ANIM_TIMELINE_VERSION;
+    header.headerSize     = sizeof(AnimTimelineHeader);
+    header.variantCount   = variantCount;
+    header.segmentCount   = segmentCount;
+    header.variantsOffset = sizeof(AnimTimelineHeader);
+    header.segmentsOffset = header.variantsOffset + (u64)variantCount * sizeof(AnimTimelineVariant);
+    
+    u64 size = header.segmentsOffset + (u64)segmentCount * sizeof(AnimTimelineSegment);
+    u8* data = memArenaPushArrayNoZero(arena, u8, size);
+    
+    memcpy(data, &header, sizeof(header));
+    if (variantCount > 0)
+        memcpy(&data[header.variantsOffset], variants, variantCount * sizeof(AnimTimelineVariant));
+    if (segmentCount > 0)
+        memcpy(&data[header.segmentsOffset], segments, segmentCount * sizeof(AnimTimelineSegment));
+    
+    *fileData = data;
+    return size;
+}
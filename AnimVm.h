@@ -0,0 +1,153 @@
+#ifndef GUARD_ANIM_VM_H
+#define GUARD_ANIM_VM_H
+
+// Runs the commands of an animation variant the way the game does, one tick (= one frame at 60 fps) at a time:
+// which frame is shown with which tiles and palette, the hitboxes and the translation of the sprite.
+// 'JumpBack' and 'SetIdAndVariant' are followed like in the game.
+//
+// Running a variant until it ends or repeats gives its timeline, with one segment per shown frame.
+// The commands are the only thing that changes the state, so a variant repeats once it gets to the same
+// command (found by hashing animation, variant and command) with the same state again.
+// Any tick of a timeline can then be looked up with a binary search over the segments' start ticks.
+//
+// The VM also counts the bytes that 'GetTiles' (into VRAM) and 'GetPalette' (into the palette buffer)
+// copy before each frame, which is what the game has to DMA when the frame changes.
+//
+// Needs "types.h", "ArenaAlloc.h", "animation_commands.h" and "animExporter.h" to be included before.
+
+#define ANIM_TIMELINE_MAGIC   "SATIMELN"
+#define ANIM_TIMELINE_VERSION 2
+
+// Hitboxes with a higher index get ignored
+#define ANIM_VM_HITBOX_COUNT 4
+
+// Limits for variants that never end or repeat:
+// Commands until a frame gets shown, and segments of a timeline
+#define ANIM_VM_MAX_COMMANDS 4096
+#define ANIM_VM_MAX_SEGMENTS 4096
+
+typedef struct {
+    s8 left;
+    s8 top;
+    s8 right;
+    s8 bottom;
+} AnimVmHitbox;
+
+// Everything the commands of an animation change about a sprite.
+// Unused parts stay 0, so two states can be compared with memcmp.
+typedef struct {
+    u16 animId;       // Whose frames get shown, 'SetIdAndVariant' changes it
+    u16 frameIndex;
+    s32 tileIndex;    // Of the last 'GetTiles', negative for 8bpp tiles
+    s32 paletteId;    // Of the last 'GetPalette'
+    s16 translateX;   // Of the last 'TranslateSprite'
+    s16 translateY;
+    u8 hasTiles;      // FALSE until the first 'GetTiles'
+    u8 hitboxMask;    // Bit i is set if 'hitboxes[i]' is active
+    u16 reserved;
+    AnimVmHitbox hitboxes[ANIM_VM_HITBOX_COUNT];
+} AnimVmState;
+
+typedef struct {
+    const DynTable *dynTable;
+    u32 animCount;
+    
+    const DynTableAnimCmd *cmd;      // Next command, NULL once the variant ended
+    const DynTableAnimCmd *frameCmd; // 'Display' command of the frame that is shown
+    u16 animId;                      // Variant the commands belong to
+    u16 variantId;
+    bool isTruncated;                // Stopped at ANIM_VM_MAX_COMMANDS, not by the commands
+    u32 tileBytes;                   // Copied by the commands that led to the frame that is shown
+    u32 paletteBytes;
+    
+    u32 tick;                        // Ticks since the start
+    u32 ticksLeft;                   // Until the next frame, including this tick (0 after the end)
+    AnimVmState state;
+} AnimVm;
+
+// First command of a variant, or NULL if there is no such variant.
+// Aliases run the commands of the animation they point at.
+const DynTableAnimCmd *animVmGetVariant(const DynTable *dynTable, u32 animCount, u32 animId, u32 variantId);
+
+// Starts a variant: runs its commands up to the first frame that gets shown (tick 0).
+// 'ticksLeft' is 0 if there is none.
+void animVmInit(AnimVm *vm, const DynTable *dynTable, u32 animCount, u16 animId, u16 variantId);
+
+// Runs commands until a frame gets shown for at least one tick, and returns for how many ticks.
+// Returns FALSE if the variant ended before that.
+// 'tileBytes' and 'paletteBytes' start over with every call.
+bool animVmNextFrame(AnimVm *vm, u32 *ticks);
+
+// Goes one tick further: 'state' is what the sprite looks like at 'tick' afterwards.
+// After the end of a variant, its last frame stays.
+void animVmStep(AnimVm *vm);
+
+// A frame of a timeline, shown from 'startTick' until the next segment starts
+typedef struct {
+    u32 startTick;
+    u32 tileBytes;    // Copied right before the segment starts
+    u32 paletteBytes;
+    AnimVmState state;
+} AnimTimelineSegment;
+
+#define ANIM_TIMELINE_ENDS      0 // The last segment stays forever
+#define ANIM_TIMELINE_LOOPS     1 // After the last segment, it continues with 'loopSegment'
+#define ANIM_TIMELINE_TRUNCATED 2 // Neither ended nor repeated within the limits above
+
+typedef struct {
+    AnimTimelineSegment *segments;
+    u32 segmentCount;
+    u32 totalTicks;  // Until the end of the last segment
+    u32 loopSegment;
+    u32 kind;        // ANIM_TIMELINE_*
+    
+    // Copied when a loop goes back to 'loopSegment', instead of what the segment says
+    u32 loopTileBytes;
+    u32 loopPaletteBytes;
+} AnimTimeline;
+
+// Pushes the segments of a variant into 'arena', and returns how many there are.
+// The arena gets used for the loop detection as well, but only the segments stay.
+u32 animTimelineBuild(MemArena *arena, const DynTable *dynTable, u32 animCount, u16 animId, u16 variantId,
+                      AnimTimeline *timeline);
+
+// Segment that is shown at 'tick' (going around the loop as often as needed), in O(log n).
+// The timeline needs at least one segment.
+u32 animTimelineFind(const AnimTimeline *timeline, u32 tick);
+
+// +--------------------------------------+
+// |  AnimTimelineHeader                  |
+// +--------------------------------------+
+// |  AnimTimelineVariant[variantCount],  |
+// |  sorted by animation, then variant   |
+// +--------------------------------------+
+// |  AnimTimelineSegment[segmentCount]   |
+// +--------------------------------------+
+// All offsets are relative to the start of the file.
+typedef struct {
+    char magic[8];
+    u32 version;
+    u32 headerSize;
+    
+    u32 variantCount;
+    u32 segmentCount;
+    u64 variantsOffset;
+    u64 segmentsOffset;
+} AnimTimelineHeader;
+
+typedef struct {
+    u16 animId;
+    u16 variantId;
+    u32 firstSegment; // Segments of the variant are 'firstSegment' to 'firstSegment + segmentCount - 1'
+    u32 segmentCount;
+    u32 totalTicks;
+    u32 loopSegment;  // Relative to 'firstSegment'
+    u32 kind;
+    u32 loopTileBytes;
+    u32 loopPaletteBytes;
+} AnimTimelineVariant;
+
+u64 animTimelineFileBuild(MemArena *arena, u8 **fileData, const AnimTimelineVariant *variants, u32 variantCount,
+                          const AnimTimelineSegment *segments, u32 segmentCount);
+
+#endif //GUARD_ANIM_VM_H
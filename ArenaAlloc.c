@@ -6,15 +6,12 @@
 #ifdef __unix__
 #include <errno.h>
 
-#define _GNU_SOURCE 1
 #include <unistd.h>
 #include <sys/mman.h>
 
-// This should be defined in sys/mman.h - why isn't it?
-#define MREMAP_MAYMOVE   1
-#define MREMAP_FIXED     2
-#define MREMAP_DONTUNMAP 4
-void *mremap(void *old_address, size_t old_size, size_t new_size, int flags, void*);
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
 #else
 #ifdef _MSC_VER
 #include <Windows.h>
@@ -25,9 +22,14 @@ void *mremap(void *old_address, size_t old_size, size_t new_size, int flags, voi
 #include "types.h"
 #include "ArenaAlloc.h"
 
-#define ARENA_SIZE (512*1024*1024)
+// Address space every arena reserves up front. Only the part that is
+// actually used gets committed, so this costs no physical memory.
+// Keeping the base address fixed is what allows us to keep pointers
+// and offsets into arenas while they grow.
+#define ARENA_RESERVE_SIZE ((sizeof(void*) == 8) ? GetGigabytes(64) : (512*1024*1024))
 
-static void memArenaExpand(MemArena *arena, s32 numNewArenas);
+// Memory gets committed in steps of this size.
+#define ARENA_COMMIT_SIZE  (1024*1024)
 
 // I have no idea why this is necessary.
 // VirtualAlloc's 2nd parameter accepts a SIZE_T, but
@@ -38,67 +40,56 @@ u64 GetGigabytes(u64 num) {
     return num*1024*1024*1024;
 }
 
-static void *memArenaVirtualAlloc(void* baseAddress, size_t size) {
+// Reserve address space without backing it with memory yet.
+static void *memArenaVirtualReserve(size_t size) {
     assert(size > 0);
     
     void* memory = NULL;
     
-    // TODO/TEMP: Just reserve ARENA_SIZE for each arena
-    u64 memoryAmount = ARENA_SIZE;
-    
     // Call OS-specific memory alloc function
 #ifdef __unix__
-    memory = mmap(baseAddress, size, (PROT_READ | PROT_WRITE), (MAP_PRIVATE | MAP_ANONYMOUS), -1, 0);
+    memory = mmap(NULL, size, PROT_NONE, (MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE), -1, 0);
     if(memory == MAP_FAILED) {
         printf("ERROR: Call to mmap failed! (Errno: %d)\n", errno);
         return NULL;
     }
 #else
 #ifdef _MSC_VER
-    memory = VirtualAlloc(baseAddress, memoryAmount, (MEM_COMMIT | MEM_RESERVE), PAGE_READWRITE);
+    memory = VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
 #endif
 #endif
     
     return memory;
 }
 
-static void *memArenaVirtualRealloc(void* memory, size_t oldSize, size_t newSize) {
-    assert(newSize > 0);
-    
-    void *oldAddress = memory;
+// Make a range of previously reserved address space usable.
+static bool memArenaVirtualCommit(void* address, size_t size) {
+    assert(size > 0);
     
-#if 1
-    // TODO: If there's a way to allocate more memory while keeping the base address,
-    //       do it on all platforms instead of just allocating 4GB in the beginning.
-    void *newAddress = oldAddress;
-#else
-    printf("OldMem: %p - PageSize: 0x%X\n", oldAddress, (u32)oldSize);
 #ifdef __unix__
-    newAddress = mremap(oldAddress, oldSize, oldSize/2, 0, NULL);
-    if((newAddress == MAP_FAILED)) {
-        printf("ERROR: Call to mremap failed! (Errno: %d)\n", errno);
-        return NULL;
+    if(mprotect(address, size, (PROT_READ | PROT_WRITE)) != 0) {
+        printf("ERROR: Call to mprotect failed! (Errno: %d)\n", errno);
+        return FALSE;
     }
 #else
 #ifdef _MSC_VER
-    
-#endif
+    if(VirtualAlloc(address, size, MEM_COMMIT, PAGE_READWRITE) == NULL) {
+        printf("ERROR: Call to VirtualAlloc failed! (Error: %lu)\n", GetLastError());
+        return FALSE;
+    }
 #endif
 #endif
     
-    // If the addresses are different, pointers would be wrong
-    assert(oldAddress == newAddress);
-    
-    return newAddress;
+    return TRUE;
 }
 
 static void memArenaVirtualFree(MemArena* arena) {
     if(arena->memory) {
 #ifdef __unix__
-        munmap(arena->memory, arena->size);
+        munmap(arena->memory, arena->reserved);
 #else
 #ifdef _MSC_VER
-        VirtualFree(arena->memory, arena->size, MEM_RELEASE);
+        VirtualFree(arena->memory, 0, MEM_RELEASE);
 #endif
 #endif
     }
@@ -106,9 +97,9 @@ static void memArenaVirtualFree(MemArena* arena) {
 
 void
 memArenaInit(MemArena *arena) {
-    void* newMem = memArenaVirtualAlloc(NULL, ARENA_SIZE); 
-    arena->memory = newMem;
-    arena->size = ARENA_SIZE;
+    arena->memory = memArenaVirtualReserve(ARENA_RESERVE_SIZE);
+    arena->reserved = ARENA_RESERVE_SIZE;
+    arena->size = 0;
     arena->offset = 0;
     
     assert(arena->memory);
@@ -117,6 +108,10 @@ memArenaInit(MemArena *arena) {
 void
 memArenaFree(MemArena *arena) {
     memArenaVirtualFree(arena);
+    arena->memory = NULL;
+    arena->reserved = 0;
+    arena->size = 0;
+    arena->offset = 0;
 }
 
 // Reserve 'byteCount' amount of memory and set it to zero.
@@ -125,33 +120,15 @@ memArenaReserve(MemArena *arena, u64 byteCount) {
     if (byteCount == 0)
         return NULL;
     
-    ALIGN(arena->offset, 4);
-    
-    if(arena->size < (arena->offset + byteCount)) {
-        // TODO: There's a bug that stems from realloc returning a different address after calling it.
-        //       Use VirtualAlloc and the Unix-equivalent to fix that.
-        //       That's why we're asserting here.
-        // Allocate more memory upfront for now, if you reach this assert!
-        assert(FALSE);
-        
-        int newArenaCount = ((arena->offset + byteCount) - arena->size);
-        newArenaCount /= ARENA_SIZE;
-        newArenaCount += 1;
-        
-        memArenaExpand(arena, newArenaCount);
-    }
-    
-    u8* memory = ((u8*)arena->memory + arena->offset);
+    void* memory = memArenaReserveNoZero(arena, byteCount);
     memset(memory, 0, byteCount);
     
-    arena->offset += byteCount;
-    
     return memory;
 }
 
 void*
 memArenaAddMemory(MemArena *arena, void *source, u64 srcLength) {
-    u8* dest = memArenaReserve(arena, srcLength);
+    u8* dest = memArenaReserveNoZero(arena, srcLength);
     
     memcpy(dest, source, srcLength);
     
@@ -168,85 +145,51 @@ memArenaAddString(MemArena *arena, char *source) {
     return str;
 }
 
-u64*
-memArenaAddU64(MemArena *arena, u64 number) {
-    ALIGN(arena->offset, 8);
-    u64* targetMem;
-    
-    if(arena->size < arena->offset + sizeof(number)) {
-        memArenaExpand(arena, 1);
-    }
-    
-    targetMem = (u64*)((u8*)arena->memory + arena->offset);
-    *targetMem = number;
-    arena->offset += sizeof(number);
-    
-    return targetMem;
+// Current offset of the arena, pass it to 'memArenaRestore' to free everything reserved after this call.
+unsigned long long
+memArenaCheckpoint(MemArena *arena) {
+    return arena->offset;
 }
 
-u32*
-memArenaAddU32(MemArena *arena, u32 number) {
-    ALIGN(arena->offset, 4);
-    u32* targetMem;
-    
-    if(arena->size < arena->offset + sizeof(number)) {
-        memArenaExpand(arena, 1);
-    }
-    
-    targetMem = (u32*)((u8*)arena->memory + arena->offset);
-    *targetMem = number;
-    arena->offset += sizeof(number);
-    
-    return targetMem;
+// Free everything that was reserved after 'checkpoint' was taken.
+// The memory stays committed, so the arena can quickly be refilled.
+void
+memArenaRestore(MemArena *arena, unsigned long long checkpoint) {
+    assert(checkpoint <= arena->offset);
+    arena->offset = checkpoint;
 }
 
-u16*
-memArenaAddU16(MemArena *arena, u16 number) {
-    ALIGN(arena->offset, 2);
-    u16* targetMem;
+// Start a scope of temporary allocations in 'arena', which get freed by 'memArenaEndTemp'.
+// Scopes can be nested, as long as they are ended in reverse order.
+MemArenaTemp
+memArenaBeginTemp(MemArena *arena) {
+    MemArenaTemp temp;
+    temp.arena = arena;
+    temp.checkpoint = memArenaCheckpoint(arena);
     
-    if(arena->size < arena->offset + sizeof(number)) {
-        memArenaExpand(arena, 1);
-    }
-    
-    targetMem = (u16*)((u8*)arena->memory + arena->offset);
-    *targetMem = number;
-    arena->offset += sizeof(number);
-    
-    return targetMem;
+    return temp;
 }
 
-u8*
-memArenaAddU8(MemArena *arena, u8 number) {
-    u8* targetMem;
-    
-    if(arena->size < arena->offset + sizeof(number)) {
-        memArenaExpand(arena, 1);
-    }
-    
-    targetMem = ((u8*)arena->memory + arena->offset);
-    *targetMem = number;
-    arena->offset += sizeof(number);
-    
-    return targetMem;
+void
+memArenaEndTemp(MemArenaTemp temp) {
+    memArenaRestore(temp.arena, temp.checkpoint);
 }
 
-static void
-memArenaExpand(MemArena *arena, s32 numNewArenas) {
-    long long newSize;
-    
-    if(numNewArenas <= 0) {
-        numNewArenas = 1;
+// Commit enough memory for the arena to hold 'requiredSize' bytes.
+// The base address never changes, so existing pointers stay valid.
+void
+memArenaCommit(MemArena *arena, u64 requiredSize) {
+    u64 newSize = requiredSize;
+    ALIGN(newSize, ARENA_COMMIT_SIZE);
+    
+    if(newSize > arena->reserved) {
+        fprintf(stderr, "ERROR: Arena ran out of reserved address space (0x%llX of 0x%llX bytes requested).\n",
+                requiredSize, arena->reserved);
+        exit(-5);
     }
     
-    newSize = arena->size + ARENA_SIZE*numNewArenas;
+    bool committed = memArenaVirtualCommit((u8*)arena->memory + arena->size, newSize - arena->size);
+    assert(committed);
     
-    // Check for overflow
-    assert(newSize > 0);
-    
-    // @BUG @SPEED
-    // malloc only takes an int, use VirtualAlloc() instead...
-    arena->memory = memArenaVirtualRealloc(arena->memory, arena->size, newSize);
-    assert(arena->memory);
     arena->size = newSize;
 }
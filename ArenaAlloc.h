@@ -3,18 +3,118 @@
 
 typedef struct {
     void *memory;
-    long long size;
+    long long size;              // committed bytes, grows on demand
+    unsigned long long reserved; // reserved address space, fixed at init
     unsigned long long offset;
 } MemArena;
 
+// Marks a point in an arena, everything reserved after it can be released at once.
+typedef struct {
+    MemArena *arena;
+    unsigned long long checkpoint;
+} MemArenaTemp;
+
 void memArenaInit(MemArena*);
 void memArenaFree(MemArena *arena);
+void memArenaCommit(MemArena *arena, u64 requiredSize);
 void* memArenaReserve(MemArena* arena, u64 srcLength);
 void *memArenaAddMemory(MemArena *arena, void *source, u64 srcLength);
 char *memArenaAddString(MemArena *arena, char *source);
-u64 *memArenaAddU64(MemArena *arena, u64 number);
-u32 *memArenaAddU32(MemArena *arena, u32 number);
-u16 *memArenaAddU16(MemArena *arena, u16 number);
-u8  *memArenaAddU8 (MemArena *arena,  u8 number);
+
+unsigned long long memArenaCheckpoint(MemArena *arena);
+void memArenaRestore(MemArena *arena, unsigned long long checkpoint);
+
+MemArenaTemp memArenaBeginTemp(MemArena *arena);
+void memArenaEndTemp(MemArenaTemp temp);
+
+// Reserve an array of 'count' elements of 'type'
+#define memArenaPushArray(arena, type, count)       ((type*)memArenaReserve((arena), sizeof(type) * (count)))
+#define memArenaPushArrayNoZero(arena, type, count) ((type*)memArenaReserveNoZero((arena), sizeof(type) * (count)))
+
+// The functions below are called for every little piece of data that gets decoded,
+// so they live in the header to allow the compiler to inline them.
+// Only committing new memory goes through a function call.
+
+// Like 'memArenaReserve', but the memory is NOT set to zero.
+// Use it when every byte gets written right away.
+static inline void*
+memArenaReserveNoZero(MemArena *arena, u64 byteCount) {
+    if (byteCount == 0)
+        return NULL;
+    
+    ALIGN(arena->offset, 4);
+    
+    if((u64)arena->size < (arena->offset + byteCount)) {
+        memArenaCommit(arena, arena->offset + byteCount);
+    }
+    
+    void* memory = ((u8*)arena->memory + arena->offset);
+    arena->offset += byteCount;
+    
+    return memory;
+}
+
+static inline u64*
+memArenaAddU64(MemArena *arena, u64 number) {
+    ALIGN(arena->offset, 8);
+    u64* targetMem;
+    
+    if((u64)arena->size < arena->offset + sizeof(number)) {
+        memArenaCommit(arena, arena->offset + sizeof(number));
+    }
+    
+    targetMem = (u64*)((u8*)arena->memory + arena->offset);
+    *targetMem = number;
+    arena->offset += sizeof(number);
+    
+    return targetMem;
+}
+
+static inline u32*
+memArenaAddU32(MemArena *arena, u32 number) {
+    ALIGN(arena->offset, 4);
+    u32* targetMem;
+    
+    if((u64)arena->size < arena->offset + sizeof(number)) {
+        memArenaCommit(arena, arena->offset + sizeof(number));
+    }
+    
+    targetMem = (u32*)((u8*)arena->memory + arena->offset);
+    *targetMem = number;
+    arena->offset += sizeof(number);
+    
+    return targetMem;
+}
+
+static inline u16*
+memArenaAddU16(MemArena *arena, u16 number) {
+    ALIGN(arena->offset, 2);
+    u16* targetMem;
+    
+    if((u64)arena->size < arena->offset + sizeof(number)) {
+        memArenaCommit(arena, arena->offset + sizeof(number));
+    }
+    
+    targetMem = (u16*)((u8*)arena->memory + arena->offset);
+    *targetMem = number;
+    arena->offset += sizeof(number);
+    
+    return targetMem;
+}
+
+static inline u8*
+memArenaAddU8(MemArena *arena, u8 number) {
+    u8* targetMem;
+    
+    if((u64)arena->size < arena->offset + sizeof(number)) {
+        memArenaCommit(arena, arena->offset + sizeof(number));
+    }
+    
+    targetMem = ((u8*)arena->memory + arena->offset);
+    *targetMem = number;
+    arena->offset += sizeof(number);
+    
+    return targetMem;
+}
 
 #endif //GUARD_ARENA_ALLOC_H
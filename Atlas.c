@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "types.h"
+#include "ArenaAlloc.h"
+#include "Atlas.h"
+
+void
+skylineInit(SkylinePacker* packer, u32 width, u32 maxHeight) {
+    memset(packer, 0, sizeof(*packer));
+    memArenaInit(&packer->nodeArena);
+    skylineReset(packer, width, maxHeight);
+}
+
+// Starts over with an empty sheet
+void
+skylineReset(SkylinePacker* packer, u32 width, u32 maxHeight) {
+    packer->width      = width;
+    packer->maxHeight  = maxHeight;
+    packer->usedHeight = 0;
+    
+    memArenaRestore(&packer->nodeArena, 0);
+    packer->nodes = memArenaPushArray(&packer->nodeArena, SkylineNode, 1);
+    packer->nodes[0].x     = 0;
+    packer->nodes[0].y     = 0;
+    packer->nodes[0].width = width;
+    packer->nodeCount = 1;
+}
+
+void
+skylineFree(SkylinePacker* packer) {
+    memArenaFree(&packer->nodeArena);
+}
+
+// Returns how far down a rectangle has to go to fit with its left edge at node 'index',
+// or -1 if it sticks out of the sheet there.
+static s64
+skylineFit(SkylinePacker* packer, u32 index, u32 width, u32 height) {
+    if (packer->nodes[index].x + width > packer->width)
+        return -1;
+    
+    // The nodes cover the whole width, so this stays inside of them
+    u32 y = 0;
+    for (u32 covered = 0; covered < width; index++) {
+        y = Max(y, packer->nodes[index].y);
+        covered += packer->nodes[index].width;
+    }
+    
+    return (y + height <= packer->maxHeight) ? (s64)y : -1;
+}
+
+// Puts a rectangle where its bottom edge ends up highest up (and leftmost, for ties).
+// Returns FALSE if it doesn't fit anywhere anymore.
+bool
+skylineInsert(SkylinePacker* packer, u32 width, u32 height, u32* x, u32* y) {
+    u32 bestIndex = packer->nodeCount;
+    u32 bestBottom = 0xFFFFFFFF;
+    
+    for (u32 i = 0; i < packer->nodeCount; i++) {
+        s64 fitY = skylineFit(packer, i, width, height);
+        
+        if ((fitY >= 0) && ((u32)fitY + height < bestBottom)) {
+            bestBottom = (u32)fitY + height;
+            bestIndex = i;
+        }
+    }
+    
+    if (bestIndex == packer->nodeCount)
+        return FALSE;
+    
+    *x = packer->nodes[bestIndex].x;
+    *y = bestBottom - height;
+    packer->usedHeight = Max(packer->usedHeight, bestBottom);
+    
+    // The new node replaces what it covers of the nodes from 'bestIndex' on.
+    memArenaPushArrayNoZero(&packer->nodeArena, SkylineNode, 1);
+    SkylineNode* nodes = packer->nodes;
+    memmove(&nodes[bestIndex + 1], &nodes[bestIndex], (packer->nodeCount - bestIndex) * sizeof(SkylineNode));
+    packer->nodeCount++;
+    
+    nodes[bestIndex].x     = *x;
+    nodes[bestIndex].y     = bestBottom;
+    nodes[bestIndex].width = width;
+    
+    u32 right = *x + width;
+    u32 next = bestIndex + 1;
+    while ((next < packer->nodeCount) && (nodes[next].x < right)) {
+        u32 nodeRight = nodes[next].x + nodes[next].width;
+        
+        if (nodeRight <= right) {
+            memmove(&nodes[next], &nodes[next + 1], (packer->nodeCount - next - 1) * sizeof(SkylineNode));
+            packer->nodeCount--;
+        } else {
+            nodes[next].x     = right;
+            nodes[next].width = nodeRight - right;
+            break;
+        }
+    }
+    
+    // Neighbours at the same height become one node
+    for (u32 i = 0; i + 1 < packer->nodeCount;) {
+        if (nodes[i].y == nodes[i + 1].y) {
+            nodes[i].width += nodes[i + 1].width;
+            memmove(&nodes[i + 1], &nodes[i + 2], (packer->nodeCount - i - 2) * sizeof(SkylineNode));
+            packer->nodeCount--;
+        } else {
+            i++;
+        }
+    }
+    
+    memArenaRestore(&packer->nodeArena, packer->nodeCount * sizeof(SkylineNode));
+    return TRUE;
+}
+
+// Tallest first, then widest
+static int
+compareRects(const void* a, const void* b) {
+    const AtlasRect* rectA = *(const AtlasRect* const*)a;
+    const AtlasRect* rectB = *(const AtlasRect* const*)b;
+    
+    if (rectA->height != rectB->height)
+        return (rectA->height < rectB->height) ? 1 : -1;
+    if (rectA->width != rectB->width)
+        return (rectA->width < rectB->width) ? 1 : -1;
+    
+    return (rectA < rectB) ? -1 : (rectA > rectB);
+}
+
+u32
+atlasPack(MemArena* scratch, MemArena* sheets, AtlasRect* rects, u32 rectCount, u32 sheetWidth, u32 firstSheetId) {
+    if (rectCount == 0)
+        return 0;
+    
+    MemArenaTemp packScope = memArenaBeginTemp(scratch);
+    
+    AtlasRect** order = memArenaPushArrayNoZero(scratch, AtlasRect*, rectCount);
+    for (u32 i = 0; i < rectCount; i++)
+        order[i] = &rects[i];
+    qsort(order, rectCount, sizeof(*order), compareRects);
+    
+    SkylinePacker packer;
+    skylineInit(&packer, sheetWidth, ATLAS_MAX_SHEET_SIZE);
+    
+    AtlasSheet* sheet = NULL;
+    u32 sheetCount = 0;
+    
+    for (u32 i = 0; i < rectCount; i++) {
+        AtlasRect* rect = order[i];
+        
+        // A sheet only gets closed once something doesn't fit anymore
+        if ((sheet == NULL) || !skylineInsert(&packer, rect->width, rect->height, &rect->x, &rect->y)) {
+            if (sheet)
+                sheet->height = (u16)packer.usedHeight;
+            
+            skylineReset(&packer, sheetWidth, ATLAS_MAX_SHEET_SIZE);
+            sheet = memArenaPushArray(sheets, AtlasSheet, 1);
+            sheet->width = (u16)sheetWidth;
+            sheetCount++;
+            
+            bool fits = skylineInsert(&packer, rect->width, rect->height, &rect->x, &rect->y);
+            assert(fits);
+        }
+        
+        rect->sheetId = firstSheetId + sheetCount - 1;
+    }
+    sheet->height = (u16)packer.usedHeight;
+    
+    skylineFree(&packer);
+    memArenaEndTemp(packScope);
+    
+    return sheetCount;
+}
+
+u32
+atlasGetSheetWidth(const AtlasRect* rects, u32 rectCount) {
+    u64 area = 0;
+    u32 widest = 0;
+    
+    for (u32 i = 0; i < rectCount; i++) {
+        area  += (u64)rects[i].width * rects[i].height;
+        widest = Max(widest, rects[i].width);
+    }
+    
+    u32 width = TILE_WIDTH;
+    while ((width < ATLAS_MAX_SHEET_SIZE) && ((u64)width * width < area))
+        width += TILE_WIDTH;
+    
+    return Max(width, widest);
+}
+
+u64
+atlasIndexBuild(MemArena* arena, u8** fileData, const AtlasSheet* sheets, u32 sheetCount,
+                const AtlasFrame* frames, u32 frameCount) {
+    AtlasHeader header = { 0 };
+    memcpy(header.magic, ATLAS_MAGIC, sizeof(ATLAS_MAGIC));
+    header.version      = ATLAS_VERSION;
+    header.headerSize   = sizeof(AtlasHeader);
+    header.sheetCount   = sheetCount;
+    header.frameCount   = frameCount;
+    header.sheetsOffset = sizeof(AtlasHeader);
+    header.framesOffset = header.sheetsOffset + (u64)sheetCount * sizeof(AtlasSheet);
+    
+    u64 size = header.framesOffset + (u64)frameCount * sizeof(AtlasFrame);
+    u8* data = memArenaPushArrayNoZero(arena, u8, size);
+    
+    memcpy(data, &header, sizeof(header));
+    if (sheetCount > 0)
+        memcpy(&data[header.sheetsOffset], sheets, sheetCount * sizeof(AtlasSheet));
+    if (frameCount > 0)
+        memcpy(&data[header.framesOffset], frames, frameCount * sizeof(AtlasFrame));
+    
+    *fileData = data;
+    return size;
+}
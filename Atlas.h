@@ -0,0 +1,98 @@
+#ifndef GUARD_ATLAS_H
+#define GUARD_ATLAS_H
+
+// Packs frames into a few big sprite sheets instead of one image per frame,
+// with a skyline packer (every sheet remembers the height of its filled area per column range,
+// and every frame goes wherever its top edge ends up lowest).
+// Where the frames ended up is stored in a small binary index next to the sheets.
+//
+// Needs "types.h" and "ArenaAlloc.h" to be included before.
+
+#define ATLAS_MAGIC   "SAATLAS"
+#define ATLAS_VERSION 1
+
+// Sheets never get bigger than this in either direction
+#define ATLAS_MAX_SHEET_SIZE 2048
+
+// +--------------------------------------+
+// |  AtlasHeader                         |
+// +--------------------------------------+
+// |  AtlasSheet[sheetCount]              |
+// +--------------------------------------+
+// |  AtlasFrame[frameCount], sorted by   |
+// |  animation, then frame               |
+// +--------------------------------------+
+// All offsets are relative to the start of the file.
+typedef struct {
+    char magic[8];
+    u32 version;
+    u32 headerSize;
+    
+    u32 sheetCount;
+    u32 frameCount;
+    u64 sheetsOffset;
+    u64 framesOffset;
+} AtlasHeader;
+
+typedef struct {
+    u16 width;
+    u16 height;
+    char fileName[28]; // Next to the index
+} AtlasSheet;
+
+typedef struct {
+    u16 animId;
+    u16 frameId;
+    u16 sheetId;
+    u16 x;        // Rectangle on the sheet, with the size of the frame (SpriteOffset.width/height)
+    u16 y;
+    u16 width;
+    u16 height;
+    s16 offsetX;  // SpriteOffset.offsetX/Y: The anchor of the frame is this far right/down of its top-left corner
+    s16 offsetY;
+    u16 reserved;
+} AtlasFrame;
+
+// Spans of columns with the same height of the filled area, left to right
+typedef struct {
+    u32 x;
+    u32 y;
+    u32 width;
+} SkylineNode;
+
+typedef struct {
+    u32 width;
+    u32 maxHeight;
+    u32 usedHeight;
+    
+    SkylineNode *nodes;
+    u32 nodeCount;
+    MemArena nodeArena;
+} SkylinePacker;
+
+void skylineInit(SkylinePacker *packer, u32 width, u32 maxHeight);
+void skylineReset(SkylinePacker *packer, u32 width, u32 maxHeight);
+void skylineFree(SkylinePacker *packer);
+bool skylineInsert(SkylinePacker *packer, u32 width, u32 height, u32 *x, u32 *y);
+
+// A rectangle that has to go on a sheet, 'sheetId'/'x'/'y' are set by 'atlasPack'
+typedef struct {
+    u32 width;
+    u32 height;
+    u32 sheetId;
+    u32 x;
+    u32 y;
+} AtlasRect;
+
+// Places 'rects' on sheets of 'sheetWidth' pixels width, tallest rectangles first.
+// Every sheet that gets started is added to 'sheets' as an AtlasSheet (without file name),
+// the first one gets 'firstSheetId'. Returns how many sheets were needed.
+u32 atlasPack(MemArena *scratch, MemArena *sheets, AtlasRect *rects, u32 rectCount, u32 sheetWidth, u32 firstSheetId);
+
+// Width of the sheets for 'rects': roughly square, but at least as wide as the widest rectangle.
+u32 atlasGetSheetWidth(const AtlasRect *rects, u32 rectCount);
+
+u64 atlasIndexBuild(MemArena *arena, u8 **fileData, const AtlasSheet *sheets, u32 sheetCount,
+                    const AtlasFrame *frames, u32 frameCount);
+
+#endif //GUARD_ATLAS_H
@@ -0,0 +1,104 @@
+#include <string.h>
+
+#include "types.h"
+#include "Hash.h"
+
+#define HASH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME64_3 0x165667B19E3779F9ULL
+#define HASH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define HASH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define RotateLeft64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+// The input doesn't have to be aligned, memcpy gets turned into a plain load.
+static inline u64
+read64(const u8 *data) {
+    u64 value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static inline u32
+read32(const u8 *data) {
+    u32 value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static inline u64
+hashRound(u64 acc, u64 input) {
+    acc += input * HASH_PRIME64_2;
+    acc  = RotateLeft64(acc, 31);
+    acc *= HASH_PRIME64_1;
+    return acc;
+}
+
+static inline u64
+hashMergeRound(u64 acc, u64 value) {
+    acc ^= hashRound(0, value);
+    acc  = acc * HASH_PRIME64_1 + HASH_PRIME64_4;
+    return acc;
+}
+
+u64
+hash64(const void *data, u64 size, u64 seed) {
+    const u8 *cursor = data;
+    const u8 *end = cursor + size;
+    u64 hash;
+    
+    if (size >= 32) {
+        // 4 independent lanes, so the multiplications can overlap
+        u64 v1 = seed + HASH_PRIME64_1 + HASH_PRIME64_2;
+        u64 v2 = seed + HASH_PRIME64_2;
+        u64 v3 = seed;
+        u64 v4 = seed - HASH_PRIME64_1;
+        
+        const u8 *lastStripe = end - 32;
+        do {
+            v1 = hashRound(v1, read64(cursor +  0));
+            v2 = hashRound(v2, read64(cursor +  8));
+            v3 = hashRound(v3, read64(cursor + 16));
+            v4 = hashRound(v4, read64(cursor + 24));
+            cursor += 32;
+        } while (cursor <= lastStripe);
+        
+        hash = RotateLeft64(v1, 1) + RotateLeft64(v2, 7) + RotateLeft64(v3, 12) + RotateLeft64(v4, 18);
+        hash = hashMergeRound(hash, v1);
+        hash = hashMergeRound(hash, v2);
+        hash = hashMergeRound(hash, v3);
+        hash = hashMergeRound(hash, v4);
+    } else {
+        hash = seed + HASH_PRIME64_5;
+    }
+    
+    hash += size;
+    
+    // Tail
+    while (cursor + 8 <= end) {
+        hash ^= hashRound(0, read64(cursor));
+        hash  = RotateLeft64(hash, 27) * HASH_PRIME64_1 + HASH_PRIME64_4;
+        cursor += 8;
+    }
+    
+    if (cursor + 4 <= end) {
+        hash ^= (u64)read32(cursor) * HASH_PRIME64_1;
+        hash  = RotateLeft64(hash, 23) * HASH_PRIME64_2 + HASH_PRIME64_3;
+        cursor += 4;
+    }
+    
+    while (cursor < end) {
+        hash ^= (*cursor) * HASH_PRIME64_5;
+        hash  = RotateLeft64(hash, 11) * HASH_PRIME64_1;
+        cursor++;
+    }
+    
+    // Avalanche
+    hash ^= hash >> 33;
+    hash *= HASH_PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= HASH_PRIME64_3;
+    hash ^= hash >> 32;
+    
+    return hash;
+}
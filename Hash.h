@@ -0,0 +1,8 @@
+#ifndef GUARD_HASH_H
+#define GUARD_HASH_H
+
+// 64-bit content hash (XXH64), for telling apart ROMs and file contents quickly.
+// Not meant for anything security-related.
+u64 hash64(const void *data, u64 size, u64 seed);
+
+#endif //GUARD_HASH_H
@@ -0,0 +1,268 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "types.h"
+#include "ArenaAlloc.h"
+#include "Hash.h"
+#include "Threads.h"
+#include "Manifest.h"
+
+// Amount of entries the list of this run grows by
+#define MANIFEST_GROW_COUNT 1024
+
+void
+manifestInit(Manifest* manifest, bool isEnabled) {
+    memset(manifest, 0, sizeof(*manifest));
+    manifest->isEnabled = isEnabled;
+    
+    memArenaInit(&manifest->previousArena);
+    memArenaInit(&manifest->entryArena);
+    manifest->entries = manifest->entryArena.memory;
+}
+
+void
+manifestFree(Manifest* manifest) {
+    memArenaFree(&manifest->previousArena);
+    memArenaFree(&manifest->entryArena);
+}
+
+static int
+compareEntries(const void* a, const void* b) {
+    u64 hashA = ((const ManifestEntry*)a)->pathHash;
+    u64 hashB = ((const ManifestEntry*)b)->pathHash;
+    
+    return (hashA > hashB) - (hashA < hashB);
+}
+
+static u64
+hashPath(const char* path) {
+    return hash64(path, strlen(path), 0);
+}
+
+// Reads the manifest of the previous run.
+// The file gets deleted right away: If this run doesn't finish, some of the files
+// might not match it anymore, so the next run has to write everything again.
+void
+manifestLoad(Manifest* manifest, const char* path) {
+    if (!manifest->isEnabled)
+        return;
+    
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+        return;
+    
+    MemArenaTemp textScope = memArenaBeginTemp(&manifest->entryArena);
+    
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    
+    char* text = NULL;
+    if (size > 0) {
+        text = memArenaPushArrayNoZero(&manifest->entryArena, char, size + 1);
+        size = (long)fread(text, 1, size, file);
+        text[size] = '\0';
+    }
+    fclose(file);
+    remove(path);
+    
+    char header[64];
+    sprintf(header, "%s %d\n", MANIFEST_MAGIC, MANIFEST_VERSION);
+    
+    if (text && !strncmp(text, header, strlen(header))) {
+        char* line = text + strlen(header);
+        
+        // One line per file: "<content hash> <size> <modified time> <path>"
+        while (*line) {
+            char* lineEnd = strchr(line, '\n');
+            if (lineEnd == NULL)
+                break;
+            *lineEnd = '\0';
+            
+            char* cursor;
+            u64 contentHash  = strtoull(line, &cursor, 16);
+            u64 fileSize     = strtoull(cursor, &cursor, 10);
+            s64 modifiedTime = strtoll(cursor, &cursor, 10);
+            
+            if (*cursor == ' ' && strlen(cursor + 1) < MANIFEST_MAX_PATH_LENGTH) {
+                ManifestEntry* entry = memArenaPushArrayNoZero(&manifest->previousArena, ManifestEntry, 1);
+                entry->contentHash  = contentHash;
+                entry->size         = fileSize;
+                entry->modifiedTime = modifiedTime;
+                strcpy(entry->path, cursor + 1);
+                entry->pathHash = hashPath(entry->path);
+                
+                manifest->previousCount++;
+            }
+            
+            line = lineEnd + 1;
+        }
+    }
+    
+    memArenaEndTemp(textScope);
+    
+    manifest->previous = manifest->previousArena.memory;
+    qsort(manifest->previous, manifest->previousCount, sizeof(ManifestEntry), compareEntries);
+}
+
+static ManifestEntry*
+findPrevious(Manifest* manifest, u64 pathHash, const char* path) {
+    ManifestEntry* previous = manifest->previous;
+    u32 low  = 0;
+    u32 high = manifest->previousCount;
+    
+    while (low < high) {
+        u32 middle = low + (high - low) / 2;
+        
+        if (previous[middle].pathHash < pathHash)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    
+    for (; (low < manifest->previousCount) && (previous[low].pathHash == pathHash); low++) {
+        if (!strcmp(previous[low].path, path))
+            return &previous[low];
+    }
+    
+    return NULL;
+}
+
+static void
+growEntries(Manifest* manifest, u32 requiredCount) {
+    if (requiredCount > manifest->entryCapacity) {
+        u32 growth = Max(requiredCount - manifest->entryCapacity, MANIFEST_GROW_COUNT);
+        
+        memArenaPushArrayNoZero(&manifest->entryArena, ManifestEntry, growth);
+        manifest->entryCapacity += growth;
+    }
+}
+
+// Makes room for 'count' more entries, so that many files can be written from several threads.
+void
+manifestReserve(Manifest* manifest, u32 count) {
+    growEntries(manifest, manifest->entryCount + count);
+}
+
+static bool
+getFileInfo(const char* path, u64* size, s64* modifiedTime) {
+    struct stat info;
+    if (stat(path, &info) != 0)
+        return FALSE;
+    
+    *size = info.st_size;
+    *modifiedTime = info.st_mtime;
+    return TRUE;
+}
+
+// Writes 'data' into the file at 'path', unless the previous run wrote the same content into it
+// and the file still looks the way it was left.
+// Returns FALSE if the file couldn't be written.
+bool
+manifestWriteFile(Manifest* manifest, const char* path, const void* data, u64 size) {
+    if (!manifest->isEnabled) {
+        FILE* file = fopen(path, "wb");
+        if (file == NULL)
+            return FALSE;
+        
+        bool success = (size == 0) || (fwrite(data, 1, size, file) == size);
+        return (fclose(file) == 0) && success;
+    }
+    
+    u64 pathHash    = hashPath(path);
+    u64 contentHash = hash64(data, size, 0);
+    
+    u64 fileSize = 0;
+    s64 modifiedTime = 0;
+    ManifestEntry* previous = findPrevious(manifest, pathHash, path);
+    
+    bool isUnchanged = previous
+        && (previous->contentHash == contentHash)
+        && (previous->size == size)
+        && getFileInfo(path, &fileSize, &modifiedTime)
+        && (fileSize == size)
+        && (modifiedTime == previous->modifiedTime);
+    
+    if (isUnchanged) {
+        atomicFetchAddU32(&manifest->skippedCount, 1);
+    } else {
+        FILE* file = fopen(path, "wb");
+        if (file == NULL) {
+            fprintf(stderr, "Could not create '%s'. Code: %d\n", path, errno);
+            return FALSE;
+        }
+        
+        bool success = (size == 0) || (fwrite(data, 1, size, file) == size);
+        success = (fclose(file) == 0) && success;
+        
+        if (!success || !getFileInfo(path, &fileSize, &modifiedTime)) {
+            fprintf(stderr, "Could not write '%s'. Code: %d\n", path, errno);
+            return FALSE;
+        }
+        
+        atomicFetchAddU32(&manifest->writtenCount, 1);
+    }
+    
+    if (strlen(path) < MANIFEST_MAX_PATH_LENGTH) {
+        u32 slot = atomicFetchAddU32(&manifest->entryCount, 1);
+        
+        // Growing is only safe on one thread, see 'manifestReserve'.
+        if (slot >= manifest->entryCapacity)
+            growEntries(manifest, slot + 1);
+        
+        ManifestEntry* entry = &manifest->entries[slot];
+        entry->pathHash     = pathHash;
+        entry->contentHash  = contentHash;
+        entry->size         = size;
+        entry->modifiedTime = modifiedTime;
+        strcpy(entry->path, path);
+    }
+    
+    return TRUE;
+}
+
+// Writes the entries of this run, under a temporary name first, like the animation database.
+bool
+manifestSave(Manifest* manifest, const char* path) {
+    if (!manifest->isEnabled)
+        return TRUE;
+    
+    char tempPath[MANIFEST_MAX_PATH_LENGTH + sizeof(".tmp")];
+    if (strlen(path) >= MANIFEST_MAX_PATH_LENGTH)
+        return FALSE;
+    sprintf(tempPath, "%s.tmp", path);
+    
+    FILE* file = fopen(tempPath, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not create '%s'. Code: %d\n", tempPath, errno);
+        return FALSE;
+    }
+    
+    fprintf(file, "%s %d\n", MANIFEST_MAGIC, MANIFEST_VERSION);
+    for (u32 i = 0; i < manifest->entryCount; i++) {
+        ManifestEntry* entry = &manifest->entries[i];
+        fprintf(file, "%016llX %llu %lld %s\n",
+                (unsigned long long)entry->contentHash, (unsigned long long)entry->size,
+                (long long)entry->modifiedTime, entry->path);
+    }
+    
+    bool success = (fclose(file) == 0);
+    
+#ifdef _MSC_VER
+    // rename() doesn't replace existing files on Windows
+    if (success)
+        remove(path);
+#endif
+    success = success && (rename(tempPath, path) == 0);
+    
+    if (!success) {
+        remove(tempPath);
+        fprintf(stderr, "Could not write '%s'. Code: %d\n", path, errno);
+    }
+    
+    return success;
+}
@@ -0,0 +1,53 @@
+#ifndef GUARD_MANIFEST_H
+#define GUARD_MANIFEST_H
+
+// Remembers the content hash of every file a run wrote, so the next run can skip
+// the files whose content didn't change. Skipped files don't get opened at all,
+// so their timestamps stay the same and nothing that depends on them gets rebuilt.
+//
+// Needs "types.h" and "ArenaAlloc.h" to be included before.
+
+#define MANIFEST_MAGIC "SAANIMMANIFEST"
+#define MANIFEST_VERSION 1
+
+// Longer paths still get written, they just can't be skipped in the next run.
+#define MANIFEST_MAX_PATH_LENGTH 256
+
+typedef struct {
+    u64 pathHash;
+    u64 contentHash;
+    u64 size;
+    s64 modifiedTime; // Of the file right after it was written, to notice changes done by hand
+    char path[MANIFEST_MAX_PATH_LENGTH];
+} ManifestEntry;
+
+typedef struct {
+    bool isEnabled; // Otherwise every file simply gets written
+    
+    // Files of the previous run, sorted by 'pathHash'
+    ManifestEntry *previous;
+    u32 previousCount;
+    
+    // Files of this run.
+    // Several threads may write files at the same time,
+    // as long as 'manifestReserve' made room for all of their entries beforehand.
+    ManifestEntry *entries;
+    volatile u32 entryCount;
+    u32 entryCapacity;
+    
+    volatile u32 writtenCount;
+    volatile u32 skippedCount;
+    
+    MemArena previousArena;
+    MemArena entryArena;
+} Manifest;
+
+void manifestInit(Manifest *manifest, bool isEnabled);
+void manifestFree(Manifest *manifest);
+void manifestLoad(Manifest *manifest, const char *path);
+bool manifestSave(Manifest *manifest, const char *path);
+void manifestReserve(Manifest *manifest, u32 count);
+
+bool manifestWriteFile(Manifest *manifest, const char *path, const void *data, u64 size);
+
+#endif //GUARD_MANIFEST_H
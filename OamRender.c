@@ -0,0 +1,116 @@
+#include <string.h>
+#include <stdio.h>
+
+#include "types.h"
+#include "ArenaAlloc.h"
+#include "TileConvert.h"
+#include "OamRender.h"
+
+void
+rgbaCanvasInit(RgbaCanvas* canvas, MemArena* arena, u32 width, u32 height) {
+    canvas->width  = width;
+    canvas->height = height;
+    canvas->pixels = memArenaPushArray(arena, u32, (u64)width * height);
+}
+
+// Draws 'count' pixels of a row, 'step' is -1 for mirrored rows.
+// Color 0 is transparent, so only the other pixels get looked up and written.
+static inline void
+blitSpan(u32* dest, const u8* indices, s32 step, u32 count, const u32* colors) {
+    for (u32 i = 0; i < count; i++, indices += step) {
+        if (*indices)
+            dest[i] = colors[*indices];
+    }
+}
+
+// Semi-transparent objects get mixed 50/50 with what's below them,
+// and are half-transparent where there's nothing below.
+static inline void
+blitSpanBlended(u32* dest, const u8* indices, s32 step, u32 count, const u32* colors) {
+    for (u32 i = 0; i < count; i++, indices += step) {
+        if (*indices == 0)
+            continue;
+        
+        u32 color = colors[*indices];
+        u32 below = dest[i];
+        
+        if ((below & RGBA_ALPHA_MASK) == 0)
+            dest[i] = (color & ~RGBA_ALPHA_MASK) | 0x80000000;
+        else
+            dest[i] = ((color & 0x00FEFEFE) >> 1) + ((below & 0x00FEFEFE) >> 1) + (below & RGBA_ALPHA_MASK);
+    }
+}
+
+static void
+renderSprite(RgbaCanvas* canvas, MemArena* scratch, const OamSprite* sprite) {
+    if ((sprite->affineMode == OAM_AFFINE_HIDDEN) || (sprite->objMode > OAM_MODE_BLEND))
+        return;
+    
+    s32 width  = sprite->widthInTiles  * TILE_WIDTH;
+    s32 height = sprite->heightInTiles * TILE_WIDTH;
+    s32 left   = sprite->x;
+    s32 top    = sprite->y;
+    u32 flip   = (sprite->affineMode & OAM_AFFINE_ENABLED) ? 0 : sprite->flip;
+    
+    // Double-sized objects get twice the area, with an unrotated sprite sitting in its center.
+    if (sprite->affineMode == OAM_AFFINE_DOUBLE) {
+        left += width / 2;
+        top  += height / 2;
+    }
+    
+    // Clip once, so the rows don't need any checks
+    s32 startX = Max(left, 0);
+    s32 startY = Max(top, 0);
+    s32 endX   = Min(left + width,  (s32)canvas->width);
+    s32 endY   = Min(top  + height, (s32)canvas->height);
+    
+    if ((startX >= endX) || (startY >= endY))
+        return;
+    
+    MemArenaTemp spriteScope = memArenaBeginTemp(scratch);
+    
+    u8* indices = memArenaPushArrayNoZero(scratch, u8, width * height);
+    tilesToIndexed(sprite->tiles, sprite->widthInTiles * sprite->heightInTiles, sprite->widthInTiles,
+                   sprite->tileSize, indices);
+    
+    u32 count = endX - startX;
+    s32 step  = (flip & OAM_FLIP_H) ? -1 : 1;
+    
+    for (s32 y = startY; y < endY; y++) {
+        s32 sourceY = (flip & OAM_FLIP_V) ? (height - 1 - (y - top)) : (y - top);
+        s32 sourceX = (flip & OAM_FLIP_H) ? (width - 1 - (startX - left)) : (startX - left);
+        
+        const u8* source = &indices[sourceY * width + sourceX];
+        u32* dest = &canvas->pixels[y * canvas->width + startX];
+        
+        if (sprite->objMode == OAM_MODE_BLEND)
+            blitSpanBlended(dest, source, step, count, sprite->colors);
+        else
+            blitSpan(dest, source, step, count, sprite->colors);
+    }
+    
+    memArenaEndTemp(spriteScope);
+}
+
+void
+oamRenderSprites(RgbaCanvas* canvas, MemArena* scratch, const OamSprite* sprites, u32 spriteCount) {
+    MemArenaTemp orderScope = memArenaBeginTemp(scratch);
+    
+    // Back to front: highest priority value first, and later entries before earlier ones.
+    // Frames only have a handful of entries, so insertion sort is plenty.
+    u32* order = memArenaPushArrayNoZero(scratch, u32, spriteCount);
+    for (u32 i = 0; i < spriteCount; i++) {
+        u32 index = spriteCount - 1 - i;
+        u32 j = i;
+        
+        for (; (j > 0) && (sprites[order[j - 1]].priority < sprites[index].priority); j--)
+            order[j] = order[j - 1];
+        
+        order[j] = index;
+    }
+    
+    for (u32 i = 0; i < spriteCount; i++)
+        renderSprite(canvas, scratch, &sprites[order[i]]);
+    
+    memArenaEndTemp(orderScope);
+}
@@ -0,0 +1,66 @@
+#ifndef GUARD_OAM_RENDER_H
+#define GUARD_OAM_RENDER_H
+
+// Draws the OAM entries of a frame the way the GBA's object layer shows them,
+// into an RGBA canvas: flips, double-sized affine objects, priorities,
+// semi-transparency and color 0 being transparent.
+// Things the game sets up at runtime (affine matrices, mosaic, blend factors) can't be known here,
+// affine objects are drawn unrotated and semi-transparent ones at 50%.
+//
+// Needs "types.h" and "ArenaAlloc.h" to be included before.
+
+#define OAM_FLIP_H 1
+#define OAM_FLIP_V 2
+
+// OamSplit.affineMode
+#define OAM_AFFINE_ENABLED 1
+#define OAM_AFFINE_HIDDEN  2 // Without OAM_AFFINE_ENABLED
+#define OAM_AFFINE_DOUBLE  3
+
+// OamSplit.objMode
+#define OAM_MODE_NORMAL  0
+#define OAM_MODE_BLEND   1
+#define OAM_MODE_WINDOW  2
+
+// Colors are u32s with the bytes R, G, B, A in memory (the exporter only runs on little-endian CPUs).
+#define RGBA_ALPHA_MASK 0xFF000000
+
+// Same scaling as gbagfx: every 5-bit channel gets scaled up to 8 bits.
+static inline u32
+rgbaFromGba(u16 color) {
+    u32 r = (( color        & 0x1F) * 255) / 31;
+    u32 g = (((color >>  5) & 0x1F) * 255) / 31;
+    u32 b = (((color >> 10) & 0x1F) * 255) / 31;
+    
+    return r | (g << 8) | (b << 16) | RGBA_ALPHA_MASK;
+}
+
+typedef struct {
+    u32 *pixels;
+    u32 width;
+    u32 height;
+} RgbaCanvas;
+
+// One OAM entry of a frame, with its tiles and colors already looked up
+typedef struct {
+    const u8 *tiles;   // 1D mapped, 'widthInTiles * heightInTiles' of them
+    const u32 *colors; // 16 colors for 4bpp tiles, 256 for 8bpp ones
+    s32 x;             // Position of the top-left corner on the canvas
+    s32 y;
+    u8 widthInTiles;
+    u8 heightInTiles;
+    u8 tileSize;
+    u8 flip;           // OAM_FLIP_H/V, only used without OAM_AFFINE_ENABLED
+    u8 affineMode;
+    u8 objMode;
+    u8 priority;       // 0 is in front
+} OamSprite;
+
+// The canvas starts out fully transparent.
+void rgbaCanvasInit(RgbaCanvas *canvas, MemArena *arena, u32 width, u32 height);
+
+// 'sprites' are in OAM order, so with the same priority, earlier ones are in front.
+// 'scratch' only gets used temporarily.
+void oamRenderSprites(RgbaCanvas *canvas, MemArena *scratch, const OamSprite *sprites, u32 spriteCount);
+
+#endif //GUARD_OAM_RENDER_H
@@ -0,0 +1,90 @@
+#include <stdarg.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "types.h"
+#include "ArenaAlloc.h"
+#include "OutBuffer.h"
+
+void
+outBufferInit(OutBuffer *out, FILE *file, MemArena *arena, u32 capacity) {
+    out->file = file;
+    out->arena = NULL;
+    out->data = memArenaPushArrayNoZero(arena, char, capacity);
+    out->used = 0;
+    out->capacity = capacity;
+}
+
+// Nothing else may be allocated from 'arena' until 'outBufferEndInMemory' was called,
+// so the text stays contiguous while it grows.
+void
+outBufferInitInMemory(OutBuffer *out, MemArena *arena) {
+    out->file = NULL;
+    out->arena = arena;
+    out->data = memArenaPushArrayNoZero(arena, char, OUT_BUFFER_GROW_SIZE);
+    out->used = 0;
+    out->capacity = OUT_BUFFER_GROW_SIZE;
+}
+
+// Gives the unused part of the block back to the arena, and returns the length of the text.
+u32
+outBufferEndInMemory(OutBuffer *out) {
+    MemArena *arena = out->arena;
+    arena->offset = (u64)(out->data - (char*)arena->memory) + out->used;
+    out->capacity = out->used;
+    
+    return out->used;
+}
+
+void
+outBufferFlush(OutBuffer *out) {
+    if (out->file && out->used > 0) {
+        fwrite(out->data, 1, out->used, out->file);
+        out->used = 0;
+    }
+}
+
+// Ensures there are 'count' free bytes behind the text
+void
+outBufferMakeSpace(OutBuffer *out, u32 count) {
+    if (out->file) {
+        outBufferFlush(out);
+    } else {
+        u32 growth = Max(count, OUT_BUFFER_GROW_SIZE);
+        ALIGN(growth, 4);
+        
+        char *more = memArenaPushArrayNoZero(out->arena, char, growth);
+        assert(more == out->data + out->capacity);
+        out->capacity += growth;
+    }
+}
+
+// For the few places that aren't worth formatting by hand (file headers, macro templates).
+void
+outFormat(OutBuffer *out, const char *format, ...) {
+    va_list args;
+    
+    // Try the remaining space first, and the whole block if that wasn't enough
+    for (int attempt = 0; attempt < 2; attempt++) {
+        u32 space = out->capacity - out->used;
+        
+        va_start(args, format);
+        int length = vsnprintf(&out->data[out->used], space, format, args);
+        va_end(args);
+        
+        if (length < 0)
+            return;
+        
+        if ((u32)length < space) {
+            out->used += length;
+            return;
+        }
+        
+        outBufferMakeSpace(out, length + 1);
+    }
+    
+    // Doesn't fit into a whole block, so it bypasses the buffer.
+    va_start(args, format);
+    vfprintf(out->file, format, args);
+    va_end(args);
+}
@@ -0,0 +1,145 @@
+#ifndef GUARD_OUT_BUFFER_H
+#define GUARD_OUT_BUFFER_H
+
+// Collects text output in a big block and writes it to the file in one go,
+// once the block is full (or the buffer gets flushed).
+// Without a file, the text stays in memory and the block grows inside of its arena instead.
+// Numbers get formatted by hand, so there's no format string to parse per token.
+typedef struct {
+    FILE *file;
+    MemArena *arena; // only set for buffers that stay in memory
+    char *data;
+    u32 used;
+    u32 capacity;
+} OutBuffer;
+
+// Default size of the block that gets written at once
+#define OUT_BUFFER_SIZE (1024*1024)
+
+// Amount of memory an in-memory buffer grows by
+#define OUT_BUFFER_GROW_SIZE (64*1024)
+
+void outBufferInit(OutBuffer *out, FILE *file, MemArena *arena, u32 capacity);
+void outBufferInitInMemory(OutBuffer *out, MemArena *arena);
+u32 outBufferEndInMemory(OutBuffer *out);
+void outBufferFlush(OutBuffer *out);
+void outBufferMakeSpace(OutBuffer *out, u32 count);
+void outFormat(OutBuffer *out, const char *format, ...);
+
+// Appends a string literal, without having to determine its length at runtime
+#define outLiteral(out, literal) outChars((out), (literal), sizeof(literal) - 1)
+
+// The functions below are called for every token that gets printed,
+// so they live in the header to allow the compiler to inline them.
+
+// Returns a pointer to at least 'count' bytes of free space, flushing if necessary
+static inline char*
+outReserve(OutBuffer *out, u32 count) {
+    if (out->used + count > out->capacity)
+        outBufferMakeSpace(out, count);
+    
+    return &out->data[out->used];
+}
+
+static inline void
+outChar(OutBuffer *out, char c) {
+    *outReserve(out, 1) = c;
+    out->used++;
+}
+
+static inline void
+outChars(OutBuffer *out, const char *string, u32 length) {
+    // Strings bigger than the whole block get written directly.
+    if (out->file && length > out->capacity) {
+        outBufferFlush(out);
+        fwrite(string, 1, length, out->file);
+        return;
+    }
+    
+    memcpy(outReserve(out, length), string, length);
+    out->used += length;
+}
+
+static inline void
+outString(OutBuffer *out, const char *string) {
+    outChars(out, string, strlen(string));
+}
+
+static inline void
+outSpaces(OutBuffer *out, s32 count) {
+    for (; count > 0; count--)
+        outChar(out, ' ');
+}
+
+// Same output as "%0<minDigits>u"
+static inline void
+outUDecPadded(OutBuffer *out, u32 value, s32 minDigits) {
+    char digits[10];
+    s32 count = 0;
+    
+    do {
+        digits[count++] = '0' + (value % 10);
+        value /= 10;
+    } while (value != 0);
+    
+    while (count < minDigits && count < (s32)sizeof(digits))
+        digits[count++] = '0';
+    
+    char *dest = outReserve(out, count);
+    for (s32 i = 0; i < count; i++)
+        dest[i] = digits[count - 1 - i];
+    
+    out->used += count;
+}
+
+// Same output as "%u"
+static inline void
+outUDec(OutBuffer *out, u32 value) {
+    outUDecPadded(out, value, 0);
+}
+
+// Same output as "%d"
+static inline void
+outDec(OutBuffer *out, s32 value) {
+    if (value < 0) {
+        outChar(out, '-');
+        // Negating in unsigned arithmetic also works for INT_MIN
+        outUDec(out, 0u - (u32)value);
+    } else {
+        outUDec(out, (u32)value);
+    }
+}
+
+static inline void
+outHexDigits(OutBuffer *out, u32 value, s32 minDigits, const char *digitChars) {
+    char digits[8];
+    s32 count = 0;
+    
+    do {
+        digits[count++] = digitChars[value & 0xF];
+        value >>= 4;
+    } while (value != 0);
+    
+    while (count < minDigits && count < (s32)sizeof(digits))
+        digits[count++] = '0';
+    
+    char *dest = outReserve(out, count);
+    for (s32 i = 0; i < count; i++)
+        dest[i] = digits[count - 1 - i];
+    
+    out->used += count;
+}
+
+// Same output as "%0<minDigits>X", without the "0x" prefix
+static inline void
+outHex(OutBuffer *out, u32 value, s32 minDigits) {
+    outHexDigits(out, value, minDigits, "0123456789ABCDEF");
+}
+
+// Same output as "%0<minDigits>x", without the "0x" prefix
+static inline void
+outHexLower(OutBuffer *out, u32 value, s32 minDigits) {
+    outHexDigits(out, value, minDigits, "0123456789abcdef");
+}
+
+#endif //GUARD_OUT_BUFFER_H
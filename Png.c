@@ -0,0 +1,601 @@
+#include <string.h>
+#include <stdio.h>
+
+#include "types.h"
+#include "ArenaAlloc.h"
+#include "Png.h"
+
+#define DEFLATE_WINDOW_SIZE 32768
+#define DEFLATE_MIN_MATCH   3
+#define DEFLATE_MAX_MATCH   258
+
+// How many earlier positions with the same hash get compared, at most.
+// More finds longer matches, but slows down long runs of the same bytes.
+#define DEFLATE_MAX_CHAIN   32
+
+#define DEFLATE_HASH_BITS   15
+#define DEFLATE_HASH_SIZE   (1 << DEFLATE_HASH_BITS)
+
+#define DEFLATE_LENGTH_CODES   29
+#define DEFLATE_DISTANCE_CODES 30
+
+static const u16 sLengthBase[DEFLATE_LENGTH_CODES] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const u8 sLengthExtraBits[DEFLATE_LENGTH_CODES] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const u16 sDistanceBase[DEFLATE_DISTANCE_CODES] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const u8 sDistanceExtraBits[DEFLATE_DISTANCE_CODES] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// CRC-32 (polynomial 0xEDB88320) of every 4-bit value.
+// Small enough to not need generating, so there's nothing to initialize across threads.
+static const u32 sCrcNibbleTable[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+};
+
+// Start with 'crc' = 0
+u32
+crc32Update(u32 crc, const u8* data, u64 size) {
+    crc = ~crc;
+    
+    for (u64 i = 0; i < size; i++) {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ sCrcNibbleTable[crc & 0xF];
+        crc = (crc >> 4) ^ sCrcNibbleTable[crc & 0xF];
+    }
+    
+    return ~crc;
+}
+
+u32
+adler32(const u8* data, u64 size) {
+    u32 a = 1;
+    u32 b = 0;
+    
+    while (size > 0) {
+        // The biggest block that can't overflow 'b' before taking the modulo
+        u64 blockSize = Min(size, 5552);
+        
+        for (u64 i = 0; i < blockSize; i++) {
+            a += data[i];
+            b += a;
+        }
+        
+        a %= 65521;
+        b %= 65521;
+        data += blockSize;
+        size -= blockSize;
+    }
+    
+    return (b << 16) | a;
+}
+
+// Deflate streams get filled starting at the lowest bit of each byte.
+typedef struct {
+    u8* data;
+    u64 used;
+    u64 bitBuffer;
+    u32 bitCount;
+} BitWriter;
+
+static inline void
+putBits(BitWriter* writer, u32 bits, u32 count) {
+    writer->bitBuffer |= (u64)bits << writer->bitCount;
+    writer->bitCount += count;
+    
+    while (writer->bitCount >= 8) {
+        writer->data[writer->used++] = (u8)writer->bitBuffer;
+        writer->bitBuffer >>= 8;
+        writer->bitCount -= 8;
+    }
+}
+
+static void
+flushBits(BitWriter* writer) {
+    if (writer->bitCount > 0)
+        putBits(writer, 0, 8 - writer->bitCount);
+}
+
+// Huffman codes get stored starting with their highest bit, the opposite of everything else.
+static inline u32
+reverseBits(u32 bits, u32 count) {
+    u32 result = 0;
+    
+    for (u32 i = 0; i < count; i++) {
+        result = (result << 1) | (bits & 1);
+        bits >>= 1;
+    }
+    
+    return result;
+}
+
+// The fixed literal/length codes of RFC 1951, 3.2.6, already reversed
+typedef struct {
+    u16 codes[288];
+    u8 lengths[288];
+    u8 lengthSymbols[DEFLATE_MAX_MATCH + 1]; // Match length -> index into 'sLengthBase'
+} FixedCodes;
+
+static void
+initFixedCodes(FixedCodes* fixed) {
+    for (u32 symbol = 0; symbol < 288; symbol++) {
+        u32 code, length;
+        
+        if (symbol < 144)      { code = 0x30  + symbol;         length = 8; }
+        else if (symbol < 256) { code = 0x190 + (symbol - 144); length = 9; }
+        else if (symbol < 280) { code = symbol - 256;           length = 7; }
+        else                   { code = 0xC0  + (symbol - 280); length = 8; }
+        
+        fixed->codes[symbol]   = reverseBits(code, length);
+        fixed->lengths[symbol] = length;
+    }
+    
+    u32 index = 0;
+    for (u32 length = DEFLATE_MIN_MATCH; length <= DEFLATE_MAX_MATCH; length++) {
+        while ((index + 1 < DEFLATE_LENGTH_CODES) && (sLengthBase[index + 1] <= length))
+            index++;
+        
+        fixed->lengthSymbols[length] = index;
+    }
+}
+
+static inline void
+putSymbol(BitWriter* writer, FixedCodes* fixed, u32 symbol) {
+    putBits(writer, fixed->codes[symbol], fixed->lengths[symbol]);
+}
+
+static inline void
+putMatch(BitWriter* writer, FixedCodes* fixed, u32 length, u32 distance) {
+    u32 lengthIndex = fixed->lengthSymbols[length];
+    putSymbol(writer, fixed, 257 + lengthIndex);
+    putBits(writer, length - sLengthBase[lengthIndex], sLengthExtraBits[lengthIndex]);
+    
+    u32 distanceIndex = 0;
+    while ((distanceIndex + 1 < DEFLATE_DISTANCE_CODES) && (sDistanceBase[distanceIndex + 1] <= distance))
+        distanceIndex++;
+    
+    putBits(writer, reverseBits(distanceIndex, 5), 5);
+    putBits(writer, distance - sDistanceBase[distanceIndex], sDistanceExtraBits[distanceIndex]);
+}
+
+static inline u32
+hash3(const u8* data) {
+    u32 value = data[0] | (data[1] << 8) | (data[2] << 16);
+    return (value * 0x9E3779B1u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+// Moves 'size' bytes at 'data' to the position of 'checkpoint' in 'arena',
+// releasing everything that was pushed after that.
+static u8*
+keepInArena(MemArena* arena, u64 checkpoint, u8* data, u64 size) {
+    memArenaRestore(arena, checkpoint);
+    
+    u8* dest = memArenaReserveNoZero(arena, size);
+    if (dest && dest != data)
+        memmove(dest, data, size);
+    
+    return dest;
+}
+
+u64
+zlibCompress(MemArena* arena, u8** compressed, const u8* data, u64 size) {
+    u64 checkpoint = memArenaCheckpoint(arena);
+    
+    s32* head = memArenaPushArrayNoZero(arena, s32, DEFLATE_HASH_SIZE);
+    s32* prev = memArenaPushArrayNoZero(arena, s32, DEFLATE_WINDOW_SIZE);
+    memset(head, 0xFF, DEFLATE_HASH_SIZE * sizeof(s32));
+    
+    FixedCodes* fixed = memArenaPushArrayNoZero(arena, FixedCodes, 1);
+    initFixedCodes(fixed);
+    
+    // Literals take 9 bits at most, matches always take less than the bytes they replace.
+    BitWriter writer = { 0 };
+    writer.data = memArenaPushArrayNoZero(arena, u8, 16 + size + size / 8);
+    
+    // zlib header: deflate with a 32K window, no dictionary
+    writer.data[writer.used++] = 0x78;
+    writer.data[writer.used++] = 0x01;
+    
+    // One final block with the fixed codes
+    putBits(&writer, 1, 1);
+    putBits(&writer, 1, 2);
+    
+    u64 pos = 0;
+    while (pos < size) {
+        u32 bestLength = 0;
+        u32 bestDistance = 0;
+        
+        if (pos + DEFLATE_MIN_MATCH <= size) {
+            u32 hash = hash3(&data[pos]);
+            u32 maxLength = (u32)Min(size - pos, DEFLATE_MAX_MATCH);
+            s64 candidate = head[hash];
+            
+            for (u32 chain = 0;
+                 (chain < DEFLATE_MAX_CHAIN) && (candidate >= 0) && (pos - candidate <= DEFLATE_WINDOW_SIZE);
+                 chain++) {
+                const u8* a = &data[candidate];
+                const u8* b = &data[pos];
+                
+                if (a[bestLength] == b[bestLength]) {
+                    u32 length = 0;
+                    while ((length < maxLength) && (a[length] == b[length]))
+                        length++;
+                    
+                    if (length > bestLength) {
+                        bestLength = length;
+                        bestDistance = (u32)(pos - candidate);
+                        
+                        if (length == maxLength)
+                            break;
+                    }
+                }
+                
+                s32 next = prev[candidate % DEFLATE_WINDOW_SIZE];
+                if (next >= candidate)
+                    break;
+                
+                candidate = next;
+            }
+        }
+        
+        u32 advance = 1;
+        if (bestLength >= DEFLATE_MIN_MATCH) {
+            putMatch(&writer, fixed, bestLength, bestDistance);
+            advance = bestLength;
+        } else {
+            putSymbol(&writer, fixed, data[pos]);
+        }
+        
+        // Every position the match covered can be the start of a later match.
+        for (u32 i = 0; i < advance; i++, pos++) {
+            if (pos + DEFLATE_MIN_MATCH <= size) {
+                u32 hash = hash3(&data[pos]);
+                prev[pos % DEFLATE_WINDOW_SIZE] = head[hash];
+                head[hash] = (s32)pos;
+            }
+        }
+    }
+    
+    putSymbol(&writer, fixed, 256);
+    flushBits(&writer);
+    
+    // Data without any repetition (noise) gets bigger with the fixed codes,
+    // so it's better off in stored blocks (5 bytes of header per 65535 bytes).
+    u64 storedSize = 2 + 5 * Max((size + 65534) / 65535, 1) + size;
+    if (writer.used > storedSize) {
+        writer.used = 2;
+        
+        u64 offset = 0;
+        do {
+            u32 blockSize = (u32)Min(size - offset, 65535);
+            bool isFinal = (offset + blockSize == size);
+            
+            writer.data[writer.used++] = isFinal;
+            writer.data[writer.used++] = (u8)(blockSize);
+            writer.data[writer.used++] = (u8)(blockSize >> 8);
+            writer.data[writer.used++] = (u8)(~blockSize);
+            writer.data[writer.used++] = (u8)(~blockSize >> 8);
+            
+            memcpy(&writer.data[writer.used], &data[offset], blockSize);
+            writer.used += blockSize;
+            offset += blockSize;
+        } while (offset < size);
+    }
+    
+    u32 checksum = adler32(data, size);
+    writer.data[writer.used++] = (u8)(checksum >> 24);
+    writer.data[writer.used++] = (u8)(checksum >> 16);
+    writer.data[writer.used++] = (u8)(checksum >> 8);
+    writer.data[writer.used++] = (u8)(checksum);
+    
+    *compressed = keepInArena(arena, checkpoint, writer.data, writer.used);
+    return writer.used;
+}
+
+static inline u8*
+putU32BigEndian(u8* dest, u32 value) {
+    dest[0] = (u8)(value >> 24);
+    dest[1] = (u8)(value >> 16);
+    dest[2] = (u8)(value >> 8);
+    dest[3] = (u8)(value);
+    return dest + 4;
+}
+
+// Length, type, data and CRC (of type and data)
+static u8*
+putChunk(u8* dest, const char* type, const u8* data, u32 size) {
+    dest = putU32BigEndian(dest, size);
+    
+    u8* crcStart = dest;
+    memcpy(dest, type, 4);
+    if (size > 0)
+        memcpy(dest + 4, data, size);
+    dest += 4 + size;
+    
+    return putU32BigEndian(dest, crc32Update(0, crcStart, 4 + size));
+}
+
+// Like 'putChunk', for the chunks of animated PNGs that start with a sequence number (fcTL and fdAT)
+static u8*
+putSequencedChunk(u8* dest, const char* type, u32 sequence, const u8* data, u32 size) {
+    dest = putU32BigEndian(dest, 4 + size);
+    
+    u8* crcStart = dest;
+    memcpy(dest, type, 4);
+    putU32BigEndian(dest + 4, sequence);
+    memcpy(dest + 8, data, size);
+    dest += 8 + size;
+    
+    return putU32BigEndian(dest, crc32Update(0, crcStart, 8 + size));
+}
+
+static void
+putImageHeader(u8* header, u32 width, u32 height, u32 bitDepth, u32 colorType) {
+    putU32BigEndian(&header[0], width);
+    putU32BigEndian(&header[4], height);
+    header[8]  = bitDepth;
+    header[9]  = colorType;
+    header[10] = 0; // Deflate
+    header[11] = 0; // Adaptive filtering
+    header[12] = 0; // Not interlaced
+}
+
+// Compresses 'raw' (rows with their filter bytes) and puts the file together after 'checkpoint'.
+// 'palette' is only written for paletted images.
+static u64
+pngFinish(MemArena* arena, u64 checkpoint, u8** pngData, const u8* raw, u64 rawSize, u32 width, u32 height,
+          u32 bitDepth, u32 colorType, const u8* palette, u32 colorCount, bool hasTransparency) {
+    static const u8 signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    
+    u8* compressed;
+    u64 compressedSize = zlibCompress(arena, &compressed, raw, rawSize);
+    
+    u8 header[13];
+    putImageHeader(header, width, height, bitDepth, colorType);
+    
+    // Signature, 3 to 5 chunks with 12 bytes of overhead each
+    u64 fileSize = sizeof(signature) + 5*12 + sizeof(header) + colorCount*3 + 1 + compressedSize;
+    u8* file = memArenaPushArrayNoZero(arena, u8, fileSize);
+    
+    u8* dest = file;
+    memcpy(dest, signature, sizeof(signature));
+    dest += sizeof(signature);
+    
+    dest = putChunk(dest, "IHDR", header, sizeof(header));
+    
+    if (palette)
+        dest = putChunk(dest, "PLTE", palette, colorCount * 3);
+    
+    if (hasTransparency) {
+        static const u8 alpha = 0;
+        dest = putChunk(dest, "tRNS", &alpha, 1);
+    }
+    
+    dest = putChunk(dest, "IDAT", compressed, (u32)compressedSize);
+    dest = putChunk(dest, "IEND", NULL, 0);
+    
+    fileSize = dest - file;
+    *pngData = keepInArena(arena, checkpoint, file, fileSize);
+    return fileSize;
+}
+
+u64
+pngEncodeIndexed(MemArena* arena, u8** pngData, const u8* pixels, u32 width, u32 height, u32 bitDepth,
+                 const u8* palette, u32 colorCount, bool hasTransparency) {
+    u64 checkpoint = memArenaCheckpoint(arena);
+    
+    // Every row starts with its filter type. Filters rarely help with palette indices, so it's always 0.
+    u32 rowSize = (width * bitDepth + 7) / 8;
+    u64 rawSize = (u64)(rowSize + 1) * height;
+    u8* raw = memArenaPushArrayNoZero(arena, u8, rawSize);
+    
+    for (u32 y = 0; y < height; y++) {
+        u8* rawRow = &raw[y * (rowSize + 1)];
+        const u8* row = &pixels[y * width];
+        rawRow[0] = 0;
+        
+        if (bitDepth == 8) {
+            memcpy(&rawRow[1], row, rowSize);
+        } else {
+            // Packed with the leftmost pixel in the high bits
+            u32 pixelsPerByte = 8 / bitDepth;
+            memset(&rawRow[1], 0, rowSize);
+            
+            for (u32 x = 0; x < width; x++) {
+                u32 shift = 8 - bitDepth * (1 + x % pixelsPerByte);
+                rawRow[1 + x / pixelsPerByte] |= (row[x] & ((1 << bitDepth) - 1)) << shift;
+            }
+        }
+    }
+    
+    return pngFinish(arena, checkpoint, pngData, raw, rawSize, width, height, bitDepth, 3, palette, colorCount,
+                     hasTransparency);
+}
+
+u64
+pngEncodeRgba(MemArena* arena, u8** pngData, const u32* pixels, u32 width, u32 height) {
+    u64 checkpoint = memArenaCheckpoint(arena);
+    
+    // Sprites are mostly runs of the same few colors, which LZ77 already handles well without a filter.
+    u32 rowSize = width * sizeof(u32);
+    u64 rawSize = (u64)(rowSize + 1) * height;
+    u8* raw = memArenaPushArrayNoZero(arena, u8, rawSize);
+    
+    for (u32 y = 0; y < height; y++) {
+        raw[y * (rowSize + 1)] = 0;
+        memcpy(&raw[y * (rowSize + 1) + 1], &pixels[y * width], rowSize);
+    }
+    
+    return pngFinish(arena, checkpoint, pngData, raw, rawSize, width, height, 8, 6, NULL, 0, FALSE);
+}
+
+// Part of the canvas that one frame of an animated PNG replaces
+typedef struct {
+    const u32* pixels; // Whole canvas, to compare the next frame against
+    u32 left;
+    u32 top;
+    u32 width;
+    u32 height;
+    u32 delay;
+    
+    u8* data;          // Compressed rows of the rectangle
+    u64 size;
+} ApngDelta;
+
+// Smallest rectangle containing every pixel that differs between 'a' and 'b'.
+// Returns FALSE if they are the same.
+static bool
+findChangedRect(const u32* a, const u32* b, u32 width, u32 height, ApngDelta* delta) {
+    u32 rowSize = width * sizeof(u32);
+    u32 top = 0;
+    u32 bottom = height;
+    
+    while ((top < height) && !memcmp(&a[top * width], &b[top * width], rowSize))
+        top++;
+    if (top == height)
+        return FALSE;
+    
+    while (!memcmp(&a[(bottom - 1) * width], &b[(bottom - 1) * width], rowSize))
+        bottom--;
+    
+    u32 left = width;
+    u32 right = 0;
+    for (u32 y = top; y < bottom; y++) {
+        const u32* rowA = &a[y * width];
+        const u32* rowB = &b[y * width];
+        
+        for (u32 x = 0; x < left; x++) {
+            if (rowA[x] != rowB[x]) {
+                left = x;
+                break;
+            }
+        }
+        for (u32 x = width; x > right; x--) {
+            if (rowA[x - 1] != rowB[x - 1]) {
+                right = x;
+                break;
+            }
+        }
+    }
+    
+    delta->left   = left;
+    delta->top    = top;
+    delta->width  = right - left;
+    delta->height = bottom - top;
+    return TRUE;
+}
+
+u64
+pngEncodeAnimated(MemArena* arena, u8** pngData, const ApngFrame* frames, u32 frameCount, u32 width, u32 height,
+                  u16 delayDivisor, u32 playCount) {
+    static const u8 signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    u64 checkpoint = memArenaCheckpoint(arena);
+    
+    ApngDelta* deltas = memArenaPushArrayNoZero(arena, ApngDelta, frameCount);
+    u32 deltaCount = 0;
+    u64 dataSize = 0;
+    
+    for (u32 i = 0; i < frameCount; i++) {
+        ApngDelta* delta = &deltas[deltaCount];
+        
+        // The first frame is the default image, which always covers the whole canvas.
+        if (deltaCount == 0) {
+            delta->left   = 0;
+            delta->top    = 0;
+            delta->width  = width;
+            delta->height = height;
+        } else if (!findChangedRect(deltas[deltaCount - 1].pixels, frames[i].pixels, width, height, delta)) {
+            ApngDelta* previous = &deltas[deltaCount - 1];
+            
+            if (previous->delay + frames[i].delay <= 0xFFFF) {
+                previous->delay += frames[i].delay;
+                continue;
+            }
+            
+            // Too long for one frame, so this one repeats a pixel
+            delta->left   = 0;
+            delta->top    = 0;
+            delta->width  = 1;
+            delta->height = 1;
+        }
+        
+        delta->pixels = frames[i].pixels;
+        delta->delay  = frames[i].delay;
+        deltaCount++;
+        
+        // Only the rectangle gets stored, with filter 0 like 'pngEncodeRgba'
+        u64 rawCheckpoint = memArenaCheckpoint(arena);
+        u32 rowSize = delta->width * sizeof(u32);
+        u64 rawSize = (u64)(rowSize + 1) * delta->height;
+        u8* raw = memArenaPushArrayNoZero(arena, u8, rawSize);
+        
+        for (u32 y = 0; y < delta->height; y++) {
+            raw[y * (rowSize + 1)] = 0;
+            memcpy(&raw[y * (rowSize + 1) + 1], &frames[i].pixels[(delta->top + y) * width + delta->left], rowSize);
+        }
+        
+        u8* compressed;
+        delta->size = zlibCompress(arena, &compressed, raw, rawSize);
+        delta->data = keepInArena(arena, rawCheckpoint, compressed, delta->size);
+        dataSize += delta->size;
+    }
+    
+    u8 header[13];
+    putImageHeader(header, width, height, 8, 6);
+    
+    u8 animationControl[8];
+    putU32BigEndian(&animationControl[0], deltaCount);
+    putU32BigEndian(&animationControl[4], playCount);
+    
+    // Signature, IHDR, acTL and IEND, then fcTL and IDAT/fdAT per frame (fdAT has a sequence number)
+    u64 fileSize = sizeof(signature) + 3*12 + sizeof(header) + sizeof(animationControl)
+                 + (u64)deltaCount * (2*12 + 26 + 4) + dataSize;
+    u8* file = memArenaPushArrayNoZero(arena, u8, fileSize);
+    
+    u8* dest = file;
+    memcpy(dest, signature, sizeof(signature));
+    dest += sizeof(signature);
+    
+    dest = putChunk(dest, "IHDR", header, sizeof(header));
+    dest = putChunk(dest, "acTL", animationControl, sizeof(animationControl));
+    
+    // fcTL and fdAT share one sequence, IDAT doesn't take part in it
+    u32 sequence = 0;
+    for (u32 i = 0; i < deltaCount; i++) {
+        ApngDelta* delta = &deltas[i];
+        
+        u8 frameControl[22];
+        putU32BigEndian(&frameControl[0],  delta->width);
+        putU32BigEndian(&frameControl[4],  delta->height);
+        putU32BigEndian(&frameControl[8],  delta->left);
+        putU32BigEndian(&frameControl[12], delta->top);
+        frameControl[16] = (u8)(delta->delay >> 8);
+        frameControl[17] = (u8)(delta->delay);
+        frameControl[18] = (u8)(delayDivisor >> 8);
+        frameControl[19] = (u8)(delayDivisor);
+        frameControl[20] = 0; // APNG_DISPOSE_OP_NONE: The next frame gets drawn over this one
+        frameControl[21] = 0; // APNG_BLEND_OP_SOURCE: Transparent pixels replace what was there
+        dest = putSequencedChunk(dest, "fcTL", sequence++, frameControl, sizeof(frameControl));
+        
+        if (i == 0)
+            dest = putChunk(dest, "IDAT", delta->data, (u32)delta->size);
+        else
+            dest = putSequencedChunk(dest, "fdAT", sequence++, delta->data, (u32)delta->size);
+    }
+    
+    dest = putChunk(dest, "IEND", NULL, 0);
+    
+    fileSize = dest - file;
+    *pngData = keepInArena(arena, checkpoint, file, fileSize);
+    return fileSize;
+}
@@ -0,0 +1,38 @@
+#ifndef GUARD_PNG_H
+#define GUARD_PNG_H
+
+// Minimal writer for paletted, RGBA and animated PNGs (APNG), with its own deflate (LZ77 + fixed Huffman codes),
+// so the exporter doesn't need zlib or an external tool to create images.
+//
+// Needs "types.h" and "ArenaAlloc.h" to be included before.
+
+// 'pixels' are 'height' rows of 'width' palette indices, one byte each,
+// which get packed into 'bitDepth' (1, 2, 4 or 8) bits per pixel.
+// 'palette' holds 'colorCount' RGB triplets.
+// With 'hasTransparency', color 0 is fully transparent, like on the GBA.
+// The file gets put together inside of 'arena', its size is returned.
+u64 pngEncodeIndexed(MemArena *arena, u8 **pngData, const u8 *pixels, u32 width, u32 height, u32 bitDepth,
+                     const u8 *palette, u32 colorCount, bool hasTransparency);
+
+// 'pixels' are 'height' rows of 'width' RGBA colors (R in the lowest byte, see OamRender.h).
+u64 pngEncodeRgba(MemArena *arena, u8 **pngData, const u32 *pixels, u32 width, u32 height);
+
+// One frame of an animated PNG: the whole canvas, shown for 'delay' / 'delayDivisor' seconds.
+typedef struct {
+    const u32 *pixels;
+    u16 delay;
+} ApngFrame;
+
+// Writes 'frames' (all 'width' x 'height') as an animated PNG, that gets played 'playCount' times (0 = forever).
+// Every frame only stores the rectangle that changed since the frame before it,
+// frames that don't change anything make the one before them last longer instead.
+u64 pngEncodeAnimated(MemArena *arena, u8 **pngData, const ApngFrame *frames, u32 frameCount, u32 width, u32 height,
+                      u16 delayDivisor, u32 playCount);
+
+// Deflate-compresses 'size' bytes into a zlib stream inside of 'arena', and returns its size.
+u64 zlibCompress(MemArena *arena, u8 **compressed, const u8 *data, u64 size);
+
+u32 crc32Update(u32 crc, const u8 *data, u64 size);
+u32 adler32(const u8 *data, u64 size);
+
+#endif //GUARD_PNG_H
@@ -0,0 +1,104 @@
+#include <stdio.h>
+
+#ifdef _MSC_VER
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "types.h"
+#include "Threads.h"
+
+typedef struct {
+    ThreadProc *proc;
+    void *params;
+} ThreadStart;
+
+#ifdef _MSC_VER
+static DWORD WINAPI
+threadEntry(LPVOID param) {
+    ThreadStart *start = (ThreadStart*)param;
+    start->proc(start->params);
+    return 0;
+}
+#else
+static void*
+threadEntry(void *param) {
+    ThreadStart *start = (ThreadStart*)param;
+    start->proc(start->params);
+    return NULL;
+}
+#endif
+
+// Number of logical processors available to this process.
+u32
+getProcessorCount(void) {
+    s64 count = 1;
+    
+#ifdef _MSC_VER
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    count = info.dwNumberOfProcessors;
+#else
+#ifdef _SC_NPROCESSORS_ONLN
+    count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+#endif
+    
+    return (u32)Max(count, 1);
+}
+
+// Call 'proc' on 'threadCount' threads and wait for all of them to finish.
+// Thread i gets '(u8*)params + i*paramsStride' as its parameter.
+// The calling thread runs thread 0 itself.
+void
+runThreads(ThreadProc *proc, void *params, u64 paramsStride, u32 threadCount) {
+    ThreadStart starts[MAX_THREADS];
+    
+    threadCount = Min(Max(threadCount, 1), MAX_THREADS);
+    
+    for(u32 i = 0; i < threadCount; i++) {
+        starts[i].proc = proc;
+        starts[i].params = (u8*)params + i*paramsStride;
+    }
+    
+#ifdef _MSC_VER
+    HANDLE threads[MAX_THREADS];
+    
+    for(u32 i = 1; i < threadCount; i++) {
+        threads[i] = CreateThread(NULL, 0, threadEntry, &starts[i], 0, NULL);
+        assert(threads[i]);
+    }
+    
+    proc(starts[0].params);
+    
+    for(u32 i = 1; i < threadCount; i++) {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+#else
+    pthread_t threads[MAX_THREADS];
+    
+    for(u32 i = 1; i < threadCount; i++) {
+        int error = pthread_create(&threads[i], NULL, threadEntry, &starts[i]);
+        assert(error == 0);
+    }
+    
+    proc(starts[0].params);
+    
+    for(u32 i = 1; i < threadCount; i++) {
+        pthread_join(threads[i], NULL);
+    }
+#endif
+}
+
+// Add 'amount' to 'value' and return the previous value.
+u32
+atomicFetchAddU32(volatile u32 *value, u32 amount) {
+#ifdef _MSC_VER
+    return (u32)InterlockedExchangeAdd((volatile LONG*)value, (LONG)amount);
+#else
+    return __atomic_fetch_add(value, amount, __ATOMIC_SEQ_CST);
+#endif
+}
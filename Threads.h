@@ -0,0 +1,13 @@
+#ifndef GUARD_THREADS_H
+#define GUARD_THREADS_H
+
+#define MAX_THREADS 64
+
+// Entry point of a thread started by 'runThreads'
+typedef void ThreadProc(void *params);
+
+u32 getProcessorCount(void);
+void runThreads(ThreadProc *proc, void *params, u64 paramsStride, u32 threadCount);
+u32 atomicFetchAddU32(volatile u32 *value, u32 amount);
+
+#endif //GUARD_THREADS_H
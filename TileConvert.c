@@ -0,0 +1,272 @@
+#include <string.h>
+#include <stdio.h>
+
+#include "types.h"
+#include "TileConvert.h"
+
+// Use the SSE2/AVX2 versions on CPUs that have them.
+// Turning this off leaves only the plain version, e.g. for checking the others against it.
+#define TILE_CONVERT_USE_SIMD TRUE
+
+#if TILE_CONVERT_USE_SIMD && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2)))
+#define HAS_SSE2 TRUE
+#include <emmintrin.h>
+
+// AVX2 gets compiled for single functions, so the rest of the program still runs on any x64 CPU.
+#if defined(_MSC_VER)
+#define HAS_AVX2 TRUE
+#define TARGET_AVX2
+#include <immintrin.h>
+#include <intrin.h>
+#elif defined(__GNUC__)
+#define HAS_AVX2 TRUE
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+#endif
+
+#ifndef HAS_SSE2
+#define HAS_SSE2 FALSE
+#endif
+#ifndef HAS_AVX2
+#define HAS_AVX2 FALSE
+#endif
+
+const char* tileKernelNames[TILE_KERNEL_COUNT] = {
+    [TILE_KERNEL_SCALAR] = "scalar",
+    [TILE_KERNEL_SSE2]   = "SSE2",
+    [TILE_KERNEL_AVX2]   = "AVX2",
+};
+
+bool
+tileKernelIsSupported(TileKernel kernel) {
+    switch (kernel) {
+        case TILE_KERNEL_SCALAR:
+            return TRUE;
+        
+        case TILE_KERNEL_SSE2:
+            return HAS_SSE2;
+        
+        case TILE_KERNEL_AVX2: {
+#if HAS_AVX2 && defined(_MSC_VER)
+            // AVX2 needs the CPU to have it, and the OS to save the YMM registers.
+            int info[4];
+            __cpuid(info, 0);
+            if (info[0] < 7)
+                return FALSE;
+            
+            __cpuid(info, 1);
+            if (!(info[2] & (1 << 27)) || ((_xgetbv(0) & 6) != 6))
+                return FALSE;
+            
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+#elif HAS_AVX2
+            // Checks the OS support as well
+            return __builtin_cpu_supports("avx2") != 0;
+#else
+            return FALSE;
+#endif
+        }
+        
+        default:
+            return FALSE;
+    }
+}
+
+// The CPU gets asked only once, since this is needed for every frame and sprite.
+// Threads that get here at the same time all come to the same result, so it doesn't matter who stores it.
+TileKernel
+tileKernelGetBest(void) {
+    static volatile s32 bestKernel = -1;
+    
+    if (bestKernel < 0) {
+        TileKernel kernel = TILE_KERNEL_COUNT - 1;
+        while ((kernel > TILE_KERNEL_SCALAR) && !tileKernelIsSupported(kernel))
+            kernel--;
+        
+        bestKernel = kernel;
+    }
+    
+    return (TileKernel)bestKernel;
+}
+
+// A row of a 4bpp tile is 4 bytes with 2 pixels each, the left pixel in the low nibble.
+// Every byte gets spread out to 16 bits first, then its high nibble moves up into the next byte.
+static inline u64
+unpackRow4bpp(u32 row) {
+    u64 pixels = row;
+    pixels = (pixels | (pixels << 16)) & 0x0000FFFF0000FFFFULL;
+    pixels = (pixels | (pixels <<  8)) & 0x00FF00FF00FF00FFULL;
+    pixels = (pixels | (pixels <<  4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return pixels;
+}
+
+static void
+tileToIndexedScalar(const u8* tile, u32 tileSize, u8* dest, u32 pitch) {
+    for (u32 y = 0; y < TILE_WIDTH; y++) {
+        if (tileSize == TILE_SIZE_4BPP) {
+            u32 row;
+            memcpy(&row, &tile[y * sizeof(row)], sizeof(row));
+            
+            u64 pixels = unpackRow4bpp(row);
+            memcpy(&dest[y * pitch], &pixels, sizeof(pixels));
+        } else {
+            memcpy(&dest[y * pitch], &tile[y * TILE_WIDTH], TILE_WIDTH);
+        }
+    }
+}
+
+#if HAS_SSE2
+// Turns 16 bytes of 4bpp tiles (4 rows of 8 pixels) into 32 pixels, 'first' gets rows 0-1, 'second' rows 2-3.
+static inline void
+unpackNibblesSse2(__m128i packed, __m128i* first, __m128i* second) {
+    __m128i mask = _mm_set1_epi8(0x0F);
+    __m128i low  = _mm_and_si128(packed, mask);
+    __m128i high = _mm_and_si128(_mm_srli_epi16(packed, 4), mask);
+    
+    *first  = _mm_unpacklo_epi8(low, high);
+    *second = _mm_unpackhi_epi8(low, high);
+}
+
+static void
+tileToIndexedSse2(const u8* tile, u32 tileSize, u8* dest, u32 pitch) {
+    if (tileSize != TILE_SIZE_4BPP) {
+        tileToIndexedScalar(tile, tileSize, dest, pitch);
+        return;
+    }
+    
+    for (u32 y = 0; y < TILE_WIDTH; y += 4) {
+        __m128i rows01, rows23;
+        unpackNibblesSse2(_mm_loadu_si128((const __m128i*)&tile[y * 4]), &rows01, &rows23);
+        
+        _mm_storel_epi64((__m128i*)&dest[(y + 0) * pitch], rows01);
+        _mm_storel_epi64((__m128i*)&dest[(y + 1) * pitch], _mm_unpackhi_epi64(rows01, rows01));
+        _mm_storel_epi64((__m128i*)&dest[(y + 2) * pitch], rows23);
+        _mm_storel_epi64((__m128i*)&dest[(y + 3) * pitch], _mm_unpackhi_epi64(rows23, rows23));
+    }
+}
+
+// Two tiles next to each other, so every store writes a full row of 16 pixels.
+static void
+tilePairToIndexedSse2(const u8* tiles, u32 tileSize, u8* dest, u32 pitch) {
+    const u8* left  = tiles;
+    const u8* right = tiles + tileSize;
+    
+    if (tileSize == TILE_SIZE_4BPP) {
+        for (u32 y = 0; y < TILE_WIDTH; y += 4) {
+            __m128i left01, left23, right01, right23;
+            unpackNibblesSse2(_mm_loadu_si128((const __m128i*)&left[y * 4]),  &left01,  &left23);
+            unpackNibblesSse2(_mm_loadu_si128((const __m128i*)&right[y * 4]), &right01, &right23);
+            
+            _mm_storeu_si128((__m128i*)&dest[(y + 0) * pitch], _mm_unpacklo_epi64(left01, right01));
+            _mm_storeu_si128((__m128i*)&dest[(y + 1) * pitch], _mm_unpackhi_epi64(left01, right01));
+            _mm_storeu_si128((__m128i*)&dest[(y + 2) * pitch], _mm_unpacklo_epi64(left23, right23));
+            _mm_storeu_si128((__m128i*)&dest[(y + 3) * pitch], _mm_unpackhi_epi64(left23, right23));
+        }
+    } else {
+        for (u32 y = 0; y < TILE_WIDTH; y += 2) {
+            __m128i leftRows  = _mm_loadu_si128((const __m128i*)&left[y * TILE_WIDTH]);
+            __m128i rightRows = _mm_loadu_si128((const __m128i*)&right[y * TILE_WIDTH]);
+            
+            _mm_storeu_si128((__m128i*)&dest[(y + 0) * pitch], _mm_unpacklo_epi64(leftRows, rightRows));
+            _mm_storeu_si128((__m128i*)&dest[(y + 1) * pitch], _mm_unpackhi_epi64(leftRows, rightRows));
+        }
+    }
+}
+#endif
+
+#if HAS_AVX2
+// Like 'unpackNibblesSse2', but every 128-bit lane does it on its own:
+// With a whole 4bpp tile, 'first' gets rows 0-1 | 4-5 and 'second' rows 2-3 | 6-7.
+TARGET_AVX2 static inline void
+unpackNibblesAvx2(__m256i packed, __m256i* first, __m256i* second) {
+    __m256i mask = _mm256_set1_epi8(0x0F);
+    __m256i low  = _mm256_and_si256(packed, mask);
+    __m256i high = _mm256_and_si256(_mm256_srli_epi16(packed, 4), mask);
+    
+    *first  = _mm256_unpacklo_epi8(low, high);
+    *second = _mm256_unpackhi_epi8(low, high);
+}
+
+// 'rowsN' hold 4 rows of tile N, 2 per lane. Writes those rows of all four tiles next to each other:
+// 'rowA'/'rowC' come from the low/high half of the first lane, 'rowB'/'rowD' from the second lane.
+TARGET_AVX2 static inline void
+storeRowsAvx2(__m256i rows0, __m256i rows1, __m256i rows2, __m256i rows3, u8* dest, u32 pitch,
+              u32 rowA, u32 rowB, u32 rowC, u32 rowD) {
+    __m256i low01  = _mm256_unpacklo_epi64(rows0, rows1);
+    __m256i low23  = _mm256_unpacklo_epi64(rows2, rows3);
+    __m256i high01 = _mm256_unpackhi_epi64(rows0, rows1);
+    __m256i high23 = _mm256_unpackhi_epi64(rows2, rows3);
+    
+    _mm256_storeu_si256((__m256i*)&dest[rowA * pitch], _mm256_permute2x128_si256(low01,  low23,  0x20));
+    _mm256_storeu_si256((__m256i*)&dest[rowB * pitch], _mm256_permute2x128_si256(low01,  low23,  0x31));
+    _mm256_storeu_si256((__m256i*)&dest[rowC * pitch], _mm256_permute2x128_si256(high01, high23, 0x20));
+    _mm256_storeu_si256((__m256i*)&dest[rowD * pitch], _mm256_permute2x128_si256(high01, high23, 0x31));
+}
+
+// Four tiles next to each other, so every store writes a full row of 32 pixels.
+TARGET_AVX2 static void
+tileQuadToIndexedAvx2(const u8* tiles, u32 tileSize, u8* dest, u32 pitch) {
+    if (tileSize == TILE_SIZE_4BPP) {
+        __m256i first[4], second[4];
+        
+        for (u32 i = 0; i < 4; i++)
+            unpackNibblesAvx2(_mm256_loadu_si256((const __m256i*)&tiles[i * tileSize]), &first[i], &second[i]);
+        
+        storeRowsAvx2(first[0],  first[1],  first[2],  first[3],  dest, pitch, 0, 4, 1, 5);
+        storeRowsAvx2(second[0], second[1], second[2], second[3], dest, pitch, 2, 6, 3, 7);
+    } else {
+        // The first half of an 8bpp tile has rows 0-1 | 2-3, the second half rows 4-5 | 6-7.
+        for (u32 half = 0; half < 2; half++) {
+            __m256i rows[4];
+            
+            for (u32 i = 0; i < 4; i++)
+                rows[i] = _mm256_loadu_si256((const __m256i*)&tiles[i * tileSize + half * 32]);
+            
+            u32 y = half * 4;
+            storeRowsAvx2(rows[0], rows[1], rows[2], rows[3], dest, pitch, y + 0, y + 2, y + 1, y + 3);
+        }
+    }
+}
+#endif
+
+void
+tilesToIndexedWithKernel(TileKernel kernel, const u8* tiles, u32 tileCount, u32 widthInTiles, u32 tileSize,
+                         u8* dest) {
+    assert((tileSize == TILE_SIZE_4BPP) || (tileSize == TILE_SIZE_8BPP));
+    assert(kernel <= tileKernelGetBest()); // Every kernel before the best one works as well
+    
+    u32 pitch = widthInTiles * TILE_WIDTH;
+    
+    for (u32 firstTile = 0; firstTile < tileCount; firstTile += widthInTiles) {
+        u32 count = Min(widthInTiles, tileCount - firstTile);
+        const u8* rowTiles = &tiles[firstTile * tileSize];
+        u8* rowDest = &dest[(firstTile / widthInTiles) * TILE_WIDTH * pitch];
+        u32 x = 0;
+        
+#if HAS_AVX2
+        if (kernel == TILE_KERNEL_AVX2) {
+            for (; x + 4 <= count; x += 4)
+                tileQuadToIndexedAvx2(&rowTiles[x * tileSize], tileSize, &rowDest[x * TILE_WIDTH], pitch);
+        }
+#endif
+#if HAS_SSE2
+        if (kernel >= TILE_KERNEL_SSE2) {
+            for (; x + 2 <= count; x += 2)
+                tilePairToIndexedSse2(&rowTiles[x * tileSize], tileSize, &rowDest[x * TILE_WIDTH], pitch);
+            
+            for (; x < count; x++)
+                tileToIndexedSse2(&rowTiles[x * tileSize], tileSize, &rowDest[x * TILE_WIDTH], pitch);
+        }
+#endif
+        
+        for (; x < count; x++)
+            tileToIndexedScalar(&rowTiles[x * tileSize], tileSize, &rowDest[x * TILE_WIDTH], pitch);
+    }
+}
+
+void
+tilesToIndexed(const u8* tiles, u32 tileCount, u32 widthInTiles, u32 tileSize, u8* dest) {
+    tilesToIndexedWithKernel(tileKernelGetBest(), tiles, tileCount, widthInTiles, tileSize, dest);
+}
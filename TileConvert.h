@@ -0,0 +1,30 @@
+#ifndef GUARD_TILE_CONVERT_H
+#define GUARD_TILE_CONVERT_H
+
+// Turns GBA tiles (8x8 pixels each, 4bpp or 8bpp) into rows of pixels with one palette index per byte,
+// which is what every image output starts from.
+// There are SSE2 and AVX2 versions next to the plain one, the fastest one the CPU supports gets picked.
+//
+// Needs "types.h" to be included before.
+
+typedef enum {
+    TILE_KERNEL_SCALAR,
+    TILE_KERNEL_SSE2,
+    TILE_KERNEL_AVX2,
+    
+    TILE_KERNEL_COUNT
+} TileKernel;
+
+extern const char *tileKernelNames[TILE_KERNEL_COUNT];
+
+bool tileKernelIsSupported(TileKernel kernel);
+TileKernel tileKernelGetBest(void); // Only checks the CPU the first time
+
+// Lays out 'tileCount' tiles with 'widthInTiles' per row (the way OAM tiles are in a 1D mapped frame).
+// 'dest' gets 'widthInTiles * TILE_WIDTH' bytes per row and needs room for whole rows of tiles,
+// missing tiles of the last row are left untouched.
+void tilesToIndexed(const u8 *tiles, u32 tileCount, u32 widthInTiles, u32 tileSize, u8 *dest);
+void tilesToIndexedWithKernel(TileKernel kernel, const u8 *tiles, u32 tileCount, u32 widthInTiles, u32 tileSize,
+                              u8 *dest);
+
+#endif //GUARD_TILE_CONVERT_H
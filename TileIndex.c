@@ -0,0 +1,150 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "types.h"
+#include "ArenaAlloc.h"
+#include "Hash.h"
+#include "TileIndex.h"
+
+#ifdef _MSC_VER
+#define ByteSwap32(x) _byteswap_ulong(x)
+#define ByteSwap64(x) _byteswap_uint64(x)
+#else
+#define ByteSwap32(x) __builtin_bswap32(x)
+#define ByteSwap64(x) __builtin_bswap64(x)
+#endif
+
+// A row of a 4bpp tile is 4 bytes with 2 pixels each, the left pixel in the low nibble.
+// Mirroring it reverses the order of the bytes and swaps the nibbles inside of every byte.
+static inline u32
+mirrorRow4bpp(u32 row) {
+    row = ByteSwap32(row);
+    return ((row >> 4) & 0x0F0F0F0F) | ((row & 0x0F0F0F0F) << 4);
+}
+
+void
+tileFlip4bpp(const u8* src, u8* dest, u32 flip) {
+    u32 rows[TILE_WIDTH];
+    memcpy(rows, src, sizeof(rows));
+    
+    for (int y = 0; y < TILE_WIDTH; y++) {
+        u32 row = rows[(flip & TILE_FLIP_V) ? (TILE_WIDTH - 1 - y) : y];
+        if (flip & TILE_FLIP_H)
+            row = mirrorRow4bpp(row);
+        
+        memcpy(&dest[y * sizeof(row)], &row, sizeof(row));
+    }
+}
+
+// A row of an 8bpp tile is 8 bytes with one pixel each, so only the byte order gets reversed.
+void
+tileFlip8bpp(const u8* src, u8* dest, u32 flip) {
+    u64 rows[TILE_WIDTH];
+    memcpy(rows, src, sizeof(rows));
+    
+    for (int y = 0; y < TILE_WIDTH; y++) {
+        u64 row = rows[(flip & TILE_FLIP_V) ? (TILE_WIDTH - 1 - y) : y];
+        if (flip & TILE_FLIP_H)
+            row = ByteSwap64(row);
+        
+        memcpy(&dest[y * sizeof(row)], &row, sizeof(row));
+    }
+}
+
+// Rebuilds the slots with room for twice as many tiles, keeping the load factor at or below 50%
+static void
+tileIndexGrow(TileIndex* index) {
+    index->slotCount = Max(index->slotCount * 2, 1024);
+    
+    memArenaRestore(&index->slotArena, 0);
+    index->slots = memArenaPushArray(&index->slotArena, u32, index->slotCount);
+    
+    for (u32 i = 0; i < index->uniqueCount; i++) {
+        u32 slot = (u32)index->uniqueHashes[i] & (index->slotCount - 1);
+        
+        while (index->slots[slot] != 0)
+            slot = (slot + 1) & (index->slotCount - 1);
+        
+        index->slots[slot] = i + 1;
+    }
+}
+
+void
+tileIndexInit(TileIndex* index, const u8* tiles, u32 tileCount, u32 tileSize) {
+    memset(index, 0, sizeof(*index));
+    index->tiles     = tiles;
+    index->tileCount = tileCount;
+    index->tileSize  = tileSize;
+    
+    memArenaInit(&index->keyArena);
+    memArenaInit(&index->uniqueArena);
+    memArenaInit(&index->hashArena);
+    memArenaInit(&index->slotArena);
+    
+    index->keys         = memArenaPushArray(&index->keyArena, u32, tileCount);
+    index->uniqueTiles  = index->uniqueArena.memory;
+    index->uniqueHashes = index->hashArena.memory;
+    tileIndexGrow(index);
+}
+
+void
+tileIndexFree(TileIndex* index) {
+    memArenaFree(&index->keyArena);
+    memArenaFree(&index->uniqueArena);
+    memArenaFree(&index->hashArena);
+    memArenaFree(&index->slotArena);
+}
+
+// Returns the key of tile 'tileId' (see 'TileIndex.keys'), canonicalising it on first use.
+u32
+tileIndexGetKey(TileIndex* index, u32 tileId) {
+    assert(tileId < index->tileCount);
+    
+    if (index->keys[tileId] != 0)
+        return index->keys[tileId];
+    
+    u32 tileSize = index->tileSize;
+    const u8* tile = &index->tiles[tileId * tileSize];
+    
+    // The smallest version becomes the canonical one.
+    // Flips are their own inverse, so the flip that creates it from 'tile' also turns it back.
+    u8 versions[4][TILE_SIZE_8BPP];
+    u32 canonicalFlip = 0;
+    memcpy(versions[0], tile, tileSize);
+    
+    for (u32 flip = 1; flip < 4; flip++) {
+        if (tileSize == TILE_SIZE_4BPP)
+            tileFlip4bpp(tile, versions[flip], flip);
+        else
+            tileFlip8bpp(tile, versions[flip], flip);
+        
+        if (memcmp(versions[flip], versions[canonicalFlip], tileSize) < 0)
+            canonicalFlip = flip;
+    }
+    
+    u8* canonical = versions[canonicalFlip];
+    u64 hash = hash64(canonical, tileSize, 0);
+    u32 slot = (u32)hash & (index->slotCount - 1);
+    
+    for (; index->slots[slot] != 0; slot = (slot + 1) & (index->slotCount - 1)) {
+        u32 uniqueId = index->slots[slot] - 1;
+        
+        if ((index->uniqueHashes[uniqueId] == hash)
+            && !memcmp(&index->uniqueTiles[uniqueId * tileSize], canonical, tileSize)) {
+            index->keys[tileId] = ((uniqueId + 1) << 2) | canonicalFlip;
+            return index->keys[tileId];
+        }
+    }
+    
+    u32 uniqueId = index->uniqueCount++;
+    memArenaAddMemory(&index->uniqueArena, canonical, tileSize);
+    memArenaAddU64(&index->hashArena, hash);
+    index->slots[slot] = uniqueId + 1;
+    
+    if (index->uniqueCount * 2 > index->slotCount)
+        tileIndexGrow(index);
+    
+    index->keys[tileId] = ((uniqueId + 1) << 2) | canonicalFlip;
+    return index->keys[tileId];
+}
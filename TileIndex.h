@@ -0,0 +1,46 @@
+#ifndef GUARD_TILE_INDEX_H
+#define GUARD_TILE_INDEX_H
+
+// Finds the tiles of a tile table that only differ by being flipped.
+// Every tile gets mapped to a "canonical" tile (the smallest of its 4 flipped versions)
+// and the flip that turns the canonical tile back into it, like an OAM entry would.
+//
+// Needs "types.h" and "ArenaAlloc.h" to be included before.
+
+#define TILE_FLIP_H 1
+#define TILE_FLIP_V 2
+
+typedef struct {
+    const u8 *tiles;
+    u32 tileCount;
+    u32 tileSize; // TILE_SIZE_4BPP or TILE_SIZE_8BPP
+    
+    // Per tile of 'tiles': ((uniqueId + 1) << 2) | flip, 0 = wasn't looked at yet
+    u32 *keys;
+    
+    // Canonical tiles, 'tileSize' bytes each
+    u8 *uniqueTiles;
+    u64 *uniqueHashes;
+    u32 uniqueCount;
+    
+    // Open addressing, each slot holds a uniqueId + 1 (0 = empty)
+    u32 *slots;
+    u32 slotCount;
+    
+    MemArena keyArena;
+    MemArena uniqueArena;
+    MemArena hashArena;
+    MemArena slotArena;
+} TileIndex;
+
+void tileIndexInit(TileIndex *index, const u8 *tiles, u32 tileCount, u32 tileSize);
+void tileIndexFree(TileIndex *index);
+u32 tileIndexGetKey(TileIndex *index, u32 tileId);
+
+void tileFlip4bpp(const u8 *src, u8 *dest, u32 flip);
+void tileFlip8bpp(const u8 *src, u8 *dest, u32 flip);
+
+static inline u32 tileKeyUniqueId(u32 key) { return (key >> 2) - 1; }
+static inline u32 tileKeyFlip(u32 key)     { return key & (TILE_FLIP_H | TILE_FLIP_V); }
+
+#endif //GUARD_TILE_INDEX_H
@@ -4,9 +4,14 @@
 #include <stdlib.h>
 
 #ifdef _MSC_VER
+#include <Windows.h>
 #include <direct.h>
 #define mkdir _mkdir
 #else
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #define mkdir(a) { mode_t perms = 0666; mkdir((a), perms); }
 #endif
@@ -14,16 +19,25 @@
 
 #include "types.h"
 #include "ArenaAlloc.h"
+#include "Threads.h"
+#include "OutBuffer.h"
+#include "Hash.h"
+#include "Manifest.h"
+#include "TileIndex.h"
+#include "Png.h"
+#include "TileConvert.h"
+#include "OamRender.h"
+#include "Atlas.h"
 
 // Needs to be included before animExporter.h
 #include "animation_commands.h"
 
 #include "animExporter.h"
+#include "AnimDb.h"
+#include "AnimVm.h"
 
 #define SizeofArray(array) ((sizeof(array)) / (sizeof(array[0])))
 
-#define OffsetPointer(ptrToOffset) (((u8*)(ptrToOffset)) + *(ptrToOffset))
-
 
 // TODO(Jace): Allow for custom animation table size
 #define SA1_ANIMATION_COUNT    908
@@ -44,20 +58,123 @@ const u32 g_TotalAnimationCount[] = {
 // so print to stdout per default, which is instant if it's directed to a file with ' > file.out'
 #define PRINT_TO_STDOUT FALSE
 
-// Identifiers
-#define AnimCmd_GetTiles        -1
-#define AnimCmd_GetPalette      -2
-#define AnimCmd_JumpBack        -3
-#define AnimCmd_End             -4
-#define AnimCmd_PlaySoundEffect -5
-#define AnimCmd_AddHitbox       -6
-#define AnimCmd_TranslateSprite -7
-#define AnimCmd_8               -8
-#define AnimCmd_SetIdAndVariant -9
-#define AnimCmd_10              -10
-#define AnimCmd_SetSpritePriority              -11
-#define AnimCmd_12              -12
-#define AnimCmd_DisplayFrame    (AnimCmd_12-1)
+// Map the ROM file read-only instead of copying it into a heap buffer.
+// If mapping fails for any reason, the ROM gets read with fread() instead.
+#define ROM_LOADER_USE_MMAP   TRUE
+
+// Prefault the whole mapping in mmap() itself (Linux only).
+// Without it, pages get faulted in lazily on the first access.
+#define ROM_MMAP_POPULATE     TRUE
+
+// Access pattern hint passed to madvise() for the mapping; 0 disables the call.
+// WILLNEED starts reading the whole image ahead, since table walks jump all over it.
+#ifdef MADV_WILLNEED
+#define ROM_MMAP_ADVICE       MADV_WILLNEED
+#else
+#define ROM_MMAP_ADVICE       0
+#endif
+
+// Load the ROM with both loaders a couple of times and print their timings to stderr.
+#define BENCHMARK_ROM_LOADERS FALSE
+
+// Number of threads decoding the animations in 'createDynamicAnimTable'.
+// 0 = one per processor.
+#define DECODE_THREAD_COUNT   0
+
+// Number of consecutive animations a decoding thread takes at once.
+#define DECODE_BLOCK_SIZE     16
+
+// Time appending decoded commands to an arena with memArenaReserve vs. pushAnimCmd.
+#define BENCHMARK_ARENA       FALSE
+
+// Print how long writing the macros and the animation table took to stderr.
+#define BENCHMARK_EMIT        FALSE
+
+// Write every animation into its own file 'documents/animations/anim_XXXX.<ext>',
+// instead of putting all of them into 'macros.<ext>' behind the header.
+// Concatenating the header and all the files in order gives the same text as the single file.
+#define OUTPUT_FILE_PER_ANIMATION FALSE
+
+// Increase this whenever a change alters what gets decoded from the ROM,
+// so that cached animations of older versions don't get used anymore.
+#define EXPORTER_VERSION      1
+
+// Keep the decoded animations in 'out/cache/<ROM hash>_v<EXPORTER_VERSION>.animdb',
+// so later runs on the same ROM can skip decoding.
+#define USE_DECODE_CACHE      TRUE
+
+// Print how long decoding the animations (or loading them from the cache) took to stderr.
+#define BENCHMARK_DECODE      FALSE
+
+// Remember the content hash of every written file in 'out/cache/<game>.manifest',
+// and don't touch files whose content didn't change since the last run.
+// That keeps their timestamps, so 'make' only rebuilds what actually changed.
+#define INCREMENTAL_OUTPUT    TRUE
+
+// Write 'documents/tile_dedup.csv', with how many of the tiles each animation uploads
+// are actually different, and how many are left if flipped tiles count as the same.
+#define OUTPUT_TILE_DEDUP_REPORT TRUE
+
+// Convert every exported frame into 'frames/<name>.png' right away (see Png.h),
+// instead of leaving it to the gbagfx calls in 'gen_frames.sh'.
+#define OUTPUT_PNG            TRUE
+
+// Render every frame the way the game shows it (flips, priorities, palettes, see OamRender.h)
+// into 'previews/<name>.png', as RGBA images.
+#define OUTPUT_FRAME_PREVIEWS TRUE
+
+// Play every variant like the game does (60 ticks per second, see AnimVm.h)
+// and write it into 'previews/a<anim>_v<variant>.png' as an animated PNG.
+#define OUTPUT_ANIMATED_PREVIEWS TRUE
+
+// How often loops get played in an animated preview, if they don't go back to the start of the variant.
+#define ANIM_PREVIEW_LOOP_COUNT    3
+
+// Animated previews stop after this many ticks, for variants that take longer than that.
+#define ANIM_PREVIEW_MAX_TICKS     (60 * 60)
+
+// Animated previews that would be bigger than this in either direction get skipped.
+#define ANIM_PREVIEW_MAX_SIZE      1024
+
+// Number of threads writing the animated previews. 0 = one per processor.
+#define PREVIEW_THREAD_COUNT  0
+
+// Print how long writing the animated previews took to stderr.
+#define BENCHMARK_PREVIEWS    FALSE
+
+// Print how long writing frames, palettes and documents took to stderr,
+// and how many files were skipped because they didn't change.
+#define BENCHMARK_OUTPUT      FALSE
+
+// Print how fast every tile conversion kernel (see TileConvert.h) turns all unique frames
+// of the ROM into pixels to stderr, and whether they all agree with the plain version.
+#define BENCHMARK_TILE_CONVERT FALSE
+
+// Write the decoded animations into 'documents/animations.animdb' (see AnimDb.h),
+// which other tools can map and read without parsing the C/asm output.
+#define OUTPUT_ANIMATION_DATABASE TRUE
+
+// Write the timeline of every variant into 'documents/animations.timeline' (see AnimVm.h):
+// which frame, hitboxes and translation are active from which tick on.
+#define OUTPUT_ANIMATION_TIMELINES TRUE
+
+// Replay the timelines and write how many bytes 'GetTiles' and 'GetPalette' copy whenever a frame changes,
+// into 'documents/dma_frames.csv', 'dma_variants.csv' and 'dma_summary.txt' (with the worst variants).
+#define OUTPUT_DMA_REPORT TRUE
+
+// What DMA can roughly copy from ROM to VRAM in one VBlank: 68 lines of 1232 cycles,
+// about 6 cycles per word (ROM waitstates and the 16-bit bus of VRAM).
+#define DMA_VBLANK_BUDGET_BYTES ((68 * 1232 / 6) * 4)
+
+// Variants listed in each ranking of 'dma_summary.txt'
+#define DMA_REPORT_WORST_COUNT  20
+
+// Number of threads formatting the animations' text in 'printAnimationDataFile'.
+// 0 = one per processor.
+#define EMIT_THREAD_COUNT     0
+
+// Number of consecutive animations a formatting thread takes at once.
+#define EMIT_BLOCK_SIZE       16
 
 const char* animCommands[] = {
     "AnimCmd_GetTiles",
@@ -257,9 +374,11 @@ const char *macrosC[SizeofArray(animCommands)] = {
         "#define SHOW_FRAME(duration, frameId)           duration, frameId,\n",
 };
 
-static void printAnimationTable(FILE* fileStream, DynTable* dynTable, AnimationTable* animTable, LabelStrings* labels, bool outputC);
-static u16 countVariants(u8* rom, AnimationTable* animTable, u32 animId);
+static void printAnimationTable(OutBuffer* out, DynTable* dynTable, AnimationTable* animTable, LabelStrings* labels, bool outputC);
+static u16 countVariants(RomView* rom, AnimationTable* animTable, u32 animId);
 static StringId pushLabel(LabelStrings* db, MemArena* stringArena, MemArena* offsetArena, char* label);
+char* addToPath(MemArena* arena, char* path, char* name);
+char* lastString(char* base, char* sub);
 
 
 static long int
@@ -279,37 +398,102 @@ getFileSize(FILE* file) {
     return size;
 }
 
+#if BENCHMARK_ROM_LOADERS || BENCHMARK_ARENA || BENCHMARK_EMIT || BENCHMARK_DECODE || BENCHMARK_PREVIEWS \
+    || BENCHMARK_OUTPUT || BENCHMARK_TILE_CONVERT
+// Monotonic wall-clock time, used for timing measurements.
+static double
+getWallClockSeconds(void) {
+#ifdef _MSC_VER
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+#endif
+}
+#endif
+
+// Translate a GBA ROM pointer into a pointer into the loaded image.
+// GBA ROM Pointers can only go from 0x08000000 to 0x09FFFFFF (32MB max.),
+// anything else - including pointers past the end of the image - returns NULL.
+static void*
+romToVirtual(RomView* rom, u32 gbaPointer) {
+    u32 offset = gbaPointer - ROM_BASE;
+    
+    // Pointers below ROM_BASE wrap around, so a single compare is enough.
+    if (offset < rom->size)
+        return rom->base + offset;
+    else
+        return NULL;
+}
+
+// Like 'romToVirtual', but 'byteCount' bytes starting at 'gbaPointer' all have to be inside the image.
 static void*
-romToVirtual(u8* rom, u32 gbaPointer) {
-    // GBA ROM Pointers can only go from 0x08000000 to 0x09FFFFFF (32MB max.)
-    u8 pointerMSB = ((gbaPointer & 0xFF000000) >> 24);
+romToVirtualChecked(RomView* rom, u32 gbaPointer, u64 byteCount) {
+    u32 offset = gbaPointer - ROM_BASE;
     
-    if (pointerMSB == 8 || pointerMSB == 9)
-        return (u32*)(rom + (gbaPointer & 0x00FFFFFF));
+    if ((offset < rom->size) && (byteCount <= (u64)(rom->size - offset)))
+        return rom->base + offset;
     else
         return NULL;
 }
 
-// TODO: Can indenting be done with character codes?
+// Check whether 'byteCount' bytes at an already translated 'pointer' are inside the image.
+static bool
+romViewContains(RomView* rom, const void* pointer, u64 byteCount) {
+    const u8* bytes = pointer;
+    
+    if ((bytes < rom->base) || (bytes >= rom->base + rom->size))
+        return FALSE;
+    
+    return (byteCount <= (u64)((rom->base + rom->size) - bytes));
+}
+
+// Translate a whole array of ROM pointers at once.
+// Returns FALSE if any of them isn't inside the image, the matching entry of 'out' is NULL then.
+static bool
+romToVirtualArray(RomView* rom, const RomPointer* pointers, u32 count, void** out) {
+    bool allValid = TRUE;
+    
+    for (u32 i = 0; i < count; i++) {
+        u32 offset = pointers[i] - ROM_BASE;
+        
+        if (offset < rom->size) {
+            out[i] = rom->base + offset;
+        } else {
+            out[i] = NULL;
+            allValid = FALSE;
+        }
+    }
+    
+    return allValid;
+}
+
 static void
-printHeaderLine(FILE* fileStream, const char* name, int value, int rightAlign, bool outputC) {
+printHeaderLine(OutBuffer* out, const char* name, int value, int rightAlign, bool outputC) {
     // Print the amount of table entries
-    if(!outputC)
-        fprintf(fileStream, ".equ %s,", name);
-    else
-        fprintf(fileStream, "#define %s", name);
+    if(!outputC) {
+        outLiteral(out, ".equ ");
+        outString(out, name);
+        outChar(out, ',');
+    } else {
+        outLiteral(out, "#define ");
+        outString(out, name);
+    }
     
     // Print the indent
-    s16 indentSpaces = rightAlign - strlen(name);
-    for (; indentSpaces > 0; indentSpaces--)
-        fprintf(fileStream, " ");
+    outSpaces(out, rightAlign - (s32)strlen(name));
     
     // Print the value
-    fprintf(fileStream, "%d\n", value);
+    outDec(out, value);
+    outChar(out, '\n');
 }
 
 static void
-printMacros(FILE* fileStream, bool outputC) {
+printMacros(OutBuffer* out, bool outputC) {
     const char **macros = (outputC) ? macrosC : macrosAsm;
     const char **names = (outputC) ? animCommandsC : macroNames;
     const char *palettesLabel = "gObjPalettes";
@@ -317,25 +501,27 @@ printMacros(FILE* fileStream, bool outputC) {
     for (int i = 0; i < SizeofArray(macrosC); i++) {
         if(i == ~AnimCmd_GetPalette) {
             if(outputC) {
-                fprintf(fileStream, macros[i], names[i], palettesLabel, palettesLabel);
+                outFormat(out, macros[i], names[i], palettesLabel, palettesLabel);
             } else {
-                fprintf(fileStream, macros[i], names[i], animCommands[i], palettesLabel);
+                outFormat(out, macros[i], names[i], animCommands[i], palettesLabel);
             }
         } else {
-            fprintf(fileStream, macros[i], names[i]);
+            // The C macros only have the command identifier as placeholder,
+            // it gets passed as 'names[i]' there.
+            outFormat(out, macros[i], names[i], animCommands[i]);
         }
     }
-    fprintf(fileStream, "\n");
+    outChar(out, '\n');
 }
 
 static void
-printFileHeader(FILE* fileStream, s32 entryCount, bool outputC) {
+printFileHeader(OutBuffer* out, s32 entryCount, bool outputC) {
     const char* entryCountName = "NUM_ANIMATION_TABLE_ENTRIES";
     const char **animCmds = (outputC) ? animCommandsC : animCommands;
     if(!outputC) {
         // Set the section
-        fprintf(fileStream, "\t.section .rodata\n");
-        fprintf(fileStream, "\n");
+        outLiteral(out, "\t.section .rodata\n");
+        outLiteral(out, "\n");
     }
     
     
@@ -349,16 +535,16 @@ printFileHeader(FILE* fileStream, s32 entryCount, bool outputC) {
     
     // Print definition of each Cmd's constant
     for(int i = 0; i < SizeofArray(animCommands); i++) {
-        printHeaderLine(fileStream, animCmds[i], ((-1) - i), rightAlign, outputC);
+        printHeaderLine(out, animCmds[i], ((-1) - i), rightAlign, outputC);
     }
-    fprintf(fileStream, "\n");
+    outChar(out, '\n');
     
     // Print the number of entries in the table
-    printHeaderLine(fileStream, entryCountName, entryCount, rightAlign, outputC);
-    fprintf(fileStream, "\n\n");
+    printHeaderLine(out, entryCountName, entryCount, rightAlign, outputC);
+    outLiteral(out, "\n\n");
     
     // Macros depend on knowing the AnimCmd_xyz values, so they have to be printed together.
-    printMacros(fileStream, outputC);
+    printMacros(out, outputC);
 }
 
 static char*
@@ -373,96 +559,136 @@ getStringFromId(LabelStrings* label, StringId id) {
 }
 
 static void
-printCommand(FILE* fileStream, DynTableAnimCmd* inAnimCmd, LabelStrings* labels) {
+printCommand(OutBuffer* out, DynTableAnimCmd* inAnimCmd, LabelStrings* labels) {
     ACmd* inCmd = &inAnimCmd->cmd;
     
     // Print macro name
     s32 nottedCmdId = ~(inCmd->id);
+    outChar(out, '\t');
     if (nottedCmdId >= 0)
-        fprintf(fileStream, "\t%s ", macroNames[nottedCmdId]);
+        outString(out, macroNames[nottedCmdId]);
     else
-        fprintf(fileStream, "\t%s ", macroNames[~(AnimCmd_DisplayFrame)]);
+        outString(out, macroNames[~(AnimCmd_DisplayFrame)]);
+    outChar(out, ' ');
     
     
     // Print the command paramters
     switch (inCmd->id) {
         case AnimCmd_GetTiles: {
             ACmd_GetTiles* cmd = &inCmd->_tiles;
-            fprintf(fileStream, "0x%X %d\n", cmd->tileIndex, cmd->numTilesToCopy);
+            outLiteral(out, "0x");
+            outHex(out, cmd->tileIndex, 0);
+            outChar(out, ' ');
+            outDec(out, cmd->numTilesToCopy);
+            outChar(out, '\n');
         } break;
         
         case AnimCmd_GetPalette: {
             ACmd_GetPalette* cmd = &inCmd->_pal;
-            char palName[64];
 #if 0
-            sprintf(palName, "palObj%03d", cmd->palId);
-            fprintf(fileStream, "%s %d 0x%X\n", palName, cmd->numColors, cmd->insertOffset);
+            outFormat(out, "palObj%03d", cmd->palId);
 #else
-            fprintf(fileStream, "%d %d 0x%X\n", cmd->palId, cmd->numColors, cmd->insertOffset);
+            outDec(out, cmd->palId);
 #endif
+            outChar(out, ' ');
+            outDec(out, cmd->numColors);
+            outLiteral(out, " 0x");
+            outHex(out, cmd->insertOffset, 0);
+            outChar(out, '\n');
         } break;
         
         case AnimCmd_JumpBack: {
             ExCmd_JumpBack* cmd = &inCmd->_exJump;
-            StringId jmpCmdLabel = inAnimCmd->label;
-            StringId targetLabel = ((DynTableAnimCmd*)cmd->jumpTarget)->label;
-            char* jmpCmdString = getStringFromId(labels, jmpCmdLabel);
-            char* targetCmdString = getStringFromId(labels, targetLabel);
-            fprintf(fileStream, "%s\n\n", targetCmdString);
+            
+            if (cmd->jumpTarget) {
+                StringId targetLabel = ((DynTableAnimCmd*)cmd->jumpTarget)->label;
+                char* targetCmdString = getStringFromId(labels, targetLabel);
+                outString(out, targetCmdString);
+                outLiteral(out, "\n\n");
+            } else {
+                // Target couldn't be resolved, so there's no label.
+                // This evaluates to the same distance inside the macro.
+                outLiteral(out, "(.-0x4-0x");
+                outHex(out, (u32)(cmd->offset * sizeof(s32)), 0);
+                outLiteral(out, ")\n\n");
+            }
         } break;
         
         case AnimCmd_End: {
-            ACmd_End* cmd = &inCmd->_end;
-            fprintf(fileStream, "\n\n");
+            outLiteral(out, "\n\n");
         } break;
         
         case AnimCmd_PlaySoundEffect: {
             ACmd_PlaySoundEffect* cmd = &inCmd->_sfx;
-            fprintf(fileStream, "%u\n", cmd->songId);
+            outUDec(out, cmd->songId);
+            outChar(out, '\n');
             
         } break;
         
         case AnimCmd_AddHitbox: {
             ACmd_AddHitbox* cmd = &inCmd->_hitbox;
             // TODO: Once the tool outputs data as C files, output these as signed bytes (ARM macros don't like '-xyz')
-            fprintf(fileStream, "%d 0x%02X 0x%02X 0x%02X 0x%02X\n",
-                    cmd->hitbox.index,
-                    (u8)cmd->hitbox.left,
-                    (u8)cmd->hitbox.top,
-                    (u8)cmd->hitbox.right,
-                    (u8)cmd->hitbox.bottom);
+            outDec(out, cmd->hitbox.index);
+            outLiteral(out, " 0x");
+            outHex(out, (u8)cmd->hitbox.left, 2);
+            outLiteral(out, " 0x");
+            outHex(out, (u8)cmd->hitbox.top, 2);
+            outLiteral(out, " 0x");
+            outHex(out, (u8)cmd->hitbox.right, 2);
+            outLiteral(out, " 0x");
+            outHex(out, (u8)cmd->hitbox.bottom, 2);
+            outChar(out, '\n');
         } break;
         
         case AnimCmd_TranslateSprite: {
             ACmd_TranslateSprite* cmd = &inCmd->_translate;
-            fprintf(fileStream, "%d %d\n", cmd->x, cmd->y);
+            outDec(out, cmd->x);
+            outChar(out, ' ');
+            outDec(out, cmd->y);
+            outChar(out, '\n');
         } break;
         
         case AnimCmd_8: {
             ACmd_8* cmd = &inCmd->_8;
-            fprintf(fileStream, "0x%x 0x%x", cmd->unk4, cmd->unk8);
+            outLiteral(out, "0x");
+            outHexLower(out, cmd->unk4, 0);
+            outLiteral(out, " 0x");
+            outHexLower(out, cmd->unk8, 0);
         } break;
         
         case AnimCmd_SetIdAndVariant: {
             ACmd_SetIdAndVariant* cmd = &inCmd->_animId;
             
             // TODO: Insert ANIM_<whatever> from "include/constants/animations.h"
-            fprintf(fileStream, "%d %d\n", cmd->animId, cmd->variant);
+            outDec(out, cmd->animId);
+            outChar(out, ' ');
+            outDec(out, cmd->variant);
+            outChar(out, '\n');
         } break;
         
         case AnimCmd_10: {
             ACmd_10* cmd = &inCmd->_10;
-            fprintf(fileStream, "0x%x 0x%x 0x%x\n", cmd->unk4, cmd->unk8, cmd->unkC);
+            outLiteral(out, "0x");
+            outHexLower(out, cmd->unk4, 0);
+            outLiteral(out, " 0x");
+            outHexLower(out, cmd->unk8, 0);
+            outLiteral(out, " 0x");
+            outHexLower(out, cmd->unkC, 0);
+            outChar(out, '\n');
         } break;
         
         case AnimCmd_SetSpritePriority: {
             ACmd_SetSpritePriority* cmd = &inCmd->_prio;
-            fprintf(fileStream, "0x%x\n", cmd->unk4);
+            outLiteral(out, "0x");
+            outHexLower(out, cmd->unk4, 0);
+            outChar(out, '\n');
         } break;
         
         case AnimCmd_12: {
             ACmd_12* cmd = &inCmd->_12;
-            fprintf(fileStream, "0x%x\n", cmd->unk4);
+            outLiteral(out, "0x");
+            outHexLower(out, cmd->unk4, 0);
+            outChar(out, '\n');
         } break;
         
         default: {
@@ -477,105 +703,143 @@ printCommand(FILE* fileStream, DynTableAnimCmd* inAnimCmd, LabelStrings* labels)
             else {
                 if (cmd->cmdId >= ROM_BASE || cmd->frameIndex >= ROM_BASE) {
                     // @BUG! If we land here, that means a pointer was mistaken as an "unknown command"
-                    fprintf(fileStream, "\t.4byte 0x%07X, 0x%07X\n\n", cmd->displayForNFrames, cmd->frameIndex);
+                    outLiteral(out, "\t.4byte 0x");
+                    outHex(out, cmd->displayForNFrames, 7);
+                    outLiteral(out, ", 0x");
+                    outHex(out, cmd->frameIndex, 7);
+                    outLiteral(out, "\n\n");
                     assert(FALSE);
-                } else
-                    fprintf(fileStream, "%d %d\n\n", cmd->displayForNFrames, cmd->frameIndex);
+                } else {
+                    outDec(out, cmd->displayForNFrames);
+                    outChar(out, ' ');
+                    outDec(out, cmd->frameIndex);
+                    outLiteral(out, "\n\n");
+                }
             }
         }
     }
 }
 
 static void
-printCommandC(FILE* fileStream, DynTableAnimCmd* inAnimCmd, LabelStrings* labels) {
+printCommandC(OutBuffer* out, DynTableAnimCmd* inAnimCmd, LabelStrings* labels) {
     ACmd* inCmd = &inAnimCmd->cmd;
     
     // Print macro name
     s32 nottedCmdId = ~(inCmd->id);
+    outLiteral(out, "    ");
     if (nottedCmdId >= 0)
-        fprintf(fileStream, "    %s(", macroNamesC[nottedCmdId]);
+        outString(out, macroNamesC[nottedCmdId]);
     else
-        fprintf(fileStream, "    %s(", macroNamesC[~(AnimCmd_DisplayFrame)]);
+        outString(out, macroNamesC[~(AnimCmd_DisplayFrame)]);
+    outChar(out, '(');
     
     
     // Print the command paramters
     switch (inCmd->id) {
         case AnimCmd_GetTiles: {
             ACmd_GetTiles* cmd = &inCmd->_tiles;
-            fprintf(fileStream, "0x%X, %d)\n", cmd->tileIndex, cmd->numTilesToCopy);
+            outLiteral(out, "0x");
+            outHex(out, cmd->tileIndex, 0);
+            outLiteral(out, ", ");
+            outDec(out, cmd->numTilesToCopy);
+            outLiteral(out, ")\n");
         } break;
         
         case AnimCmd_GetPalette: {
             ACmd_GetPalette* cmd = &inCmd->_pal;
-            char palName[64];
 #if 0
-            sprintf(palName, "palObj%03d", cmd->palId);
-            fprintf(fileStream, "%s, %d, 0x%X)\n", palName, cmd->numColors, cmd->insertOffset);
+            outFormat(out, "palObj%03d", cmd->palId);
 #else
-            fprintf(fileStream, "%d, %d, 0x%X)\n", cmd->palId, cmd->numColors, cmd->insertOffset);
+            outDec(out, cmd->palId);
 #endif
+            outLiteral(out, ", ");
+            outDec(out, cmd->numColors);
+            outLiteral(out, ", 0x");
+            outHex(out, cmd->insertOffset, 0);
+            outLiteral(out, ")\n");
         } break;
         
         case AnimCmd_JumpBack: {
             ExCmd_JumpBack* cmd = &inCmd->_exJump;
-            StringId jmpCmdLabel = inAnimCmd->label;
-            StringId targetLabel = ((DynTableAnimCmd*)cmd->jumpTarget)->label;
-            char* jmpCmdString = getStringFromId(labels, jmpCmdLabel);
-            char* targetCmdString = getStringFromId(labels, targetLabel);
-            fprintf(fileStream, "%d)\n", cmd->offset);
+            outDec(out, cmd->offset);
+            outLiteral(out, ")\n");
         } break;
         
         case AnimCmd_End: {
-            ACmd_End* cmd = &inCmd->_end;
-            fprintf(fileStream, ")\n");
+            outLiteral(out, ")\n");
         } break;
         
         case AnimCmd_PlaySoundEffect: {
             ACmd_PlaySoundEffect* cmd = &inCmd->_sfx;
-            fprintf(fileStream, "%u)\n", cmd->songId);
+            outUDec(out, cmd->songId);
+            outLiteral(out, ")\n");
             
         } break;
         
         case AnimCmd_AddHitbox: {
             ACmd_AddHitbox* cmd = &inCmd->_hitbox;
-            fprintf(fileStream, "%d, %d, %d, %d, %d)\n",
-                    cmd->hitbox.index,
-                    (s8)cmd->hitbox.left,
-                    (s8)cmd->hitbox.top,
-                    (s8)cmd->hitbox.right,
-                    (s8)cmd->hitbox.bottom);
+            outDec(out, cmd->hitbox.index);
+            outLiteral(out, ", ");
+            outDec(out, (s8)cmd->hitbox.left);
+            outLiteral(out, ", ");
+            outDec(out, (s8)cmd->hitbox.top);
+            outLiteral(out, ", ");
+            outDec(out, (s8)cmd->hitbox.right);
+            outLiteral(out, ", ");
+            outDec(out, (s8)cmd->hitbox.bottom);
+            outLiteral(out, ")\n");
         } break;
         
         case AnimCmd_TranslateSprite: {
             ACmd_TranslateSprite* cmd = &inCmd->_translate;
-            fprintf(fileStream, "%d, %d)\n", cmd->x, cmd->y);
+            outDec(out, cmd->x);
+            outLiteral(out, ", ");
+            outDec(out, cmd->y);
+            outLiteral(out, ")\n");
         } break;
         
         case AnimCmd_8: {
             ACmd_8* cmd = &inCmd->_8;
-            fprintf(fileStream, "0x%x, 0x%x)", cmd->unk4, cmd->unk8);
+            outLiteral(out, "0x");
+            outHexLower(out, cmd->unk4, 0);
+            outLiteral(out, ", 0x");
+            outHexLower(out, cmd->unk8, 0);
+            outChar(out, ')');
         } break;
         
         case AnimCmd_SetIdAndVariant: {
             ACmd_SetIdAndVariant* cmd = &inCmd->_animId;
             
             // TODO: Insert ANIM_<whatever> from "include/constants/animations.h"
-            fprintf(fileStream, "%d, %d)\n", cmd->animId, cmd->variant);
+            outDec(out, cmd->animId);
+            outLiteral(out, ", ");
+            outDec(out, cmd->variant);
+            outLiteral(out, ")\n");
         } break;
         
         case AnimCmd_10: {
             ACmd_10* cmd = &inCmd->_10;
-            fprintf(fileStream, "0x%x, 0x%x, 0x%x)\n", cmd->unk4, cmd->unk8, cmd->unkC);
+            outLiteral(out, "0x");
+            outHexLower(out, cmd->unk4, 0);
+            outLiteral(out, ", 0x");
+            outHexLower(out, cmd->unk8, 0);
+            outLiteral(out, ", 0x");
+            outHexLower(out, cmd->unkC, 0);
+            outLiteral(out, ")\n");
         } break;
         
         case AnimCmd_SetSpritePriority: {
             ACmd_SetSpritePriority* cmd = &inCmd->_prio;
-            fprintf(fileStream, "0x%x)\n", cmd->unk4);
+            outLiteral(out, "0x");
+            outHexLower(out, cmd->unk4, 0);
+            outLiteral(out, ")\n");
         } break;
         
         case AnimCmd_12: {
             ACmd_12* cmd = &inCmd->_12;
-            fprintf(fileStream, "0x%x)\n", cmd->unk4);
+            outLiteral(out, "0x");
+            outHexLower(out, cmd->unk4, 0);
+            outLiteral(out, ")\n");
         } break;
         
         default: {
@@ -590,25 +854,155 @@ printCommandC(FILE* fileStream, DynTableAnimCmd* inAnimCmd, LabelStrings* labels
             else {
                 if (cmd->cmdId >= ROM_BASE || cmd->frameIndex >= ROM_BASE) {
                     // @BUG! If we land here, that means a pointer was mistaken as an "unknown command"
-                    fprintf(fileStream, "    .4byte 0x%07X, 0x%07X\n\n", cmd->displayForNFrames, cmd->frameIndex);
+                    outLiteral(out, "    .4byte 0x");
+                    outHex(out, cmd->displayForNFrames, 7);
+                    outLiteral(out, ", 0x");
+                    outHex(out, cmd->frameIndex, 7);
+                    outLiteral(out, "\n\n");
                     assert(FALSE);
-                } else
-                    fprintf(fileStream, "%d, %d)\n", cmd->displayForNFrames, cmd->frameIndex);
+                } else {
+                    outDec(out, cmd->displayForNFrames);
+                    outLiteral(out, ", ");
+                    outDec(out, cmd->frameIndex);
+                    outLiteral(out, ")\n");
+                }
             }
         }
     }
 }
 
+// An output format of the animation data.
+// 'printAnimationDataFile' walks the animations once and hands every piece to each enabled emitter,
+// so adding a format doesn't add another pass over the data.
+typedef struct {
+    const char* name;          // selects the emitter on the command line ("--<name>")
+    const char* fileExtension; // of every file the emitter's output goes into
+    u32 labelFlags;            // commands with any of these flags get a label
+    
+    void (*printFileHeader)(OutBuffer* out, s32 entryCount);
+    void (*printLabel)(OutBuffer* out, DynTableAnimCmd* cmd, LabelStrings* labels);
+    void (*printCommand)(OutBuffer* out, DynTableAnimCmd* cmd, LabelStrings* labels);
+    void (*printVariantEnd)(OutBuffer* out);
+    void (*printVariantPointers)(OutBuffer* out, char* animName, u16 numVariants);
+    void (*printAnimationTable)(OutBuffer* out, DynTable* dynTable, AnimationTable* table, LabelStrings* labels);
+} Emitter;
+
+#define MAX_EMITTERS 8
+
+static void
+printLabelAsm(OutBuffer* out, DynTableAnimCmd* cmd, LabelStrings* labels) {
+    if (cmd->flags & (ACMD_FLAG__IS_START_OF_ANIM | ACMD_FLAG__NEEDS_LABEL)) {
+        outString(out, getStringFromId(labels, cmd->label));
+        outLiteral(out, ": @ ");
+        outHex(out, cmd->address, 7);
+        outChar(out, '\n');
+    }
+}
+
 static void
-printAnimationDataFile(FILE* fileStream, DynTable* dynTable,
-                       LabelStrings* labels, MemArena *stringArena, MemArena* stringOffsetArena,
-                       u32 numAnims, OutFiles* outFiles, bool outputC) {
-    AnimationData anim;
-    
-    printFileHeader(outFiles->header, numAnims, outputC);
+printLabelC(OutBuffer* out, DynTableAnimCmd* cmd, LabelStrings* labels) {
+    if (cmd->flags & ACMD_FLAG__IS_START_OF_ANIM) {
+        outLiteral(out, "const s32 ");
+        outString(out, getStringFromId(labels, cmd->label));
+        outLiteral(out, "[] = { // 0x");
+        outHex(out, cmd->address, 8);
+        outChar(out, '\n');
+    }
+}
+
+static void
+printVariantEndAsm(OutBuffer* out) {
+}
+
+static void
+printVariantEndC(OutBuffer* out) {
+    outLiteral(out, "};\n\n");
+}
+
+static void
+printVariantPointersAsm(OutBuffer* out, char* animName, u16 numVariants) {
+    if (animName) {
+        outString(out, animName);
+        outLiteral(out, ":\n");
+    }
     
-    char filename[256];
+    for (int variantId = 0; variantId < numVariants; variantId++) {
+        outLiteral(out, "\t.4byte ");
+        outString(out, animName);
+        outLiteral(out, "__v");
+        outDec(out, variantId);
+        outLiteral(out, "_l0\n");
+    }
+    outLiteral(out, "\n\n");
+}
+
+static void
+printVariantPointersC(OutBuffer* out, char* animName, u16 numVariants) {
+    if (animName) {
+        outLiteral(out, "const s32 * const ");
+        outString(out, animName);
+        outChar(out, '[');
+        outDec(out, numVariants);
+        outLiteral(out, "] = {\n");
+    }
     
+    for (int variantId = 0; variantId < numVariants; variantId++) {
+        outLiteral(out, "    ");
+        outString(out, animName);
+        outLiteral(out, "__v");
+        outDec(out, variantId);
+        outLiteral(out, "_l0,\n");
+    }
+    outLiteral(out, "};\n\n");
+}
+
+static void printFileHeaderAsm(OutBuffer* out, s32 entryCount) { printFileHeader(out, entryCount, FALSE); }
+static void printFileHeaderC(OutBuffer* out, s32 entryCount)   { printFileHeader(out, entryCount, TRUE);  }
+
+static void printAnimationTableAsm(OutBuffer* out, DynTable* dynTable, AnimationTable* table, LabelStrings* labels) {
+    printAnimationTable(out, dynTable, table, labels, FALSE);
+}
+static void printAnimationTableC(OutBuffer* out, DynTable* dynTable, AnimationTable* table, LabelStrings* labels) {
+    printAnimationTable(out, dynTable, table, labels, TRUE);
+}
+
+const Emitter emitterAsm = {
+    .name                 = "asm",
+    .fileExtension        = ".inc",
+    .labelFlags           = ACMD_FLAG__IS_START_OF_ANIM | ACMD_FLAG__NEEDS_LABEL,
+    .printFileHeader      = printFileHeaderAsm,
+    .printLabel           = printLabelAsm,
+    .printCommand         = printCommand,
+    .printVariantEnd      = printVariantEndAsm,
+    .printVariantPointers = printVariantPointersAsm,
+    .printAnimationTable  = printAnimationTableAsm,
+};
+
+const Emitter emitterC = {
+    .name                 = "c",
+    .fileExtension        = ".c",
+    .labelFlags           = ACMD_FLAG__IS_START_OF_ANIM,
+    .printFileHeader      = printFileHeaderC,
+    .printLabel           = printLabelC,
+    .printCommand         = printCommandC,
+    .printVariantEnd      = printVariantEndC,
+    .printVariantPointers = printVariantPointersC,
+    .printAnimationTable  = printAnimationTableC,
+};
+
+// Every emitter that can be enabled on the command line
+const Emitter* availableEmitters[] = {
+    &emitterAsm,
+    &emitterC,
+};
+
+// Every command that starts a variant (and for some emitters also every jump target) gets a label.
+// The label strings get pushed here, in the order they appear in the output,
+// so that the animations can be printed independently of each other afterwards.
+// The names don't depend on the emitter, so one pass serves all of them.
+static void
+assignCommandLabels(DynTable* dynTable, LabelStrings* labels, MemArena *stringArena, MemArena* stringOffsetArena,
+                    u32 numAnims, u32 labelFlags) {
     DynTableAnim* table = dynTable->animations;
     u16* variantCounts = dynTable->variantCounts;
     
@@ -620,7 +1014,6 @@ printAnimationDataFile(FILE* fileStream, DynTable* dynTable,
             char labelBuffer[256];
             char* animName = getStringFromId(labels, table[i].name);
             
-            // Print all variants' commands
             for (int variantId = 0; variantId < numVariants; variantId++) {
                 // currCmd -> start of variant
                 s32* offset = &variantOffsets[variantId];
@@ -630,114 +1023,317 @@ printAnimationDataFile(FILE* fileStream, DynTable* dynTable,
                 
                 int labelId = 0;
                 while (TRUE) {
-                    // Maybe print label
-                    
-                    if(!outputC) {
-                        if (currCmd->flags & (ACMD_FLAG__IS_START_OF_ANIM | ACMD_FLAG__NEEDS_LABEL)) {
-                            sprintf(labelBuffer, "%s__v%d_l%d", animName, variantId, labelId);
-                            
-                            StringId varLabel = pushLabel(labels, stringArena, stringOffsetArena, labelBuffer);
-                            currCmd->label = varLabel;
-                            fprintf(fileStream, "%s: @ %07X\n", labelBuffer, currCmd->address);
-                            labelId++;
-                            
-                        }
-                    } else {
-                        if(currCmd->flags & ACMD_FLAG__IS_START_OF_ANIM) {
-                            sprintf(labelBuffer, "%s__v%d_l%d", animName, variantId, labelId);
-                            
-                            StringId varLabel = pushLabel(labels, stringArena, stringOffsetArena, labelBuffer);
-                            currCmd->label = varLabel;
-                            fprintf(fileStream, "const s32 %s[] = { // 0x%08X\n", labelBuffer, currCmd->address);
-                            labelId++;
-                        }
-                    }
-                    
-                    if(!outputC)
-                        printCommand(fileStream, currCmd, labels);
-                    else
-                        printCommandC(fileStream, currCmd, labels);
-                    
-                    // Add an additional newline after DisplayFrame cmd.
-                    if(currCmd->cmd.id >= 0){
-                        DynTableAnimCmd* nextCmd = currCmd + 1;
-                        
-                        if(!(nextCmd->flags & ACMD_FLAG__NEEDS_LABEL) || (nextCmd->cmd.id == AnimCmd_JumpBack))
-                            fprintf(fileStream, "\n");
-                        
+                    if (currCmd->flags & labelFlags) {
+                        sprintf(labelBuffer, "%s__v%d_l%d", animName, variantId, labelId);
+                        currCmd->label = pushLabel(labels, stringArena, stringOffsetArena, labelBuffer);
+                        labelId++;
                     }
                     
-                    // Break loop after printing jump/end command
                     if((currCmd->cmd.id == AnimCmd_End)
                        || (currCmd->cmd.id == AnimCmd_JumpBack)
                        || (currCmd->cmd.id == AnimCmd_SetIdAndVariant)) {
-                        if(outputC)
-                            fprintf(fileStream, "};\n\n");
-                        
                         break;
                     }
                     
                     currCmd++;
                 }
+            }
+        }
+    }
+}
+
+// Print the commands and variant pointers of one animation, with every emitter into its own buffer.
+// Labels have to be assigned with 'assignCommandLabels' before.
+static void
+printAnimation(OutBuffer* outs, const Emitter** emitters, u32 emitterCount,
+               DynTable* dynTable, LabelStrings* labels, u32 animId) {
+    DynTableAnim* anim = &dynTable->animations[animId];
+    
+    if (anim->offsetVariants < 0)
+        return;
+    
+    s32* variantOffsets = (s32*)OffsetPointer(&anim->offsetVariants);
+    u16 numVariants = dynTable->variantCounts[animId];
+    
+    // Print all variants' commands
+    for (int variantId = 0; variantId < numVariants; variantId++) {
+        // currCmd -> start of variant
+        s32* offset = &variantOffsets[variantId];
+        DynTableAnimCmd* currCmd = (DynTableAnimCmd*)OffsetPointer(offset);
+        
+        while (TRUE) {
+            for (u32 e = 0; e < emitterCount; e++) {
+                // Maybe print label
+                emitters[e]->printLabel(&outs[e], currCmd, labels);
+                emitters[e]->printCommand(&outs[e], currCmd, labels);
+            }
+            
+            // Add an additional newline after DisplayFrame cmd.
+            if(currCmd->cmd.id >= 0){
+                DynTableAnimCmd* nextCmd = currCmd + 1;
                 
+                if(!(nextCmd->flags & ACMD_FLAG__NEEDS_LABEL) || (nextCmd->cmd.id == AnimCmd_JumpBack)) {
+                    for (u32 e = 0; e < emitterCount; e++)
+                        outChar(&outs[e], '\n');
+                }
                 
             }
             
-            if (table[i].name) { // Print variant pointers
-                if(!outputC) {
-                    char* entryName = getStringFromId(labels, table[i].name);
-                    if (entryName)
-                        fprintf(fileStream, "%s:\n", entryName);
-                    
-                    for (int variantId = 0; variantId < numVariants; variantId++) {
-                        fprintf(fileStream, "\t.4byte %s__v%d_l%d\n", animName, variantId, 0);
-                    }
-                    fprintf(fileStream, "\n\n");
+            // Break loop after printing jump/end command
+            if((currCmd->cmd.id == AnimCmd_End)
+               || (currCmd->cmd.id == AnimCmd_JumpBack)
+               || (currCmd->cmd.id == AnimCmd_SetIdAndVariant)) {
+                for (u32 e = 0; e < emitterCount; e++)
+                    emitters[e]->printVariantEnd(&outs[e]);
+                
+                break;
+            }
+            
+            currCmd++;
+        }
+        
+        
+    }
+    
+    if (anim->name) { // Print variant pointers
+        char* animName = getStringFromId(labels, anim->name);
+        
+        for (u32 e = 0; e < emitterCount; e++)
+            emitters[e]->printVariantPointers(&outs[e], animName, numVariants);
+    }
+}
+
+typedef struct {
+    char* text;
+    u32 length;
+} AnimText;
+
+typedef struct {
+    DynTable* dynTable;
+    LabelStrings* labels;
+    u32 numAnims;
+    
+    const Emitter** emitters;
+    u32 emitterCount;
+    
+    u32 blockCount;
+    volatile u32* nextBlock;
+    
+    // Text of each emitter's animations ([emitterIndex * numAnims + animId]), if it stays in memory
+    AnimText* texts;
+    
+    // Path of each emitter's file of the animation, if each animation gets its own.
+    // 'fileNames' point at the "anim_XXXX<extension>" part of them.
+    char* filePaths[MAX_EMITTERS];
+    char* fileNames[MAX_EMITTERS];
+    Manifest* manifest;
+    
+    MemArena text[MAX_EMITTERS]; // Text of every animation this thread formatted, per emitter
+} EmitThread;
+
+// Format blocks of animations until none are left.
+// The text either stays in the thread's arenas, or gets written into the animation's own files right away.
+static void
+printAnimationsThread(void* params) {
+    EmitThread* thread = params;
+    u32 emitterCount = thread->emitterCount;
+    
+    for (;;) {
+        u32 blockId = atomicFetchAddU32(thread->nextBlock, 1);
+        if (blockId >= thread->blockCount)
+            break;
+        
+        u32 firstAnim = blockId * EMIT_BLOCK_SIZE;
+        u32 endAnim   = Min(firstAnim + EMIT_BLOCK_SIZE, thread->numAnims);
+        
+        for (u32 animId = firstAnim; animId < endAnim; animId++) {
+            MemArenaTemp animScopes[MAX_EMITTERS];
+            OutBuffer outs[MAX_EMITTERS];
+            
+            for (u32 e = 0; e < emitterCount; e++) {
+                animScopes[e] = memArenaBeginTemp(&thread->text[e]);
+                outBufferInitInMemory(&outs[e], &thread->text[e]);
+            }
+            
+            printAnimation(outs, thread->emitters, emitterCount, thread->dynTable, thread->labels, animId);
+            
+            for (u32 e = 0; e < emitterCount; e++) {
+                u32 length = outBufferEndInMemory(&outs[e]);
+                
+                if (thread->filePaths[e] == NULL) {
+                    AnimText* text = &thread->texts[e * thread->numAnims + animId];
+                    text->text   = outs[e].data;
+                    text->length = length;
                 } else {
-                    char* entryName = getStringFromId(labels, table[i].name);
-                    if (entryName)
-                        fprintf(fileStream, "const s32 * const %s[%d] = {\n", entryName, numVariants);
-                    
-                    for (int variantId = 0; variantId < numVariants; variantId++) {
-                        fprintf(fileStream, "    %s__v%d_l%d,\n", animName, variantId, 0);
+                    // Aliases don't have any text of their own
+                    if (length > 0) {
+                        sprintf(thread->fileNames[e], "anim_%04d%s", animId, thread->emitters[e]->fileExtension);
+                        manifestWriteFile(thread->manifest, thread->filePaths[e], outs[e].data, length);
                     }
-                    fprintf(fileStream, "};\n\n");
+                    
+                    memArenaEndTemp(animScopes[e]);
                 }
             }
         }
     }
 }
 
-static bool
-wasReferencedBefore(AnimationTable* animTable, int entryIndex, int* prevIndex) {
-    s32* cursor = animTable->data;
-    
-    bool wasReferencedBefore = FALSE;
+// Prints the header and all animations, for every emitter into its own buffer in 'outs'.
+// If 'animDirectory' is NULL, the animations get printed into 'outs' in order,
+// otherwise each one gets its own file (per emitter) inside of that directory.
+static void
+printAnimationDataFile(OutBuffer* outs, const Emitter** emitters, u32 emitterCount, DynTable* dynTable,
+                       LabelStrings* labels, MemArena *stringArena, MemArena* stringOffsetArena,
+                       u32 numAnims, char* animDirectory, Manifest* manifest) {
+    u32 labelFlags = 0;
+    for (u32 e = 0; e < emitterCount; e++) {
+        emitters[e]->printFileHeader(&outs[e], numAnims);
+        labelFlags |= emitters[e]->labelFlags;
+    }
     
-    for (int index = 0; index < entryIndex; index++) {
-        if (cursor[index] == cursor[entryIndex]) {
-            wasReferencedBefore = TRUE;
+    // Label IDs depend on the order they got pushed in, so this can't be done in parallel.
+    assignCommandLabels(dynTable, labels, stringArena, stringOffsetArena, numAnims, labelFlags);
+    
+    u32 blockCount = (numAnims + EMIT_BLOCK_SIZE - 1) / EMIT_BLOCK_SIZE;
+    u32 threadCount = (EMIT_THREAD_COUNT > 0) ? EMIT_THREAD_COUNT : getProcessorCount();
+    threadCount = Min(Min(threadCount, blockCount), MAX_THREADS);
+    threadCount = Max(threadCount, 1);
+    
+    MemArena scratch;
+    memArenaInit(&scratch);
+    
+    EmitThread* threads = memArenaPushArray(&scratch, EmitThread, threadCount);
+    AnimText* texts = memArenaPushArray(&scratch, AnimText, emitterCount * numAnims);
+    volatile u32 nextBlock = 0;
+    
+    // The threads can't grow the manifest's list of files themselves.
+    if (animDirectory)
+        manifestReserve(manifest, numAnims * emitterCount);
+    
+    for (u32 i = 0; i < threadCount; i++) {
+        EmitThread* thread = &threads[i];
+        thread->dynTable = dynTable;
+        thread->labels = labels;
+        thread->numAnims = numAnims;
+        thread->emitters = emitters;
+        thread->emitterCount = emitterCount;
+        thread->blockCount = blockCount;
+        thread->nextBlock = &nextBlock;
+        thread->texts = texts;
+        thread->manifest = manifest;
+        
+        for (u32 e = 0; e < emitterCount; e++) {
+            if (animDirectory) {
+                char fileName[64];
+                sprintf(fileName, "anim_XXXX%s", emitters[e]->fileExtension);
+                thread->filePaths[e] = addToPath(&scratch, animDirectory, fileName);
+                thread->fileNames[e] = lastString(thread->filePaths[e], "anim_");
+            }
             
-            if (prevIndex)
-                *prevIndex = index;
+            memArenaInit(&thread->text[e]);
+        }
+    }
+    
+    runThreads(printAnimationsThread, threads, sizeof(EmitThread), threadCount);
+    
+    // Merge the text in order
+    if (animDirectory == NULL) {
+        for (u32 e = 0; e < emitterCount; e++) {
+            for (u32 animId = 0; animId < numAnims; animId++) {
+                AnimText* text = &texts[e * numAnims + animId];
+                outChars(&outs[e], text->text, text->length);
+            }
+        }
+    }
+    
+    for (u32 i = 0; i < threadCount; i++) {
+        for (u32 e = 0; e < emitterCount; e++)
+            memArenaFree(&threads[i].text[e]);
+    }
+    memArenaFree(&scratch);
+}
+
+typedef struct {
+    RomPointer key;
+    s32 index;
+} AnimIndexSlot;
+
+// Hash of a ROM pointer, for the open-addressing table in 'buildAnimationTableIndex'.
+// Animations are word-aligned, so the low bits carry no information.
+static u32
+hashRomPointer(RomPointer pointer) {
+    return (pointer >> 2) * 0x9E3779B1u;
+}
+
+// Find the first entry of the table that points to the same animation as each entry,
+// so aliases can be resolved in O(1) afterwards, no matter how big the table gets.
+static void
+buildAnimationTableIndex(MemArena* arena, AnimationTable* animTable) {
+    s32 entryCount = animTable->entryCount;
+    
+    // Keep the load factor at or below 50%
+    u32 slotCount = 16;
+    while (slotCount < (u32)entryCount * 2)
+        slotCount *= 2;
+    
+    animTable->firstReference = memArenaPushArray(arena, s32, entryCount);
+    
+    // The slots are only needed while building, so they get released at the end.
+    MemArenaTemp slotScope = memArenaBeginTemp(arena);
+    AnimIndexSlot* slots = memArenaPushArray(arena, AnimIndexSlot, slotCount);
+    
+    for (s32 i = 0; i < entryCount; i++) {
+        RomPointer anim = animTable->data[i];
+        animTable->firstReference[i] = i;
+        
+        // Empty entries don't reference anything
+        if (anim == 0)
+            continue;
+        
+        u32 slot = hashRomPointer(anim) & (slotCount - 1);
+        while (slots[slot].key != 0) {
+            if (slots[slot].key == anim) {
+                animTable->firstReference[i] = slots[slot].index;
+                break;
+            }
             
-            break;
+            slot = (slot + 1) & (slotCount - 1);
+        }
+        
+        if (slots[slot].key == 0) {
+            slots[slot].key   = anim;
+            slots[slot].index = i;
         }
     }
     
+    memArenaEndTemp(slotScope);
+}
+
+static bool
+wasReferencedBefore(AnimationTable* animTable, int entryIndex, int* prevIndex) {
+    s32 firstIndex = animTable->firstReference[entryIndex];
+    
+    bool wasReferencedBefore = (firstIndex != entryIndex);
+    
+    if (wasReferencedBefore && prevIndex)
+        *prevIndex = firstIndex;
+    
     return wasReferencedBefore;
 }
 
 static void
-printAnimationTable(FILE* fileStream, DynTable* dynTable, AnimationTable* table, LabelStrings* labels, bool outputC) {
+printAnimationTable(OutBuffer* out, DynTable* dynTable, AnimationTable* table, LabelStrings* labels, bool outputC) {
     const char* animTableVarName = "gAnimations";
     
     if(!outputC) {
-        fprintf(fileStream,
-                "\n"
-                ".align 2, 0\n"
-                ".global %s\n"
-                "%s:\n", animTableVarName, animTableVarName);
+        outLiteral(out,
+                   "\n"
+                   ".align 2, 0\n"
+                   ".global ");
+        outString(out, animTableVarName);
+        outChar(out, '\n');
+        outString(out, animTableVarName);
+        outLiteral(out, ":\n");
         
         s32 numAnims = table->entryCount;
         for(int i = 0; i < numAnims; i++) {
@@ -752,27 +1348,38 @@ printAnimationTable(FILE* fileStream, DynTable* dynTable, AnimationTable* table,
                 
                 assert(animId >= 0 && animId < numAnims);
                 
-                char* animName = getStringFromId(labels, dynTable->animations[animId].name);
-                fprintf(fileStream, "\t.4byte %s\n", animName);
+                // Animations without any variants don't get a label, there's nothing to point at
+                StringId animName = dynTable->animations[animId].name;
+                outLiteral(out, "\t.4byte ");
+                outString(out, (animName != 0) ? getStringFromId(labels, animName) : "0");
+                outChar(out, '\n');
             } else {
-                fprintf(fileStream, "\t.4byte 0\n");
+                outLiteral(out, "\t.4byte 0\n");
             }
         }
-        fprintf(fileStream, ".size %s,.-%s\n\n", animTableVarName, animTableVarName);
+        outLiteral(out, ".size ");
+        outString(out, animTableVarName);
+        outLiteral(out, ",.-");
+        outString(out, animTableVarName);
+        outLiteral(out, "\n\n");
     } else {
         s32 numAnims = table->entryCount;
         
-        fprintf(fileStream, "#include \"global.h\"\n\n");
+        outLiteral(out, "#include \"global.h\"\n\n");
         
         // Resolve external references
         for(int i = 0; i < numAnims; i++) {
             if(table->data[i]) {
-                fprintf(fileStream, "extern const s32 * const anim_%04d[];\n", i);
+                outLiteral(out, "extern const s32 * const anim_");
+                outUDecPadded(out, i, 4);
+                outLiteral(out, "[];\n");
             }
         }
-        fprintf(fileStream, "\n");
+        outChar(out, '\n');
         
-        fprintf(fileStream, "const s32 * const *%s[] = {\n", animTableVarName);
+        outLiteral(out, "const s32 * const *");
+        outString(out, animTableVarName);
+        outLiteral(out, "[] = {\n");
         
         for(int i = 0; i < numAnims; i++) {
             if(table->data[i]) {
@@ -786,13 +1393,15 @@ printAnimationTable(FILE* fileStream, DynTable* dynTable, AnimationTable* table,
                 
                 assert(animId >= 0 && animId < numAnims);
                 
-                char* animName = getStringFromId(labels, dynTable->animations[animId].name);
-                fprintf(fileStream, "    %s,\n", animName);
+                StringId animName = dynTable->animations[animId].name;
+                outLiteral(out, "    ");
+                outString(out, (animName != 0) ? getStringFromId(labels, animName) : "NULL");
+                outLiteral(out, ",\n");
             } else {
-                fprintf(fileStream, "    NULL,\n");
+                outLiteral(out, "    NULL,\n");
             }
         }
-        fprintf(fileStream, "};\n");
+        outLiteral(out, "};\n");
     }
 }
 
@@ -824,74 +1433,83 @@ getRomIndex(u8* rom) {
     return result;
 }
 
-void getSpriteTables(u8* rom, int gameIndex, SpriteTables* tables) {
+// Returns FALSE if the sprite tables of the game couldn't be found inside the ROM.
+bool getSpriteTables(RomView* rom, int gameIndex, SpriteTables* tables) {
     RomPointer* result = NULL;
     
-    char region = getRomRegion(rom);
+    char region = getRomRegion(rom->base);
     
     switch (gameIndex) {
         case 1: {
             //SA1 (PAL)
             result = romToVirtual(rom, 0x0801A78C); // SA1(PAL)
-            result = romToVirtual(rom, *result);
+            result = (result) ? romToVirtual(rom, *result) : NULL;
         } break;
         
         case 2: {
             result = romToVirtual(rom, 0x0801A5DC); // SA2(PAL, NTSC)
-            result = romToVirtual(rom, *result);
+            result = (result) ? romToVirtual(rom, *result) : NULL;
         } break;
         
         case 3: {
             //result = romToVirtual(rom, 0x080003B4);// SA3(JP [Kiosk])
             result = romToVirtual(rom, 0x08000404);// SA3(PAL, NTSC)
-            result = romToVirtual(rom, *result);
+            result = (result) ? romToVirtual(rom, *result) : NULL;
             
         } break;
         
         // Kirby ATAM
         case 10: {
             result = romToVirtual(rom, 0x080002E0); // (PAL, maybe others?)
-            result = romToVirtual(rom, *result);
-        }
-        
-        default: {
-            memset(tables, 0, sizeof(*tables));
-        }
+            result = (result) ? romToVirtual(rom, *result) : NULL;
+        } break;
     }
     
+    memset(tables, 0, sizeof(*tables));
+    
+    if (!result || !romViewContains(rom, result, sizeof(SpriteTablesROM)))
+        return FALSE;
+    
     SpriteTablesROM* romTable = (SpriteTablesROM*)result;
     
-    tables->animations = romToVirtual(rom, romTable->animations);
-    tables->dimensions = romToVirtual(rom, romTable->dimensions);
-    tables->oamData    = romToVirtual(rom, romTable->oamData);
-    tables->palettes   = romToVirtual(rom, romTable->palettes);
-    tables->tiles_4bpp = romToVirtual(rom, romTable->tiles_4bpp);
-    tables->tiles_8bpp = romToVirtual(rom, romTable->tiles_8bpp);
-
-    if(gameIndex == SA3 || gameIndex == KATAM) {
-        tables->sa3OnlyData = romToVirtual(rom, romTable->sa3OnlyData);
-    } else {
-        tables->sa3OnlyData = NULL;
-    }
-
+    // SA1 and SA2 don't have the last table
+    u32 tableCount = (gameIndex == SA3 || gameIndex == KATAM)
+        ? (sizeof(SpriteTablesROM) / sizeof(RomPointer))
+        : (sizeof(SpriteTablesROM) / sizeof(RomPointer)) - 1;
+    
+    void* translated[sizeof(SpriteTablesROM) / sizeof(RomPointer)] = { 0 };
+    bool allValid = romToVirtualArray(rom, (RomPointer*)romTable, tableCount, translated);
+    
+    tables->animations  = translated[0];
+    tables->dimensions  = translated[1];
+    tables->oamData     = translated[2];
+    tables->palettes    = translated[3];
+    tables->tiles_4bpp  = translated[4];
+    tables->tiles_8bpp  = translated[5];
+    tables->sa3OnlyData = translated[6];
+    
+    return allValid;
 }
 
 // Input:
 // NOTE: Indices can go from 0-255 -> count can be 256, so count has to be a u16
 static u16
-countVariants(u8* rom, AnimationTable* animTable, u32 animId) {
+countVariants(RomView* rom, AnimationTable* animTable, u32 animId) {
     u16 count = 0;
     
     RomPointer anim = animTable->data[animId];
     if (anim != 0) {
         RomPointer* variants = romToVirtual(rom, anim);
+        if (variants == NULL)
+            return 0;
         
         for (;;) {
             // Check whether we're at a pointer,
             // and not the beginning of 'animTable' (which points at the individual anims)
-            if((romToVirtual(rom, variants[count]) != NULL)
-               /* SA1 corner-case */ && ((RomPointer*)romToVirtual(rom, variants[count]) < variants)
-               && (&variants[count] < animTable->data)) {
+            if((&variants[count] < animTable->data)
+               && romViewContains(rom, &variants[count], sizeof(RomPointer))
+               && (romToVirtual(rom, variants[count]) != NULL)
+               /* SA1 corner-case */ && ((RomPointer*)romToVirtual(rom, variants[count]) < variants)) {
                 // Found another variant
                 count++;
             }
@@ -905,12 +1523,45 @@ countVariants(u8* rom, AnimationTable* animTable, u32 animId) {
     return count;
 }
 
+// Append a zeroed command to the arena.
+// Called for every decoded command, so skip the call to memset that 'memArenaReserve' does.
+static inline DynTableAnimCmd*
+pushAnimCmd(MemArena* arena) {
+    DynTableAnimCmd* cmd = memArenaPushArrayNoZero(arena, DynTableAnimCmd, 1);
+    *cmd = (DynTableAnimCmd){ 0 };
+    
+    return cmd;
+}
+
+// Find the command that starts at 'address' within [first, end).
+// Commands are decoded in order, so their addresses are sorted and we can do a binary search.
+static DynTableAnimCmd*
+findCmdAtAddress(DynTableAnimCmd* first, DynTableAnimCmd* end, RomPointer address) {
+    s64 low  = 0;
+    s64 high = end - first;
+    
+    // Find the first command with an address >= 'address'
+    while (low < high) {
+        s64 middle = low + (high - low) / 2;
+        
+        if (first[middle].address < address)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    
+    if ((first + low < end) && (first[low].address == address))
+        return &first[low];
+    else
+        return NULL;
+}
+
 DynTableAnimCmd*
-fillVariantFromRom(MemArena* arena, u8* rom, const RomPointer* variantInRom) {
+fillVariantFromRom(MemArena* arena, RomView* rom, const RomPointer* variantInRom) {
     ACmd* cmdInRom = romToVirtual(rom, *variantInRom);   // A 'real' pointer to the current cmd inside the ROM
     RomPointer cmdAddress = *variantInRom;               // The ROM pointer the current cmd is at
     
-    DynTableAnimCmd* variantStart = memArenaReserve(arena, sizeof(DynTableAnimCmd));
+    DynTableAnimCmd* variantStart = pushAnimCmd(arena);
     DynTableAnimCmd* currCmd = variantStart;
     
     bool breakLoop = FALSE;
@@ -942,21 +1593,20 @@ fillVariantFromRom(MemArena* arena, u8* rom, const RomPointer* variantInRom) {
                 currCmd->cmd._jump.offset = cmdInRom->_jump.offset;
                 currCmd->jmpTarget = cmdAddress - cmdInRom->_jump.offset*sizeof(s32);
                 structSize = sizeof(ACmd_JumpBack);
-                
+                    
                 // We will use this label to calculate the offset for the jump
                 currCmd->flags |= ACMD_FLAG__NEEDS_LABEL;
-                
-                for (DynTableAnimCmd* check = variantStart; check < currCmd; check++) {
-                    if (check->address == currCmd->jmpTarget) {
-                        check->flags |= ACMD_FLAG__IS_POINTED_TO;
-                        
-                        StringId labelId = check->label;
-                        
-                        currCmd->cmd._exJump.jumpTarget = check;
-                        break;
-                    }
+                    
+                DynTableAnimCmd* target = findCmdAtAddress(variantStart, currCmd, currCmd->jmpTarget);
+                if (target) {
+                    target->flags |= ACMD_FLAG__IS_POINTED_TO;
+                    currCmd->cmd._exJump.jumpTarget = target;
+                } else {
+                    fprintf(stderr,
+                            "WARNING: Jump at 0x%08X targets 0x%08X, which is not the start of a command in its variant (0x%08X-0x%08X).\n",
+                            cmdAddress, currCmd->jmpTarget, variantStart->address, cmdAddress);
                 }
-                
+                    
                 breakLoop = TRUE;
             } break;
                 
@@ -997,7 +1647,7 @@ fillVariantFromRom(MemArena* arena, u8* rom, const RomPointer* variantInRom) {
                 currCmd->cmd._animId.animId  = cmdInRom->_animId.animId;
                 currCmd->cmd._animId.variant = cmdInRom->_animId.variant;
                 structSize = sizeof(ACmd_SetIdAndVariant);
-                
+                    
                 breakLoop = TRUE;
             } break;
                 
@@ -1039,84 +1689,276 @@ fillVariantFromRom(MemArena* arena, u8* rom, const RomPointer* variantInRom) {
         // Prevent an empty cmd getting allocated,
         // when the loop is about to end
         if(!breakLoop)
-            currCmd = memArenaReserve(arena, sizeof(DynTableAnimCmd));
+            currCmd = pushAnimCmd(arena);
     }
     
     return variantStart;
 }
 
-/* +--------------------------------------+
-   |  ---------  Data Layout  ---------   |
-   +--------------------------------------+
-   |  DynTableAnim[]                      |
-   +--------------------------------------+
-   |  u16[animCount] variantsPerAnim      |
-   +--------------------------------------+
-   | (s32)offsets -> each anim's variants |
-   |  / / / / / / / / / / / / / / / / / / |
-   | All commands, for each variant       |
-   +--------------------------------------+
-*/
+#if BENCHMARK_ARENA
 static void
-createDynamicAnimTable(MemArena* arena, u8* rom, AnimationTable *animTable, DynTable* dynTable) {
-    u32 animCount = animTable->entryCount;
-    
-    DynTableAnim* table = NULL;
-    u16* variantsPerAnim = NULL;
-    DynTableAnimCmd* variantStart = NULL;
+benchmarkArena(void) {
+    const int runs = 8;
+    const u32 cmdCount = 1 << 22;
+    double timeReserve = 0.0;
+    double timePush    = 0.0;
+    MemArena arena;
+    memArenaInit(&arena);
+    
+    // Commit and fault in all pages first, so neither side pays for that.
+    memArenaReserve(&arena, cmdCount * sizeof(DynTableAnimCmd));
+    memArenaRestore(&arena, 0);
+    
+    for (int i = 0; i < runs; i++) {
+        // Same pattern as 'fillVariantFromRom': one command at a time, a few fields get set.
+        double start = getWallClockSeconds();
+        for (u32 c = 0; c < cmdCount; c++) {
+            DynTableAnimCmd* cmd = memArenaReserve(&arena, sizeof(DynTableAnimCmd));
+            cmd->address = c;
+            cmd->cmd._display.displayForNFrames = c;
+        }
+        timeReserve += getWallClockSeconds() - start;
+        memArenaRestore(&arena, 0);
+        
+        start = getWallClockSeconds();
+        for (u32 c = 0; c < cmdCount; c++) {
+            DynTableAnimCmd* cmd = pushAnimCmd(&arena);
+            cmd->address = c;
+            cmd->cmd._display.displayForNFrames = c;
+        }
+        timePush += getWallClockSeconds() - start;
+        memArenaRestore(&arena, 0);
+    }
     
-    // Init the table and ensure there's enough space in memory
-    table = memArenaReserve(arena, animCount * sizeof(DynTableAnim));
+    memArenaFree(&arena);
     
-    // Count the number of variants of each animation
-    variantsPerAnim = memArenaReserve(arena, animCount * sizeof(u16));
-    for (u32 animId = 0; animId < animCount; animId++)
-        variantsPerAnim[animId] = countVariants(rom, animTable, animId);
+    fprintf(stderr,
+            "Arena benchmark (%d runs of %u commands, %d bytes each):\n"
+            "  memArenaReserve: %6.2f ns/cmd\n"
+            "  pushAnimCmd:     %6.2f ns/cmd\n",
+            runs, cmdCount, (int)sizeof(DynTableAnimCmd),
+            (timeReserve / ((double)runs * cmdCount)) * 1e9,
+            (timePush / ((double)runs * cmdCount)) * 1e9);
+}
+#endif
+
+typedef struct {
+    u32 threadIndex;
+    
+    // Ranges of the decoding thread's arenas that belong to this block
+    u64 cmdsStart;
+    u64 cmdsEnd;
+    u64 relocationsStart;
+    u64 relocationsEnd;
+} DecodeBlock;
+
+typedef struct {
+    u32 threadIndex;
     
+    RomView* rom;
+    AnimationTable* animTable;
+    u16* variantsPerAnim;
     
-    // Convert all the commands of each animation into a format that lets us easily modify it.
-    for (int animationId = 0; animationId < animCount; animationId++) {
-        RomPointer animPointer = animTable->data[animationId];
-        if (animPointer == 0)
-            continue;
+    DecodeBlock* blocks;
+    u32 blockCount;
+    volatile u32* nextBlock;
+    
+    // Position of each animation's variant offsets inside the 'cmds' arena of the thread that decoded it
+    u64* variantOffsetsPos;
+    
+    MemArena cmds;        // Variant offsets and commands of every block this thread decoded
+    MemArena relocations; // Offsets (into 'cmds') of commands with a 'jumpTarget' pointer
+} DecodeThread;
+
+#define NO_VARIANT_OFFSETS ((u64)-1)
+
+// Decode blocks of animations until none are left.
+// Everything gets written into the thread's own arenas, the results get merged by 'createDynamicAnimTable'.
+static void
+decodeAnimationsThread(void* params) {
+    DecodeThread* thread = params;
+    AnimationTable* animTable = thread->animTable;
+    u16* variantsPerAnim = thread->variantsPerAnim;
+    u8* cmdsBase = thread->cmds.memory;
+    
+    for (;;) {
+        u32 blockId = atomicFetchAddU32(thread->nextBlock, 1);
+        if (blockId >= thread->blockCount)
+            break;
+        
+        DecodeBlock* block = &thread->blocks[blockId];
+        block->threadIndex      = thread->threadIndex;
+        block->cmdsStart        = memArenaCheckpoint(&thread->cmds);
+        block->relocationsStart = memArenaCheckpoint(&thread->relocations);
+        
+        s32 firstAnim = blockId * DECODE_BLOCK_SIZE;
+        s32 endAnim   = Min(firstAnim + DECODE_BLOCK_SIZE, animTable->entryCount);
         
-        // Don't print an animation that we already printed.
-        int prevIndex = -1;
-        if (wasReferencedBefore(animTable, animationId, &prevIndex)) {
-            s32 offsetCurrPrev = (&table[prevIndex] - &table[animationId]);
+        for (s32 animationId = firstAnim; animationId < endAnim; animationId++) {
+            RomPointer animPointer = animTable->data[animationId];
+            if (animPointer == 0)
+                continue;
             
-            table[animationId].offsetVariants = offsetCurrPrev;
-            variantsPerAnim[animationId] = variantsPerAnim[prevIndex];
+            // Count the number of variants of the animation
+            u16 numVariants = countVariants(thread->rom, animTable, animationId);
+            variantsPerAnim[animationId] = numVariants;
             
-            continue;
+            // Don't decode an animation that was already decoded.
+            // Aliases get their offsets in 'createDynamicAnimTable'.
+            if (wasReferencedBefore(animTable, animationId, NULL))
+                continue;
+            
+            RomPointer *variantsInRom = romToVirtual(thread->rom, animPointer);
+            if (variantsInRom == NULL)
+                continue;
+            
+            // allocate offsets of each variant
+            s32* variantOffsets = memArenaPushArray(&thread->cmds, s32, numVariants);
+            
+            if (variantOffsets)
+                thread->variantOffsetsPos[animationId] = (u8*)variantOffsets - cmdsBase;
+            
+            // - iterate through all variants of the current animation
+            // - flag commands that are pointed at by jumps.
+            // - set offset to each variant
+            for (u16 variantId = 0; variantId < numVariants; variantId++) {
+                DynTableAnimCmd* variantStart = fillVariantFromRom(&thread->cmds, thread->rom, &variantsInRom[variantId]);
+                DynTableAnimCmd* variantEnd   = (DynTableAnimCmd*)(cmdsBase + thread->cmds.offset);
+                
+                s32 offset = (s32)(((u8*)variantStart) - (u8*)&variantOffsets[variantId]);
+                variantOffsets[variantId] = offset;
+                
+                // Jump targets are pointers, they have to be moved along with the block.
+                for (DynTableAnimCmd* cmd = variantStart; cmd < variantEnd; cmd++) {
+                    if ((cmd->cmd.id == AnimCmd_JumpBack) && cmd->cmd._exJump.jumpTarget)
+                        memArenaAddU64(&thread->relocations, (u8*)cmd - cmdsBase);
+                }
+            }
+            
+            // SA1 cornercase, of a pointer pointing at
+            // supposedly deleted variant, without a replacement "End" command.
+            if((variantsInRom[numVariants] >= ROM_BASE)
+               && (&variantsInRom[numVariants] < animTable->data)){
+                
+            }
         }
         
-        RomPointer *variantsInRom = romToVirtual(rom, animPointer);
+        block->cmdsEnd        = memArenaCheckpoint(&thread->cmds);
+        block->relocationsEnd = memArenaCheckpoint(&thread->relocations);
+    }
+}
+
+/* +--------------------------------------+
+   |  ---------  Data Layout  ---------   |
+   +--------------------------------------+
+   |  DynTableAnim[]                      |
+   +--------------------------------------+
+   |  u16[animCount] variantsPerAnim      |
+   +--------------------------------------+
+   | (s32)offsets -> each anim's variants |
+   |  / / / / / / / / / / / / / / / / / / |
+   | All commands, for each variant       |
+   +--------------------------------------+
+   
+   The animations get decoded on multiple threads in blocks of DECODE_BLOCK_SIZE,
+   and the blocks get copied into 'arena' in order afterwards,
+   so the layout is the same as if everything was decoded sequentially.
+*/
+static void
+createDynamicAnimTable(MemArena* arena, RomView* rom, AnimationTable *animTable, DynTable* dynTable) {
+    u32 animCount = animTable->entryCount;
+    
+    DynTableAnim* table = NULL;
+    u16* variantsPerAnim = NULL;
+    
+    // Init the table and ensure there's enough space in memory
+    table = memArenaPushArray(arena, DynTableAnim, animCount);
+    variantsPerAnim = memArenaPushArray(arena, u16, animCount);
+    
+    u32 blockCount = (animCount + DECODE_BLOCK_SIZE - 1) / DECODE_BLOCK_SIZE;
+    u32 threadCount = (DECODE_THREAD_COUNT > 0) ? DECODE_THREAD_COUNT : getProcessorCount();
+    threadCount = Min(Min(threadCount, blockCount), MAX_THREADS);
+    threadCount = Max(threadCount, 1);
+    
+    MemArena scratch;
+    memArenaInit(&scratch);
+    
+    DecodeBlock* blocks = memArenaPushArray(&scratch, DecodeBlock, blockCount);
+    DecodeThread* threads = memArenaPushArray(&scratch, DecodeThread, threadCount);
+    u64* variantOffsetsPos = memArenaPushArrayNoZero(&scratch, u64, animCount);
+    volatile u32 nextBlock = 0;
+    
+    for (u32 animId = 0; animId < animCount; animId++)
+        variantOffsetsPos[animId] = NO_VARIANT_OFFSETS;
+    
+    for (u32 i = 0; i < threadCount; i++) {
+        DecodeThread* thread = &threads[i];
+        thread->threadIndex = i;
+        thread->rom = rom;
+        thread->animTable = animTable;
+        thread->variantsPerAnim = variantsPerAnim;
+        thread->blocks = blocks;
+        thread->blockCount = blockCount;
+        thread->nextBlock = &nextBlock;
+        thread->variantOffsetsPos = variantOffsetsPos;
+        memArenaInit(&thread->cmds);
+        memArenaInit(&thread->relocations);
+    }
+    
+    runThreads(decodeAnimationsThread, threads, sizeof(DecodeThread), threadCount);
+    
+    // Merge the blocks in order
+    for (u32 blockId = 0; blockId < blockCount; blockId++) {
+        DecodeBlock* block = &blocks[blockId];
+        DecodeThread* thread = &threads[block->threadIndex];
         
-        // allocate offsets of each variant
-        s32* variantOffsets = memArenaReserve(arena, variantsPerAnim[animationId] * sizeof(u32));
-        table[animationId].offsetVariants = (s32)((u8*)variantOffsets - (u8*)&table[animationId]);
+        u64 blockSize = block->cmdsEnd - block->cmdsStart;
+        u8* source = (u8*)thread->cmds.memory + block->cmdsStart;
+        u8* dest   = memArenaReserveNoZero(arena, blockSize);
         
+        if (blockSize > 0)
+            memcpy(dest, source, blockSize);
         
-        // - iterate through all variants of the current animation
-        // - flag commands that are pointed at by jumps.
-        // - set offset to each variant
-        u16 numVariants = variantsPerAnim[animationId];
-        for (u16 variantId = 0; variantId < numVariants; variantId++) {
-            variantStart = fillVariantFromRom(arena, rom, &variantsInRom[variantId]);
-            
-            s32 offset = (s32)(((u8*)variantStart) - (u8*)&variantOffsets[variantId]);
-            variantOffsets[variantId] = offset;
+        // Commands pointing at other commands have to point into the copy
+        u64* relocations = (u64*)((u8*)thread->relocations.memory + block->relocationsStart);
+        u64 relocationCount = (block->relocationsEnd - block->relocationsStart) / sizeof(u64);
+        for (u64 i = 0; i < relocationCount; i++) {
+            DynTableAnimCmd* cmd = (DynTableAnimCmd*)(dest + (relocations[i] - block->cmdsStart));
+            u8* target = cmd->cmd._exJump.jumpTarget;
+            cmd->cmd._exJump.jumpTarget = dest + (target - source);
         }
         
-        // SA1 cornercase, of a pointer pointing at
-        // supposedly deleted variant, without a replacement "End" command.
-        if((variantsInRom[numVariants] >= ROM_BASE)
-           && (&variantsInRom[numVariants] < animTable->data)){
+        s32 firstAnim = blockId * DECODE_BLOCK_SIZE;
+        s32 endAnim   = Min(firstAnim + DECODE_BLOCK_SIZE, animCount);
+        for (s32 animationId = firstAnim; animationId < endAnim; animationId++) {
+            if (animTable->data[animationId] == 0)
+                continue;
+            
+            int prevIndex = -1;
+            if (wasReferencedBefore(animTable, animationId, &prevIndex)) {
+                s32 offsetCurrPrev = (&table[prevIndex] - &table[animationId]);
+                
+                table[animationId].offsetVariants = offsetCurrPrev;
+                variantsPerAnim[animationId] = variantsPerAnim[prevIndex];
+                
+                continue;
+            }
+            
+            // Animations without variants don't have offsets
+            if (variantOffsetsPos[animationId] == NO_VARIANT_OFFSETS)
+                continue;
             
+            u8* variantOffsets = dest + (variantOffsetsPos[animationId] - block->cmdsStart);
+            table[animationId].offsetVariants = (s32)(variantOffsets - (u8*)&table[animationId]);
         }
     }
     
+    for (u32 i = 0; i < threadCount; i++) {
+        memArenaFree(&threads[i].cmds);
+        memArenaFree(&threads[i].relocations);
+    }
+    memArenaFree(&scratch);
+    
     dynTable->animations = table;
     dynTable->variantCounts = variantsPerAnim;
 }
@@ -1171,8 +2013,14 @@ createAnimLabels(DynTable* table, u32 numAnimations, LabelStrings* labels, MemAr
 
 typedef void (*CmdIterator)(FILE* fileStream, DynTableAnimCmd* cmd, u16 animId, u16 variantId, u16 labelId, void* itParams);
 
-// Go through every command that was found in the game and pass it to 'iterator' function.
-void iterateAllCommands(FILE* fileStream, DynTable *dynTable, u16 startAnimId, u16 endAnimId, CmdIterator iterator, void* iteratorParams) {
+typedef struct {
+    CmdIterator iterator;
+    void* params;
+} CmdVisitor;
+
+// Go through every command that was found in the game once and pass it to each of the 'visitors'.
+// Running several analyses in one traversal costs less than iterating over all commands for each of them.
+void iterateAllCommandsFused(FILE* fileStream, DynTable *dynTable, u16 startAnimId, u16 endAnimId, CmdVisitor* visitors, u32 visitorCount) {
     for (int animId = startAnimId; animId < endAnimId; animId++) {
         DynTableAnim* anim = &dynTable->animations[animId];
         
@@ -1187,7 +2035,8 @@ void iterateAllCommands(FILE* fileStream, DynTable *dynTable, u16 startAnimId, u
             
             int labelId = 0;
             while (TRUE) {
-                iterator(fileStream, dtCmd, animId, variantId, labelId, iteratorParams);
+                for (u32 i = 0; i < visitorCount; i++)
+                    visitors[i].iterator(fileStream, dtCmd, animId, variantId, labelId, visitors[i].params);
                 
                 dtCmd++;
                 
@@ -1201,6 +2050,12 @@ void iterateAllCommands(FILE* fileStream, DynTable *dynTable, u16 startAnimId, u
     }
 }
 
+// Go through every command that was found in the game and pass it to 'iterator' function.
+void iterateAllCommands(FILE* fileStream, DynTable *dynTable, u16 startAnimId, u16 endAnimId, CmdIterator iterator, void* iteratorParams) {
+    CmdVisitor visitor = { iterator, iteratorParams };
+    iterateAllCommandsFused(fileStream, dynTable, startAnimId, endAnimId, &visitor, 1);
+}
+
 typedef struct {
     s32 firstTileId;
     u32 minRange;
@@ -1260,8 +2115,9 @@ void itGetNumTileInformation(FILE* fileStream, DynTableAnimCmd* dtCmd, u16 animI
 #endif
         }
         
-        TileInfo* tileInfo = (TileInfo*)itParams;
-        tileInfo->numTileIndices = Max(tileInfo->numTileIndices, (cmd->tileIndex + cmd->numTilesToCopy));
+        // 8bpp tiles are in a separate table (negative index), they'd mess up the count.
+        if (cmd->tileIndex >= 0)
+            tileInfo->numTileIndices = Max(tileInfo->numTileIndices, (cmd->tileIndex + cmd->numTilesToCopy));
         tileInfo->numGetTileCalls++;
         
         TileRange tr;
@@ -1274,6 +2130,169 @@ void itGetNumTileInformation(FILE* fileStream, DynTableAnimCmd* dtCmd, u16 animI
     }
 }
 
+typedef struct {
+    u32 numCommands;
+    u32 numDisplayedFrames;
+    u32 numPerCommand[SizeofArray(animCommands)];
+} CmdStatistics;
+
+void itCountCommands(FILE* fileStream, DynTableAnimCmd* dtCmd, u16 animId, u16 variantId, u16 labelId, void* itParams) {
+    CmdStatistics* stats = (CmdStatistics*)itParams;
+    
+    s32 nottedCmdId = ~(dtCmd->cmd.id);
+    if (nottedCmdId >= 0 && nottedCmdId < SizeofArray(animCommands))
+        stats->numPerCommand[nottedCmdId]++;
+    else
+        stats->numPerCommand[~(AnimCmd_DisplayFrame)]++;
+    
+    if (dtCmd->cmd.id >= 0)
+        stats->numDisplayedFrames += dtCmd->cmd._display.displayForNFrames;
+    
+    stats->numCommands++;
+}
+
+typedef struct {
+    u32 getTilesCalls;
+    u32 uploadedTiles;    // All tiles the GetTiles commands copy
+    u32 uploadedBytes;
+    u32 distinctTiles;    // Different tiles of the ROM's tile table
+    u32 exactTiles;       // Different contents
+    u32 uniqueTiles;      // Different contents, if flipped tiles count as the same
+    u32 uniqueBytes;
+} TileDedupCounts;
+
+// Counts every tile only once per animation, and once for the whole ROM.
+typedef struct {
+    TileIndex indices[2]; // 4bpp, 8bpp
+    
+    // Marks of the current animation, everything with another stamp wasn't seen in it yet
+    u32 stamp;
+    u32* tileStamps[2];   // Per tile of the table
+    u32* uniqueStamps[2]; // Per canonical tile
+    u8* uniqueFlips[2];   // Per canonical tile: bit (1 << flip) for every flipped version that was seen
+    
+    // Same for the whole ROM, (1 << 4) marks that the tile was seen at all
+    u8* tileSeen[2];
+    u8* uniqueSeen[2];
+    
+    TileDedupCounts anim;
+    TileDedupCounts total;
+    
+    MemArena arena;
+} TileDedupInfo;
+
+static void
+tileDedupInit(TileDedupInfo* info, RomView* rom, SpriteTables* spriteTables) {
+    memset(info, 0, sizeof(*info));
+    memArenaInit(&info->arena);
+    info->stamp = 1;
+    
+    u8* tables[2]   = { spriteTables->tiles_4bpp, spriteTables->tiles_8bpp };
+    u32 tileSize[2] = { TILE_SIZE_4BPP, TILE_SIZE_8BPP };
+    
+    for (int i = 0; i < 2; i++) {
+        // The tables don't store their size, but they can't go past the end of the ROM.
+        u32 tileCount = 0;
+        if (romViewContains(rom, tables[i], 0))
+            tileCount = (u32)((rom->base + rom->size - tables[i]) / tileSize[i]);
+        
+        tileIndexInit(&info->indices[i], tables[i], tileCount, tileSize[i]);
+        info->tileStamps[i]   = memArenaPushArray(&info->arena, u32, tileCount);
+        info->uniqueStamps[i] = memArenaPushArray(&info->arena, u32, tileCount);
+        info->uniqueFlips[i]  = memArenaPushArray(&info->arena, u8,  tileCount);
+        info->tileSeen[i]     = memArenaPushArray(&info->arena, u8,  tileCount);
+        info->uniqueSeen[i]   = memArenaPushArray(&info->arena, u8,  tileCount);
+    }
+}
+
+static void
+tileDedupFree(TileDedupInfo* info) {
+    tileIndexFree(&info->indices[0]);
+    tileIndexFree(&info->indices[1]);
+    memArenaFree(&info->arena);
+}
+
+static void
+countTile(TileDedupInfo* info, int table, u32 tileId) {
+    TileIndex* index = &info->indices[table];
+    u32 key      = tileIndexGetKey(index, tileId);
+    u32 uniqueId = tileKeyUniqueId(key);
+    u8 flipBit   = 1 << tileKeyFlip(key);
+    
+    if (info->tileStamps[table][tileId] != info->stamp) {
+        info->tileStamps[table][tileId] = info->stamp;
+        info->anim.distinctTiles++;
+        
+        if (info->uniqueStamps[table][uniqueId] != info->stamp) {
+            info->uniqueStamps[table][uniqueId] = info->stamp;
+            info->uniqueFlips[table][uniqueId] = 0;
+            
+            info->anim.uniqueTiles++;
+            info->anim.uniqueBytes += index->tileSize;
+        }
+        
+        if (!(info->uniqueFlips[table][uniqueId] & flipBit)) {
+            info->uniqueFlips[table][uniqueId] |= flipBit;
+            info->anim.exactTiles++;
+        }
+    }
+    
+    if (!info->tileSeen[table][tileId]) {
+        info->tileSeen[table][tileId] = TRUE;
+        info->total.distinctTiles++;
+        
+        u8* seen = &info->uniqueSeen[table][uniqueId];
+        if (!(*seen & (1 << 4))) {
+            info->total.uniqueTiles++;
+            info->total.uniqueBytes += index->tileSize;
+        }
+        
+        if (!(*seen & flipBit))
+            info->total.exactTiles++;
+        
+        *seen |= flipBit | (1 << 4);
+    }
+}
+
+void itCountUniqueTiles(FILE* fileStream, DynTableAnimCmd* dtCmd, u16 animId, u16 variantId, u16 labelId, void* itParams) {
+    TileDedupInfo* info = (TileDedupInfo*)itParams;
+    
+    if (dtCmd->cmd.id == AnimCmd_GetTiles) {
+        ACmd_GetTiles* cmd = &dtCmd->cmd._tiles;
+        
+        // 8bpp tiles are in a separate table (negative index)
+        int table = (cmd->tileIndex < 0) ? 1 : 0;
+        u32 firstTile = cmd->tileIndex & 0x7FFFFFFF;
+        u32 tileCount = info->indices[table].tileCount;
+        
+        info->anim.getTilesCalls++;
+        info->anim.uploadedTiles += cmd->numTilesToCopy;
+        info->anim.uploadedBytes += cmd->numTilesToCopy * info->indices[table].tileSize;
+        
+        for (u32 i = 0; i < cmd->numTilesToCopy && firstTile + i < tileCount; i++)
+            countTile(info, table, firstTile + i);
+    }
+}
+
+// Adds the row of the animation whose commands were just visited, and starts counting the next one.
+static void
+tileDedupEndAnimation(TileDedupInfo* info, OutBuffer* report, u16 animId) {
+    TileDedupCounts* anim = &info->anim;
+    
+    if (anim->getTilesCalls > 0) {
+        outFormat(report, "%u,%u,%u,%u,%u,%u,%u,%u\n", animId, anim->getTilesCalls,
+                  anim->uploadedTiles, anim->uploadedBytes, anim->distinctTiles,
+                  anim->exactTiles, anim->uniqueTiles, anim->uniqueBytes);
+    }
+    
+    info->total.getTilesCalls += anim->getTilesCalls;
+    info->total.uploadedTiles += anim->uploadedTiles;
+    info->total.uploadedBytes += anim->uploadedBytes;
+    
+    memset(anim, 0, sizeof(*anim));
+    info->stamp++;
+}
+
 int trCompare(const void* _a, const void* _b) {
     TileRange* a = (TileRange*)_a;
     TileRange* b = (TileRange*)_b;
@@ -1325,95 +2344,255 @@ char* gameFolderName(u8* rom) {
     }
 }
 
-void tryLoadingRom(char* path, u8** rom, eGame *romIndex) {
-    FILE* romFile = fopen(path, "rb");
-    int fileSize = 0;
+// Map the ROM file into memory read-only, so the exporter reads straight from the page cache.
+// Returns FALSE if the platform can't map files or the mapping failed.
+static bool
+tryMappingRom(char* path, RomFile* romFile) {
+#if ROM_LOADER_USE_MMAP
+#ifdef __unix__
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return FALSE;
+    
+    struct stat fileInfo;
+    if ((fstat(fd, &fileInfo) != 0) || (fileInfo.st_size <= 0)) {
+        close(fd);
+        return FALSE;
+    }
+    
+    int flags = MAP_PRIVATE;
+#if ROM_MMAP_POPULATE && defined(MAP_POPULATE)
+    flags |= MAP_POPULATE;
+#endif
+    
+    void* memory = mmap(NULL, fileInfo.st_size, PROT_READ, flags, fd, 0);
+    
+    // The mapping keeps its own reference to the file.
+    close(fd);
+    
+    if (memory == MAP_FAILED)
+        return FALSE;
+    
+#if ROM_MMAP_ADVICE
+    madvise(memory, fileInfo.st_size, ROM_MMAP_ADVICE);
+#endif
+    
+    romFile->data = memory;
+    romFile->size = fileInfo.st_size;
+    romFile->isMapped = TRUE;
+    
+    return TRUE;
+#else
+#ifdef _MSC_VER
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return FALSE;
+    
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || (fileSize.QuadPart <= 0)) {
+        CloseHandle(file);
+        return FALSE;
+    }
+    
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    void* memory = NULL;
+    if (mapping) {
+        memory = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        
+        // The view keeps the mapping alive.
+        CloseHandle(mapping);
+    }
+    CloseHandle(file);
+    
+    if (memory == NULL)
+        return FALSE;
+    
+    romFile->data = memory;
+    romFile->size = fileSize.QuadPart;
+    romFile->isMapped = TRUE;
+    
+    return TRUE;
+#endif
+#endif
+#endif
+    return FALSE;
+}
+
+// Copy the whole ROM file into a heap buffer.
+static void
+readRom(char* path, RomFile* romFile) {
+    FILE* file = fopen(path, "rb");
+    long int fileSize = 0;
     
-    if (romFile == NULL) {
+    if (file == NULL) {
         fprintf(stderr, "Could not open file '%s'. Code: %d\n", path, errno);
         exit(-2);
     }
     
-    fileSize = getFileSize(romFile);
-    *rom = (u8*)malloc(fileSize);
+    fileSize = getFileSize(file);
+    romFile->data = (u8*)malloc(fileSize);
+    romFile->size = fileSize;
+    romFile->isMapped = FALSE;
     
-    fseek(romFile, 0, SEEK_SET);
-    if (fread(*rom, 1, fileSize, romFile) != fileSize) {
+    fseek(file, 0, SEEK_SET);
+    if (fread(romFile->data, 1, fileSize, file) != fileSize) {
         fprintf(stderr, "File '%s' couldn't be fully loaded.\n", path);
         exit(-3);
     }
     
     // We have a copy of the ROM in memory
     // and don't intend to write to it again, so close the file.
-    fclose(romFile);
+    fclose(file);
+}
+
+void unloadRom(RomFile* romFile) {
+    if (romFile->data == NULL)
+        return;
+    
+    if (romFile->isMapped) {
+#ifdef __unix__
+        munmap(romFile->data, romFile->size);
+#else
+#ifdef _MSC_VER
+        UnmapViewOfFile(romFile->data);
+#endif
+#endif
+    } else {
+        free(romFile->data);
+    }
+    
+    romFile->data = NULL;
+    romFile->size = 0;
+}
+
+void tryLoadingRom(char* path, RomFile* romFile, eGame *romIndex) {
+    if (!tryMappingRom(path, romFile))
+        readRom(path, romFile);
     
+    // Make sure we can at least read the header
+    if (romFile->size < 0xC0) {
+        fprintf(stderr, "File '%s' is too small to be a GBA ROM.\n", path);
+        exit(-3);
+    }
     
-    *romIndex = getRomIndex(*rom);
+    *romIndex = getRomIndex(romFile->data);
     if (*romIndex == UNKNOWN) {
         fprintf(stderr, "Loaded ROM is unknown game. Closing...\n");
         exit(-4);
     }
 }
 
+#if BENCHMARK_ROM_LOADERS
+// Sum one byte of each page, so lazily mapped pages get paid for as well.
+static u32
+touchRomPages(RomFile* romFile) {
+    u32 sum = 0;
+    for (u64 i = 0; i < romFile->size; i += 4096)
+        sum += romFile->data[i];
+    
+    return sum;
+}
+
+static void
+benchmarkRomLoaders(char* path) {
+    const int runs = 16;
+    double timeMapped = 0.0;
+    double timeRead   = 0.0;
+    u32 checksum = 0;
+    
+    for (int i = 0; i < runs; i++) {
+        RomFile romFile = { 0 };
+        
+        double start = getWallClockSeconds();
+        if (!tryMappingRom(path, &romFile)) {
+            fprintf(stderr, "Benchmark: mapping '%s' failed.\n", path);
+            return;
+        }
+        checksum += touchRomPages(&romFile);
+        unloadRom(&romFile);
+        timeMapped += getWallClockSeconds() - start;
+        
+        start = getWallClockSeconds();
+        readRom(path, &romFile);
+        checksum += touchRomPages(&romFile);
+        unloadRom(&romFile);
+        timeRead += getWallClockSeconds() - start;
+    }
+    
+    fprintf(stderr,
+            "ROM loader benchmark (%d runs, checksum %u):\n"
+            "  mmap:         %7.3f ms/run\n"
+            "  malloc+fread: %7.3f ms/run\n",
+            runs, checksum,
+            (timeMapped / runs) * 1000.0,
+            (timeRead / runs) * 1000.0);
+}
+#endif
+
 void printHelp(char* programPath) {
     fprintf(stderr,
             "This program can be used to extract animation data from the Sonic Advance games.\n"
             "Please add the path to a Sonic Advance 1|2|3 ROM file as a parameter.\n"
-            "%s <SA3 ROM>\n", programPath);
+            "%s <SA3 ROM> [--asm] [--c] [--atlas | --atlas-game]\n"
+            "  --asm         Output the animations as GNU assembler macros (.inc)\n"
+            "  --c           Output the animations as C arrays (.c), the default\n"
+            "Both can be combined, the ROM only gets parsed once.\n"
+            "  --atlas       Put the images of all frames of an animation onto sprite sheets,\n"
+            "                instead of writing images for every frame\n"
+            "  --atlas-game  Same, but with one set of sprite sheets for the whole game\n", programPath);
 }
 
-// The "Display" command occurs after the tile/palette data is set,
-// so we store the information in the buffer, until the command occurs.
-static FrameData fdBuffer = { 0 };
-
 void generateFrameData(FILE* fileStream, DynTableAnimCmd* dtCmd, u16 animId, u16 variantId, u16 labelId, void* itParams) {
     FrameDataInput* in = itParams;
     FrameData* frames  = in->data;
+    FrameData* fdBuffer = &in->ctx->fdBuffer;
     
     if (dtCmd->cmd.id >= 0) {
         // Game says the frame shall be displayed, so we output it, if that didn't happen yet.
         ACmd_Display* cmd = &dtCmd->cmd._display;
         
+        // The number of frames isn't known before all commands were visited, so grow the array as needed.
+        // Nothing else is allocated from 'frameData' in the meantime, so it stays contiguous.
+        if (cmd->frameIndex >= in->frameCount) {
+            u16 newFrameCount = cmd->frameIndex + 1;
+            FrameData* newFrames = memArenaPushArray(&in->ctx->frameData, FrameData, newFrameCount - in->frameCount);
+            
+            if (in->data == NULL)
+                in->data = newFrames;
+            
+            assert(newFrames == in->data + in->frameCount);
+            in->frameCount = newFrameCount;
+            frames = in->data;
+        }
+        
         FrameData* frame = &frames[cmd->frameIndex];
         
         if (!frame->wasInitialized) {
-            memcpy(frame, &fdBuffer, sizeof(fdBuffer));
+            memcpy(frame, fdBuffer, sizeof(*fdBuffer));
             frame->animId = animId;
             frame->variantId = variantId;
             frame->labelId = labelId;
             frame->wasInitialized = TRUE;
             
             // Make sure the buffer doesn't immediate get copied in the next iteration
-            fdBuffer.wasInitialized = FALSE;
+            fdBuffer->wasInitialized = FALSE;
         }
     }
     else if (dtCmd->cmd.id == AnimCmd_GetTiles) {
         ACmd_GetTiles* cmd = &dtCmd->cmd._tiles;
-        fdBuffer.tileIndex = cmd->tileIndex;
-        fdBuffer.tileCount = cmd->numTilesToCopy;
+        fdBuffer->tileIndex = cmd->tileIndex;
+        fdBuffer->tileCount = cmd->numTilesToCopy;
     }
     else if (dtCmd->cmd.id == AnimCmd_GetPalette) {
         ACmd_GetPalette* cmd = &dtCmd->cmd._pal;
         
-        fdBuffer.paletteId = cmd->palId;
-        fdBuffer.numColors = cmd->numColors;
+        fdBuffer->paletteId = cmd->palId;
+        fdBuffer->numColors = cmd->numColors;
     }
     else {
     }
 }
 
-// Return the number of frames in an animation
-void getAnimFrameCount(FILE* fileStream, DynTableAnimCmd* dtCmd, u16 animId, u16 variantId, u16 labelId, void* itParams) {
-    u16* result = (u16*)itParams;
-    
-    if (dtCmd->cmd.id >= 0) {
-        ACmd_Display* disp = &dtCmd->cmd._display;
-        
-        // +1 because we want the _amount_ of frames
-        *result = Max(disp->frameIndex+1, *result);
-    }
-}
-
 // Get the last occurence of sub in base
 char* lastString(char* base, char* sub) {
     if (!base || !sub)
@@ -1482,71 +2661,529 @@ const s8Vec2D sOamTileSizes[3][4] = {
     { {1,2}, {1,4}, {2,4}, {4,8} }, // Vertical
 };
 
-typedef struct {
-    u16 lastAnim;
-    u16 writtenCount;
-    MemArena arena;
-} WrittenTiles;
-static WrittenTiles writtenTiles;
-
-// Check whether the addressed tiles were already exported.
-bool wasFrameIndexed(u16 animId, u8* targetTiles) {
-    if (animId != writtenTiles.lastAnim) {
-        writtenTiles.writtenCount = 0;
-        writtenTiles.lastAnim = animId;
-    }
+// Rebuilds the slots with room for twice as many frames, keeping the load factor at or below 50%
+static void
+frameStoreGrow(FrameStore* store) {
+    store->slotCount = Max(store->slotCount * 2, 1024);
     
-    u8** pointers = writtenTiles.arena.memory;
+    memArenaRestore(&store->slotArena, 0);
+    store->slots = memArenaPushArray(&store->slotArena, u32, store->slotCount);
     
-    bool result = FALSE;
-    for (int i = 0; i < writtenTiles.writtenCount; i++) {
-        if (pointers[i] == targetTiles) {
-            result = TRUE;
-            break;
+    for (u32 i = 0; i < store->frameCount; i++) {
+        u32 slot = (u32)store->frames[i].hash & (store->slotCount - 1);
+        
+        while (store->slots[slot] != 0)
+            slot = (slot + 1) & (store->slotCount - 1);
+        
+        store->slots[slot] = i + 1;
+    }
+}
+
+// Returns the frame with the same content, or NULL if there is none yet.
+// The content gets compared in full, so a hash collision can't merge different frames.
+static StoredFrame*
+frameStoreFind(FrameStore* store, u8* tiles, u32 size, u16 tileSize, u64* hash) {
+    *hash = hash64(tiles, size, tileSize);
+    u32 slot = (u32)*hash & (store->slotCount - 1);
+    
+    for (; store->slots[slot] != 0; slot = (slot + 1) & (store->slotCount - 1)) {
+        StoredFrame* frame = &store->frames[store->slots[slot] - 1];
+        
+        if ((frame->hash == *hash) && (frame->size == size) && (frame->tileSize == tileSize)
+            && !memcmp((u8*)store->data.memory + frame->dataOffset, tiles, size)) {
+            return frame;
         }
     }
     
-    return result;
+    return NULL;
 }
 
-void indexFrame(void* frameTiles){
-    u8** pointers = writtenTiles.arena.memory;
+// Adds a frame that got written as 'fileName', with the hash 'frameStoreFind' returned for it
+static void
+frameStoreAdd(FrameStore* store, u8* tiles, u32 size, u16 tileSize, u16 widthInTiles, u64 hash, char* fileName) {
+    StoredFrame* frame = memArenaPushArrayNoZero(&store->frameArena, StoredFrame, 1);
+    frame->hash     = hash;
+    frame->size     = size;
+    frame->tileSize = tileSize;
+    frame->widthInTiles = widthInTiles;
+    
+    u8* data = memArenaPushArrayNoZero(&store->data, u8, size);
+    frame->dataOffset = (u32)(data - (u8*)store->data.memory);
+    memcpy(data, tiles, size);
+    
+    assert(strlen(fileName) < sizeof(frame->fileName));
+    strcpy(frame->fileName, fileName);
+    
+    u32 slot = (u32)hash & (store->slotCount - 1);
+    while (store->slots[slot] != 0)
+        slot = (slot + 1) & (store->slotCount - 1);
     
-    pointers[writtenTiles.writtenCount] = frameTiles;
-    writtenTiles.writtenCount++;
+    store->slots[slot] = ++store->frameCount;
+    
+    if (store->frameCount * 2 > store->slotCount)
+        frameStoreGrow(store);
 }
 
-void generateSprite(u8* rom, MemArena* fullTileImage, SpriteTables* spriteTables, FrameDataInput* fdi, FILE* debugComposition, FILE* scriptFilestream, FILE* tile_collection, FILE* inc_bin, u16 animId, char* framePath, char* docsPath, char* palPath) {
-    FrameData* fds = fdi->data;
+static void
+frameStoreInit(FrameStore* store) {
+    memset(store, 0, sizeof(*store));
     
-    SpriteOffset* dimensions = romToVirtual(rom, spriteTables->dimensions[animId]);
-    u16* oamDataStart        = romToVirtual(rom, spriteTables->oamData[animId]);
+    memArenaInit(&store->frameArena);
+    memArenaInit(&store->slotArena);
+    memArenaInit(&store->data);
     
-    // Write script header
+    store->frames = store->frameArena.memory;
+    frameStoreGrow(store);
+}
+
+static void
+frameStoreFree(FrameStore* store) {
+    memArenaFree(&store->frameArena);
+    memArenaFree(&store->slotArena);
+    memArenaFree(&store->data);
+}
+
+// Same conversion as gbagfx: every 5-bit channel gets scaled up to 8 bits.
+static void
+paletteToRgb(const u16* colors, u32 colorCount, u8* rgb) {
+    for (u32 i = 0; i < colorCount; i++) {
+        u16 color = colors[i];
+        rgb[i*3 + 0] = (( color        & 0x1F) * 255) / 31;
+        rgb[i*3 + 1] = (((color >>  5) & 0x1F) * 255) / 31;
+        rgb[i*3 + 2] = (((color >> 10) & 0x1F) * 255) / 31;
+    }
+}
+
+// Writes the tiles of a frame as a paletted PNG, like "gbagfx <frame> <png> -object -palette <pal> -width <w>" would.
+// 4bpp frames use the 16 colors of their palette, 8bpp frames the 256 colors starting at it.
+// Returns FALSE if the PNG couldn't be written.
+static bool
+writeFramePng(ExporterContext* ctx, char* pngPath, u8* frameTiles, u32 frameSize, u32 tileSize,
+              u32 widthInTiles, s32 paletteId) {
+    MemArena* arena = &ctx->fullTileImage;
+    MemArenaTemp pngScope = memArenaBeginTemp(arena);
+    
+    u32 tileCount = frameSize / tileSize;
+    u32 heightInTiles = (tileCount + widthInTiles - 1) / widthInTiles;
+    u32 bitDepth = (tileSize == TILE_SIZE_4BPP) ? 4 : 8;
+    
+    // Missing tiles of the last row stay transparent.
+    u32 width = widthInTiles * TILE_WIDTH;
+    u8* pixels = memArenaPushArray(arena, u8, heightInTiles * TILE_WIDTH * width);
+    tilesToIndexed(frameTiles, tileCount, widthInTiles, tileSize, pixels);
+    
+    u32 colorCount = 1 << bitDepth;
+    u8 rgb[256 * 3] = { 0 };
+    u16* colors = &ctx->spriteTables.palettes[paletteId * 16];
+    
+    while ((colorCount > 0) && !romViewContains(&ctx->rom, colors, colorCount * sizeof(u16)))
+        colorCount -= 16;
+    paletteToRgb(colors, colorCount, rgb);
+    
+    u8* png;
+    u64 pngSize = pngEncodeIndexed(arena, &png, pixels, width, heightInTiles * TILE_WIDTH,
+                                   bitDepth, rgb, 1 << bitDepth, TRUE);
+    bool wasWritten = manifestWriteFile(&ctx->manifest, pngPath, png, pngSize);
+    
+    memArenaEndTemp(pngScope);
+    return wasWritten;
+}
+
+// Draws a frame onto 'canvas', with its anchor point at 'anchorX'/'anchorY'.
+// The top-left corner of the frame ends up 'SpriteOffset.offsetX/Y' pixels left/up of it.
+// The tiles of all OAM entries have to be inside the ROM. 'arena' only gets used temporarily.
+static void
+renderFrame(ExporterContext* ctx, MemArena* arena, RgbaCanvas* canvas, SpriteOffset* frameDimensions,
+            OamSplit* frameOamData, u8* tiles, u32 tileSize, s32 paletteId, s32 anchorX, s32 anchorY) {
+    MemArenaTemp renderScope = memArenaBeginTemp(arena);
+    
+    // 4bpp entries pick one of the 16 palettes starting at the frame's palette, 8bpp ones use all 256 colors.
+    // Colors past the end of the ROM stay transparent.
+    u32* colors = memArenaPushArray(arena, u32, 256);
+    u16* romColors = &ctx->spriteTables.palettes[paletteId * 16];
+    u32 colorCount = 256;
+    
+    while ((colorCount > 0) && !romViewContains(&ctx->rom, romColors, colorCount * sizeof(u16)))
+        colorCount -= 16;
+    
+    for (u32 i = 0; i < colorCount; i++)
+        colors[i] = rgbaFromGba(romColors[i]);
+    
+    u32 spriteCount = frameDimensions->numSubframes;
+    OamSprite* sprites = memArenaPushArrayNoZero(arena, OamSprite, spriteCount);
+    
+    for (u32 i = 0; i < spriteCount; i++) {
+        // See 'generateSprite' for why this is a cast
+        OamSplit* oam = (OamSplit*)&((u16*)frameOamData)[i * 3];
+        s8Vec2D sizes = sOamTileSizes[oam->shape][oam->size];
+        OamSprite* sprite = &sprites[i];
+        
+        sprite->tiles         = &tiles[oam->tileNum * tileSize];
+        sprite->colors        = (tileSize == TILE_SIZE_4BPP) ? &colors[oam->paletteNum * 16] : colors;
+        sprite->x             = anchorX - frameDimensions->offsetX + oam->x;
+        sprite->y             = anchorY - frameDimensions->offsetY + oam->y;
+        sprite->widthInTiles  = sizes.x;
+        sprite->heightInTiles = sizes.y;
+        sprite->tileSize      = tileSize;
+        sprite->flip          = (oam->matrixNum >> 3) & (OAM_FLIP_H | OAM_FLIP_V);
+        sprite->affineMode    = oam->affineMode;
+        sprite->objMode       = oam->objMode;
+        sprite->priority      = oam->priority;
+    }
     
-    if (dimensions == NULL || oamDataStart == NULL)
-        return;
+    oamRenderSprites(canvas, arena, sprites, spriteCount);
     
-    char filePath[256];
-    char filenameNoExt[64];
+    memArenaEndTemp(renderScope);
+}
+
+// Writes a frame the way the game shows it, cut to the frame's own size.
+static void
+writeFramePreview(ExporterContext* ctx, char* previewPath, SpriteOffset* frameDimensions, OamSplit* frameOamData,
+                  u8* tiles, u32 tileSize, s32 paletteId) {
+    MemArena* arena = &ctx->fullTileImage;
+    MemArenaTemp previewScope = memArenaBeginTemp(arena);
     
-    eGame game = getRomIndex(rom);
+    RgbaCanvas canvas;
+    rgbaCanvasInit(&canvas, arena, frameDimensions->width, frameDimensions->height);
+    renderFrame(ctx, arena, &canvas, frameDimensions, frameOamData, tiles, tileSize, paletteId,
+                frameDimensions->offsetX, frameDimensions->offsetY);
     
-    for (int frameId = 0; frameId < fdi->frameCount; frameId++) {
-        // Reset the frame buffer, to reduce memory usage
-        fullTileImage->offset = 0;
-        
-        
-        FrameData *fd = &fds[frameId];
-        SpriteOffset* frameDimensions = &dimensions[frameId];
-        assert((frameDimensions->width % 8) == 0);
-        assert((frameDimensions->height % 8) == 0);
-        
-        // " X,  Y - SubCnt: [SubDim, SubPos] \n"
-        fprintf(debugComposition, "%4d: %2d, %2d  - %4d  : ",
-                animId,
-                frameDimensions->width, frameDimensions->height,
-                frameDimensions->numSubframes);
+    u8* png;
+    u64 pngSize = pngEncodeRgba(arena, &png, canvas.pixels, canvas.width, canvas.height);
+    manifestWriteFile(&ctx->manifest, previewPath, png, pngSize);
+    
+    memArenaEndTemp(previewScope);
+}
+
+static void
+atlasInit(AtlasBuilder* atlas) {
+    memset(atlas, 0, sizeof(*atlas));
+    atlas->mode = ATLAS_OFF;
+    
+    memArenaInit(&atlas->frames);
+    memArenaInit(&atlas->sources);
+    memArenaInit(&atlas->sheets);
+    memArenaInit(&atlas->scratch);
+}
+
+static void
+atlasFree(AtlasBuilder* atlas) {
+    memArenaFree(&atlas->frames);
+    memArenaFree(&atlas->sources);
+    memArenaFree(&atlas->sheets);
+    memArenaFree(&atlas->scratch);
+}
+
+static void
+atlasAddFrame(AtlasBuilder* atlas, u16 animId, u16 frameId, SpriteOffset* frameDimensions, OamSplit* frameOamData,
+              u8* tiles, u32 tileSize, s32 paletteId) {
+    AtlasFrame* frame = memArenaPushArray(&atlas->frames, AtlasFrame, 1);
+    frame->animId  = animId;
+    frame->frameId = frameId;
+    frame->width   = frameDimensions->width;
+    frame->height  = frameDimensions->height;
+    frame->offsetX = frameDimensions->offsetX;
+    frame->offsetY = frameDimensions->offsetY;
+    
+    AtlasSource* source = memArenaPushArrayNoZero(&atlas->sources, AtlasSource, 1);
+    source->dimensions = frameDimensions;
+    source->oamData    = frameOamData;
+    source->tiles      = tiles;
+    source->tileSize   = tileSize;
+    source->paletteId  = paletteId;
+}
+
+// Frames built from the same OAM entries, tiles and palette look the same, wherever their anchor is.
+static bool
+atlasSourcesLookSame(AtlasSource* a, AtlasSource* b) {
+    return (a->oamData == b->oamData) && (a->tiles == b->tiles) && (a->tileSize == b->tileSize)
+        && (a->paletteId == b->paletteId)
+        && (a->dimensions->width == b->dimensions->width) && (a->dimensions->height == b->dimensions->height)
+        && (a->dimensions->numSubframes == b->dimensions->numSubframes);
+}
+
+static u64
+atlasHashSource(AtlasSource* source) {
+    u64 key[4] = {
+        (u64)(size_t)source->oamData,
+        (u64)(size_t)source->tiles,
+        ((u64)source->tileSize << 32) | (u32)source->paletteId,
+        ((u64)source->dimensions->width << 32) | ((u64)source->dimensions->height << 16)
+            | source->dimensions->numSubframes,
+    };
+    
+    return hash64(key, sizeof(key), 0);
+}
+
+// Packs the frames that were added since the last call onto new sheets, and writes those
+// as 'sheetName.png' (or 'sheetName_<n>.png', if it takes more than one).
+static void
+atlasFlush(ExporterContext* ctx, char* sheetName) {
+    AtlasBuilder* atlas = &ctx->atlas;
+    u32 frameCount = (u32)(atlas->frames.offset / sizeof(AtlasFrame)) - atlas->batchStart;
+    if (frameCount == 0)
+        return;
+    
+    AtlasFrame* frames   = (AtlasFrame*)atlas->frames.memory + atlas->batchStart;
+    AtlasSource* sources = atlas->sources.memory;
+    
+    MemArenaTemp flushScope = memArenaBeginTemp(&atlas->scratch);
+    
+    // Frames that look the same share one rectangle
+    AtlasRect* rects      = memArenaPushArrayNoZero(&atlas->scratch, AtlasRect, frameCount);
+    u32* rectSources      = memArenaPushArrayNoZero(&atlas->scratch, u32, frameCount);
+    u32* frameRects       = memArenaPushArrayNoZero(&atlas->scratch, u32, frameCount);
+    u32 rectCount = 0;
+    
+    u32 slotCount = 1024;
+    while (slotCount < frameCount * 2)
+        slotCount *= 2;
+    u32* slots = memArenaPushArray(&atlas->scratch, u32, slotCount);
+    
+    for (u32 i = 0; i < frameCount; i++) {
+        u32 slot = (u32)atlasHashSource(&sources[i]) & (slotCount - 1);
+        
+        for (; slots[slot] != 0; slot = (slot + 1) & (slotCount - 1)) {
+            if (atlasSourcesLookSame(&sources[rectSources[slots[slot] - 1]], &sources[i]))
+                break;
+        }
+        
+        if (slots[slot] == 0) {
+            rects[rectCount].width  = frames[i].width;
+            rects[rectCount].height = frames[i].height;
+            rectSources[rectCount]  = i;
+            slots[slot] = ++rectCount;
+        }
+        
+        frameRects[i] = slots[slot] - 1;
+    }
+    
+    u32 firstSheetId = (u32)(atlas->sheets.offset / sizeof(AtlasSheet));
+    u32 sheetCount = atlasPack(&atlas->scratch, &atlas->sheets, rects, rectCount,
+                               atlasGetSheetWidth(rects, rectCount), firstSheetId);
+    
+    char filePath[256];
+    MemArena* arena = &ctx->fullTileImage;
+    
+    for (u32 sheetId = firstSheetId; sheetId < firstSheetId + sheetCount; sheetId++) {
+        AtlasSheet* sheet = (AtlasSheet*)atlas->sheets.memory + sheetId;
+        MemArenaTemp sheetScope = memArenaBeginTemp(arena);
+        
+        RgbaCanvas sheetCanvas;
+        rgbaCanvasInit(&sheetCanvas, arena, sheet->width, sheet->height);
+        
+        // Every frame gets rendered on its own first, so double-sized objects can't reach into their neighbours.
+        for (u32 r = 0; r < rectCount; r++) {
+            if (rects[r].sheetId != sheetId)
+                continue;
+            
+            AtlasSource* source = &sources[rectSources[r]];
+            MemArenaTemp frameScope = memArenaBeginTemp(arena);
+            
+            RgbaCanvas frameCanvas;
+            rgbaCanvasInit(&frameCanvas, arena, rects[r].width, rects[r].height);
+            renderFrame(ctx, arena, &frameCanvas, source->dimensions, source->oamData, source->tiles,
+                        source->tileSize, source->paletteId, source->dimensions->offsetX, source->dimensions->offsetY);
+            
+            for (u32 y = 0; y < frameCanvas.height; y++) {
+                memcpy(&sheetCanvas.pixels[(rects[r].y + y) * sheetCanvas.width + rects[r].x],
+                       &frameCanvas.pixels[y * frameCanvas.width], frameCanvas.width * sizeof(u32));
+            }
+            
+            memArenaEndTemp(frameScope);
+        }
+        
+        if (sheetCount == 1)
+            sprintf(sheet->fileName, "%s.png", sheetName);
+        else
+            sprintf(sheet->fileName, "%s_%u.png", sheetName, sheetId - firstSheetId);
+        
+        u8* png;
+        u64 pngSize = pngEncodeRgba(arena, &png, sheetCanvas.pixels, sheetCanvas.width, sheetCanvas.height);
+        sprintf(filePath, "%s/%s", atlas->path, sheet->fileName);
+        manifestWriteFile(&ctx->manifest, filePath, png, pngSize);
+        
+        memArenaEndTemp(sheetScope);
+    }
+    
+    for (u32 i = 0; i < frameCount; i++) {
+        AtlasRect* rect = &rects[frameRects[i]];
+        frames[i].sheetId = rect->sheetId;
+        frames[i].x       = rect->x;
+        frames[i].y       = rect->y;
+    }
+    
+    memArenaEndTemp(flushScope);
+    
+    atlas->batchStart += frameCount;
+    memArenaRestore(&atlas->sources, 0);
+}
+
+static void
+atlasWriteIndex(ExporterContext* ctx) {
+    AtlasBuilder* atlas = &ctx->atlas;
+    MemArenaTemp indexScope = memArenaBeginTemp(&ctx->output);
+    
+    u8* index;
+    u64 indexSize = atlasIndexBuild(&ctx->output, &index,
+                                    atlas->sheets.memory, (u32)(atlas->sheets.offset / sizeof(AtlasSheet)),
+                                    atlas->frames.memory, (u32)(atlas->frames.offset / sizeof(AtlasFrame)));
+    manifestWriteFile(&ctx->manifest, addToPath(&ctx->paths, atlas->path, "atlas.index"), index, indexSize);
+    
+    memArenaEndTemp(indexScope);
+}
+
+#if BENCHMARK_TILE_CONVERT
+static void
+benchmarkTileConvert(FrameStore* store) {
+    const int runs = 256;
+    u64 pixelCount = 0;
+    u64 largestFrame = 0;
+    
+    for (u32 i = 0; i < store->frameCount; i++) {
+        StoredFrame* frame = &store->frames[i];
+        if ((frame->size == 0) || (frame->widthInTiles == 0))
+            continue;
+        
+        u32 tileCount = frame->size / frame->tileSize;
+        u32 heightInTiles = (tileCount + frame->widthInTiles - 1) / frame->widthInTiles;
+        u64 framePixels = (u64)heightInTiles * frame->widthInTiles * TILE_WIDTH * TILE_WIDTH;
+        
+        pixelCount += framePixels;
+        largestFrame = Max(largestFrame, framePixels);
+    }
+    
+    MemArena arena;
+    memArenaInit(&arena);
+    u8* expected = memArenaPushArray(&arena, u8, largestFrame);
+    u8* pixels   = memArenaPushArray(&arena, u8, largestFrame);
+    
+    fprintf(stderr, "Tile conversion benchmark (%d runs over %u frames, %.2f MPixels):\n",
+            runs, store->frameCount, pixelCount / 1e6);
+    
+    for (TileKernel kernel = 0; kernel < TILE_KERNEL_COUNT; kernel++) {
+        if (!tileKernelIsSupported(kernel)) {
+            fprintf(stderr, "  %-6s: not supported\n", tileKernelNames[kernel]);
+            continue;
+        }
+        
+        double start = getWallClockSeconds();
+        for (int run = 0; run < runs; run++) {
+            for (u32 i = 0; i < store->frameCount; i++) {
+                StoredFrame* frame = &store->frames[i];
+                if ((frame->size == 0) || (frame->widthInTiles == 0))
+                    continue;
+                
+                tilesToIndexedWithKernel(kernel, (u8*)store->data.memory + frame->dataOffset,
+                                         frame->size / frame->tileSize, frame->widthInTiles, frame->tileSize, pixels);
+            }
+        }
+        double seconds = getWallClockSeconds() - start;
+        
+        u32 mismatches = 0;
+        for (u32 i = 0; i < store->frameCount; i++) {
+            StoredFrame* frame = &store->frames[i];
+            if ((frame->size == 0) || (frame->widthInTiles == 0))
+                continue;
+            
+            u8* tiles = (u8*)store->data.memory + frame->dataOffset;
+            u32 tileCount = frame->size / frame->tileSize;
+            u32 heightInTiles = (tileCount + frame->widthInTiles - 1) / frame->widthInTiles;
+            u64 framePixels = (u64)heightInTiles * frame->widthInTiles * TILE_WIDTH * TILE_WIDTH;
+            
+            memset(expected, 0, framePixels);
+            memset(pixels, 0, framePixels);
+            tilesToIndexedWithKernel(TILE_KERNEL_SCALAR, tiles, tileCount, frame->widthInTiles, frame->tileSize,
+                                     expected);
+            tilesToIndexedWithKernel(kernel, tiles, tileCount, frame->widthInTiles, frame->tileSize, pixels);
+            
+            if (memcmp(expected, pixels, framePixels))
+                mismatches++;
+        }
+        
+        fprintf(stderr, "  %-6s: %8.3f ms/run, %7.1f MPixels/s, %u mismatching frames\n",
+                tileKernelNames[kernel], (seconds / runs) * 1000.0,
+                (pixelCount * (double)runs) / (seconds * 1e6), mismatches);
+    }
+    
+    memArenaFree(&arena);
+}
+#endif
+
+// Text file that gets put together in memory, so it can go through the manifest in one piece.
+typedef struct {
+    MemArena arena;
+    OutBuffer out;
+    char* path; // NULL prints the text to stdout
+} Document;
+
+static void
+documentBegin(Document* doc, char* path) {
+    memArenaInit(&doc->arena);
+    outBufferInitInMemory(&doc->out, &doc->arena);
+    doc->path = path;
+}
+
+static void
+documentEnd(Document* doc, Manifest* manifest) {
+    u32 length = outBufferEndInMemory(&doc->out);
+    
+    if (doc->path)
+        manifestWriteFile(manifest, doc->path, doc->out.data, length);
+    else
+        fwrite(doc->out.data, 1, length, stdout);
+    
+    memArenaFree(&doc->arena);
+}
+
+void generateSprite(ExporterContext* ctx, FrameDataInput* fdi, OutBuffer* debugComposition, OutBuffer* scriptFilestream, OutBuffer* tile_collection, OutBuffer* inc_bin, OutBuffer* frameReferences, u16 animId, char* framePath, char* previewPath, char* docsPath, char* palPath) {
+    RomView* rom = &ctx->rom;
+    SpriteTables* spriteTables = &ctx->spriteTables;
+    MemArena* fullTileImage = &ctx->fullTileImage;
+    FrameData* fds = fdi->data;
+    
+    eGame game = ctx->game;
+    
+    // Validate the tables this animation reads from once, instead of on every access.
+    SpriteOffset* dimensions = romToVirtualChecked(rom, spriteTables->dimensions[animId], fdi->frameCount * sizeof(SpriteOffset));
+    if (dimensions == NULL)
+        return;
+    
+    u32 oamEntryCount = 0;
+    for (int frameId = 0; frameId < fdi->frameCount; frameId++) {
+        // Seems like SA3 and KATAM had a different layout?
+        u8 oamIndex = (game == SA1 || game == SA2)
+            ? dimensions[frameId].oamIndex
+            : dimensions[frameId].flip;
+        
+        oamEntryCount = Max(oamEntryCount, oamIndex + dimensions[frameId].numSubframes);
+    }
+    
+    u16* oamDataStart = romToVirtualChecked(rom, spriteTables->oamData[animId], oamEntryCount * 3 * sizeof(u16));
+    if (oamDataStart == NULL)
+        return;
+    
+    char filePath[256];
+    char filenameNoExt[64];
+    char fileName[sizeof(filenameNoExt) + 8];
+#if OUTPUT_FRAME_PREVIEWS
+    char previewFilePath[256];
+#endif
+    
+    for (int frameId = 0; frameId < fdi->frameCount; frameId++) {
+        // Only one frame is held in the frame buffer at a time, to reduce memory usage
+        MemArenaTemp frameScope = memArenaBeginTemp(fullTileImage);
+        
+        FrameData *fd = &fds[frameId];
+        SpriteOffset* frameDimensions = &dimensions[frameId];
+        assert((frameDimensions->width % 8) == 0);
+        assert((frameDimensions->height % 8) == 0);
+        
+        // " X,  Y - SubCnt: [SubDim, SubPos] \n"
+        outFormat(debugComposition, "%4d: %2d, %2d  - %4d  : ",
+                animId,
+                frameDimensions->width, frameDimensions->height,
+                frameDimensions->numSubframes);
         
         u16* palette = &spriteTables->palettes[fd->paletteId * 16];
         
@@ -1572,16 +3209,33 @@ void generateSprite(u8* rom, MemArena* fullTileImage, SpriteTables* spriteTables
         
         const char* fileExt = (tileSize == TILE_SIZE_4BPP) ? "4bpp" : "8bpp";
         sprintf(filenameNoExt, "a%04d_f%03d", animId, frameId);
-        sprintf(filePath, "%s/%s.%s",
-                framePath, filenameNoExt, fileExt);
+        sprintf(fileName, "%s.%s", filenameNoExt, fileExt);
+        sprintf(filePath, "%s/%s",
+                framePath, fileName);
+        
+        u8* image = NULL;
+        long fullFrameSize = 0;
         
         u64 arenaReserveLength = (frameDimensions->width*frameDimensions->height)*tileSize;
         if(arenaReserveLength == 0)
             goto skipGeneration;
         
-        u8* image = memArenaReserve(fullTileImage, arenaReserveLength);
+        // Make sure all the tiles the sub-frames copy from are inside the ROM
+        u32 tileCount = 0;
+        for (int subFrame = 0; subFrame < frameDimensions->numSubframes; subFrame++) {
+            OamSplit* oamSubFrame = (OamSplit*)&((u16*)frameOamData)[subFrame * 3];
+            s8Vec2D sizes = sOamTileSizes[oamSubFrame->shape][oamSubFrame->size];
+            
+            tileCount = Max(tileCount, oamSubFrame->tileNum + sizes.x * sizes.y);
+        }
+        
+        if (!romViewContains(rom, tiles, tileCount * tileSize)) {
+            fprintf(stderr, "WARNING: Tiles of frame %d of animation %d are outside of the ROM, skipping it.\n", frameId, animId);
+            goto skipGeneration;
+        }
+        
+        image = memArenaReserve(fullTileImage, arenaReserveLength);
         
-        long fullFrameSize = 0;
         for (int subFrame = 0; subFrame < frameDimensions->numSubframes; subFrame++) {
             // MSVC doesn't support the regular "packed" attribute of GCC.
             // We have to work around that with this cast...
@@ -1612,44 +3266,72 @@ void generateSprite(u8* rom, MemArena* fullTileImage, SpriteTables* spriteTables
                 fullFrameSize += subFrameRowSize;
             }
             
-            fprintf(debugComposition, "(%2d, %2d) => (%3d, %3d)",
+            outFormat(debugComposition, "(%2d, %2d) => (%3d, %3d)",
                     sizes.x * TILE_WIDTH, sizes.y * TILE_WIDTH,
                     subPos.x, subPos.y);
             
             // Left-bound padding
             if(subFrame + 1 < frameDimensions->numSubframes)
-                fprintf(debugComposition, "\n%*s", 25, "");
+                outFormat(debugComposition, "\n%*s", 25, "");
             
         }
-        fprintf(debugComposition, "\n");
+        outChar(debugComposition, '\n');
         
-        skipGeneration:
-        if (!wasFrameIndexed(animId, tiles)) {
-            indexFrame(tiles);
-            
-            FILE* frameFile = fopen(filePath, "wb");
-            
-            if(frameFile) {
-                if(image)
-                    fwrite(image, fullFrameSize, 1, frameFile);
-                
-                fclose(frameFile);
+        if (ctx->atlas.mode != ATLAS_OFF) {
+            atlasAddFrame(&ctx->atlas, animId, frameId, frameDimensions, frameOamData, tiles, tileSize, fd->paletteId);
+        } else {
+#if OUTPUT_FRAME_PREVIEWS
+            sprintf(previewFilePath, "%s/%s.png", previewPath, filenameNoExt);
+            writeFramePreview(ctx, previewFilePath, frameDimensions, frameOamData, tiles, tileSize, fd->paletteId);
+#endif
+        }
+        
+        skipGeneration:;
+        u32 frameSize = (image) ? fullFrameSize : 0;
+        int cmdTileWidth = frameDimensions->width / TILE_WIDTH;
+        
+        // Frames without any tiles get a file of their own, there's nothing to share
+        bool canBeShared = (image != NULL) && (frameSize > 0);
+        u64 frameHash = 0;
+        StoredFrame* sameFrame = (canBeShared)
+            ? frameStoreFind(&ctx->frameStore, image, frameSize, tileSize, &frameHash)
+            : NULL;
+        
+        if (sameFrame) {
+            // The frame's tiles are already in another file, but that one can have another palette or width.
+            // Only the tiles get shared, the frame still gets a PNG with its own.
+            outFormat(frameReferences, "%s %s\n", filenameNoExt, sameFrame->fileName);
+#if OUTPUT_PNG
+            if (image && (cmdTileWidth > 0) && (ctx->atlas.mode == ATLAS_OFF)) {
+                sprintf(filePath, "%s/%s.png", framePath, filenameNoExt);
+                writeFramePng(ctx, filePath, image, frameSize, tileSize, cmdTileWidth, fd->paletteId);
             }
+#endif
+        } else {
+            bool wasWritten = manifestWriteFile(&ctx->manifest, filePath, image, frameSize);
+            bool wasPngWritten = TRUE;
             /* Add this file to the output- and tile-generation scripts */
 #if 1
-            int cmdTileWidth = frameDimensions->width / TILE_WIDTH;
-            
-            if(frameFile && cmdTileWidth > 0) {
+            // With sprite sheets, the frames don't get images of their own
+            if(wasWritten && cmdTileWidth > 0 && (ctx->atlas.mode == ATLAS_OFF)) {
+#if OUTPUT_PNG
+                if (image) {
+                    sprintf(filePath, "%s/%s.png", framePath, filenameNoExt);
+                    wasPngWritten = writeFramePng(ctx, filePath, image, frameSize, tileSize, cmdTileWidth,
+                                                  fd->paletteId);
+                }
+#else
                 // Write gbagfx command for conversion script
-                fprintf(scriptFilestream, "./gbagfx %s/%s.%s %s/%s.png -object -palette %s/pal_%03d.gbapal -width %d\n",
+                outFormat(scriptFilestream, "./gbagfx %s/%s.%s %s/%s.png -object -palette %s/pal_%03d.gbapal -width %d\n",
                         framePath, filenameNoExt, fileExt,
                         framePath, filenameNoExt,
                         palPath, fd->paletteId,
                         cmdTileWidth);
+#endif
                 
                 // PNG -> 4BPP script
                 // TODO: Split 4bpp and 8bpp into separate files
-                fprintf(tile_collection, "./tools/gbagfx/gbagfx %s/%s.png %s/%s.%s -width %d\n",
+                outFormat(tile_collection, "./tools/gbagfx/gbagfx %s/%s.png %s/%s.%s -width %d\n",
                         framePath, filenameNoExt,
                         framePath, filenameNoExt, fileExt,
                         cmdTileWidth);
@@ -1658,154 +3340,989 @@ void generateSprite(u8* rom, MemArena* fullTileImage, SpriteTables* spriteTables
             
 #define ADD_GLOBAL_LABELS_TO_INCBIN FALSE // Can be useful for debugging!
 #if ADD_GLOBAL_LABELS_TO_INCBIN
-            fprintf(inc_bin,
+            outFormat(inc_bin,
                     ".global %s\n"
                     "%s:\n", filenameNoExt, filenameNoExt);
 #endif // ADD_GLOBAL_LABELS_TO_INCBIN
             
             // Assembly file, putting all tiles together
-            fprintf(inc_bin,
+            outFormat(inc_bin,
                     ".incbin \"%s/%s.%s\"\n",
                     framePath, filenameNoExt, fileExt);
+            
+            // Later frames only get to reference files that actually exist
+            if (canBeShared && wasWritten && wasPngWritten)
+                frameStoreAdd(&ctx->frameStore, image, frameSize, tileSize, cmdTileWidth, frameHash, fileName);
         }
+        
+        memArenaEndTemp(frameScope);
+    }
+    
+    if (ctx->atlas.mode == ATLAS_PER_ANIMATION) {
+        sprintf(filenameNoExt, "a%04d", animId);
+        atlasFlush(ctx, filenameNoExt);
     }
 }
 
 void
-generateSprites(u8* rom, DynTable* dynTable, SpriteTables* spriteTables, int animMin, int animMax,
-                char* framePath, char* docsPath, char* palettePath, char* genFramesScriptFilePath, char* gfxIncFilePath) {
+generateSprites(ExporterContext* ctx, TileInfo* tileInfo, int animMin, int animMax,
+                char* framePath, char* previewPath, char* docsPath, char* palettePath, char* genFramesScriptFilePath,
+                char* gfxIncFilePath) {
+    DynTable* dynTable = &ctx->dynTable;
+    SpriteTables* spriteTables = &ctx->spriteTables;
     
-    MemArena frameData;
-    memArenaInit(&frameData);
     FrameDataInput fdi;
     fdi.data = NULL;
+    fdi.ctx = ctx;
+    
+    CmdStatistics stats = { 0 };
     
-    FILE* spriteImagesScript = fopen(gfxIncFilePath, "w");
-    fprintf(spriteImagesScript,
-            "$(TILES_BUILDDIR)/%%.o: $(TILES_SUBDIR)/%%.s\n"
-            "	@echo $(GFX) <flags> -I sound -o $@ $<\n"
-            "	@$(AS)");
+#if OUTPUT_TILE_DEDUP_REPORT
+    TileDedupInfo tileDedup;
+    tileDedupInit(&tileDedup, &ctx->rom, spriteTables);
     
-    FILE* tile_script = fopen("obj_tiles_4bpp.sh", "w");
-    FILE* incbin = fopen("obj_tiles_4bpp.inc", "w");
+    Document tileDedupReport;
+    documentBegin(&tileDedupReport, addToPath(&ctx->paths, docsPath, "tile_dedup.csv"));
+    outLiteral(&tileDedupReport.out, "anim,get_tiles_calls,uploaded_tiles,uploaded_bytes,distinct_tiles,"
+               "exact_unique_tiles,flip_unique_tiles,flip_unique_bytes\n");
+#endif
+    
+    // Everything that needs to know about the commands of an animation gets them in one traversal
+    CmdVisitor visitors[] = {
+        { generateFrameData,       &fdi     },
+        { itGetNumTileInformation, tileInfo },
+        { itCountCommands,         &stats   },
+#if OUTPUT_TILE_DEDUP_REPORT
+        { itCountUniqueTiles,      &tileDedup },
+#endif
+    };
     
-    FILE* script = fopen(genFramesScriptFilePath, "w");
-    fprintf(script, "#!/bin/sh\n");
+    Document spriteImagesScript;
+    documentBegin(&spriteImagesScript, gfxIncFilePath);
+    outLiteral(&spriteImagesScript.out,
+               "$(TILES_BUILDDIR)/%.o: $(TILES_SUBDIR)/%.s\n"
+               "	@echo $(GFX) <flags> -I sound -o $@ $<\n"
+               "	@$(AS)");
+    documentEnd(&spriteImagesScript, &ctx->manifest);
     
-    char debugFilePathBuffer[256];
-    sprintf(debugFilePathBuffer, "%s/%s", docsPath, "Debug_FrameComposition.txt");
-    FILE* debugFile_FrameComposition = fopen(debugFilePathBuffer, "w");
-    fprintf(debugFile_FrameComposition, "--- FRAME COMPOSIITON ---\n");
-    fprintf(debugFile_FrameComposition, "FullX, FullY - SubCnt [SubDim, SubPos] \n");
+    Document tile_script, incbin, script, debugFile_FrameComposition, frameReferences;
+    documentBegin(&tile_script, "obj_tiles_4bpp.sh");
+    documentBegin(&incbin, "obj_tiles_4bpp.inc");
     
+    documentBegin(&script, genFramesScriptFilePath);
+    outLiteral(&script.out, "#!/bin/sh\n");
     
-    // Scratch-memory for one full frame that should be output.
-    MemArena fullTileImage;
-    memArenaInit(&fullTileImage);
+    documentBegin(&debugFile_FrameComposition, addToPath(&ctx->paths, docsPath, "Debug_FrameComposition.txt"));
+    outLiteral(&debugFile_FrameComposition.out, "--- FRAME COMPOSIITON ---\n");
+    outLiteral(&debugFile_FrameComposition.out, "FullX, FullY - SubCnt [SubDim, SubPos] \n");
+    
+    // Frames that didn't get a file of their own, and the file with the same tiles
+    documentBegin(&frameReferences, addToPath(&ctx->paths, docsPath, "frame_references.txt"));
     
     for (int animId = animMin; animId < animMax; animId++) {
         if (spriteTables->animations == 0)
             break;
         
+        // Frame data is only needed while the sprites of this animation are generated
+        MemArenaTemp animScope = memArenaBeginTemp(&ctx->frameData);
+        
+        // Tile/palette state only carries over from animations that display frames
+        FrameData prevFdBuffer = ctx->fdBuffer;
+        
+        fdi.data = NULL;
         fdi.frameCount = 0;
-        iterateAllCommands(stdout, dynTable, animId, animId + 1, getAnimFrameCount, &fdi.frameCount);
+        iterateAllCommandsFused(stdout, dynTable, animId, animId + 1, visitors, SizeofArray(visitors));
+        
+        if (fdi.frameCount == 0)
+            ctx->fdBuffer = prevFdBuffer;
+        
+#if OUTPUT_TILE_DEDUP_REPORT
+        tileDedupEndAnimation(&tileDedup, &tileDedupReport.out, animId);
+#endif
         
         if (fdi.frameCount > 0) {
-            fdi.data = memArenaReserve(&frameData, fdi.frameCount * sizeof(FrameData));
-            iterateAllCommands(stdout, dynTable, animId, animId + 1, generateFrameData, &fdi);
+            generateSprite(ctx, &fdi, &debugFile_FrameComposition.out, &script.out, &tile_script.out, &incbin.out,
+                           &frameReferences.out, animId, framePath, previewPath, docsPath, palettePath);
+        }
+        
+        memArenaEndTemp(animScope);
+    }
+    
+    // Summary of what the visitors collected
+    Document debugFile_Statistics;
+    documentBegin(&debugFile_Statistics, addToPath(&ctx->paths, docsPath, "Debug_CommandStatistics.txt"));
+    OutBuffer* statsOut = &debugFile_Statistics.out;
+    
+    outLiteral(statsOut, "--- COMMAND STATISTICS ---\n");
+    outFormat(statsOut, "Commands:         %u\n", stats.numCommands);
+    outFormat(statsOut, "Display duration: %u frames\n", stats.numDisplayedFrames);
+    outFormat(statsOut, "GetTiles calls:   %u\n", tileInfo->numGetTileCalls);
+    outFormat(statsOut, "4bpp tiles used:  %u\n", tileInfo->numTileIndices);
+    outLiteral(statsOut, "\n");
+    
+    for (int i = 0; i < SizeofArray(animCommands); i++)
+        outFormat(statsOut, "%-26s %u\n", animCommands[i], stats.numPerCommand[i]);
+    
+#if OUTPUT_TILE_DEDUP_REPORT
+    // Every tile of the ROM only counts once here
+    TileDedupCounts* total = &tileDedup.total;
+    outLiteral(statsOut, "\n");
+    outFormat(statsOut, "Uploaded tiles:    %u (%u bytes)\n", total->uploadedTiles, total->uploadedBytes);
+    outFormat(statsOut, "Distinct tiles:    %u\n", total->distinctTiles);
+    outFormat(statsOut, "Exact unique:      %u\n", total->exactTiles);
+    outFormat(statsOut, "Unique with flips: %u (%u bytes)\n", total->uniqueTiles, total->uniqueBytes);
+    
+    documentEnd(&tileDedupReport, &ctx->manifest);
+    tileDedupFree(&tileDedup);
+#endif
+    
+    documentEnd(&debugFile_Statistics, &ctx->manifest);
+    documentEnd(&debugFile_FrameComposition, &ctx->manifest);
+    documentEnd(&script, &ctx->manifest);
+    documentEnd(&tile_script, &ctx->manifest);
+    documentEnd(&incbin, &ctx->manifest);
+    documentEnd(&frameReferences, &ctx->manifest);
+    
+    if (ctx->atlas.mode == ATLAS_PER_GAME)
+        atlasFlush(ctx, "atlas");
+    if (ctx->atlas.mode != ATLAS_OFF)
+        atlasWriteIndex(ctx);
+}
+
+// Looks up what's needed to draw frame 'frameIndex' of an animation with the tiles at 'tileIndex',
+// with the same checks as 'generateSprite'. Returns FALSE if there's nothing to draw.
+static bool
+resolveFrame(ExporterContext* ctx, u16 animId, u16 frameIndex, s32 tileIndex, s32 paletteId, AtlasSource* source) {
+    RomView* rom = &ctx->rom;
+    SpriteTables* spriteTables = &ctx->spriteTables;
+    
+    RomPointer frameDimensions = spriteTables->dimensions[animId] + frameIndex * sizeof(SpriteOffset);
+    SpriteOffset* dimensions = romToVirtualChecked(rom, frameDimensions, sizeof(SpriteOffset));
+    if ((dimensions == NULL) || (dimensions->width == 0) || (dimensions->height == 0))
+        return FALSE;
+    
+    // Seems like SA3 and KATAM had a different layout?
+    u8 oamIndex = (ctx->game == SA1 || ctx->game == SA2)
+        ? dimensions->oamIndex
+        : dimensions->flip;
+    
+    OamSplit* oamData = romToVirtualChecked(rom, spriteTables->oamData[animId] + oamIndex * 3 * sizeof(u16),
+                                            dimensions->numSubframes * 3 * sizeof(u16));
+    if (oamData == NULL)
+        return FALSE;
+    
+    u32 tileSize = (tileIndex & 0x80000000) ? TILE_SIZE_8BPP : TILE_SIZE_4BPP;
+    u8* tiles = (tileIndex & 0x80000000)
+        ? &spriteTables->tiles_8bpp[((u32)tileIndex & 0x7FFFFFFF) * tileSize]
+        : &spriteTables->tiles_4bpp[(u32)tileIndex * tileSize];
+    
+    u32 tileCount = 0;
+    for (u32 subFrame = 0; subFrame < dimensions->numSubframes; subFrame++) {
+        OamSplit* oam = (OamSplit*)&((u16*)oamData)[subFrame * 3];
+        
+        // The 4th shape is prohibited, so this isn't OAM data
+        if (oam->shape >= SizeofArray(sOamTileSizes))
+            return FALSE;
+        
+        s8Vec2D sizes = sOamTileSizes[oam->shape][oam->size];
+        tileCount = Max(tileCount, oam->tileNum + sizes.x * sizes.y);
+    }
+    
+    if (!romViewContains(rom, tiles, tileCount * tileSize))
+        return FALSE;
+    
+    source->dimensions = dimensions;
+    source->oamData    = oamData;
+    source->tiles      = tiles;
+    source->tileSize   = tileSize;
+    source->paletteId  = paletteId;
+    return TRUE;
+}
+
+// A frame that got rendered for an animated preview, at its own size (like its still preview)
+typedef struct {
+    AtlasSource source;
+    u32* pixels;
+} PreviewFrame;
+
+typedef struct {
+    ExporterContext* ctx;
+    char* previewPath;
+    u32 animCount;
+    volatile u32* nextAnim;
+    
+    u32 variantsWritten;
+    u32 framesRendered;
+    
+    // Frames rendered for the current animation, which all of its variants share
+    MemArena frames;      // PreviewFrame
+    MemArena framePixels;
+    MemArena scratch;     // Playback, canvases and PNG of one variant at a time
+} PreviewThread;
+
+// Index of the rendered frame that looks like 'source', after rendering it if there is none yet
+static u32
+findOrRenderPreviewFrame(PreviewThread* thread, AtlasSource* source) {
+    PreviewFrame* frames = thread->frames.memory;
+    u32 frameCount = (u32)(thread->frames.offset / sizeof(PreviewFrame));
+    
+    for (u32 i = 0; i < frameCount; i++) {
+        if (atlasSourcesLookSame(&frames[i].source, source))
+            return i;
+    }
+    
+    PreviewFrame* frame = memArenaPushArrayNoZero(&thread->frames, PreviewFrame, 1);
+    SpriteOffset* dimensions = source->dimensions;
+    
+    RgbaCanvas canvas;
+    rgbaCanvasInit(&canvas, &thread->framePixels, dimensions->width, dimensions->height);
+    renderFrame(thread->ctx, &thread->scratch, &canvas, dimensions, source->oamData, source->tiles, source->tileSize,
+                source->paletteId, dimensions->offsetX, dimensions->offsetY);
+    
+    frame->source = *source;
+    frame->pixels = canvas.pixels;
+    thread->framesRendered++;
+    
+    return frameCount;
+}
+
+static void
+writeAnimatedPreview(PreviewThread* thread, u16 animId, u16 variantId) {
+    ExporterContext* ctx = thread->ctx;
+    MemArena* scratch = &thread->scratch;
+    MemArenaTemp variantScope = memArenaBeginTemp(scratch);
+    
+    AnimTimeline timeline;
+    u32 segmentCount = animTimelineBuild(scratch, &ctx->dynTable, ctx->animTable.entryCount, animId, variantId,
+                                         &timeline);
+    AnimTimelineSegment* segments = timeline.segments;
+    
+    // Rendered frame of every segment (-1 if there's nothing to draw),
+    // and the area all of them cover, relative to the anchor.
+    s32* segmentFrames = memArenaPushArrayNoZero(scratch, s32, segmentCount);
+    s32 left = 0, top = 0, right = 0, bottom = 0;
+    bool isEmpty = TRUE;
+    
+    for (u32 i = 0; i < segmentCount; i++) {
+        AnimVmState* state = &segments[i].state;
+        AtlasSource source;
+        segmentFrames[i] = -1;
+        
+        if (!state->hasTiles
+            || !resolveFrame(ctx, state->animId, state->frameIndex, state->tileIndex, state->paletteId, &source)) {
+            continue;
+        }
+        
+        segmentFrames[i] = findOrRenderPreviewFrame(thread, &source);
+        
+        SpriteOffset* dimensions = source.dimensions;
+        s32 frameLeft = -dimensions->offsetX;
+        s32 frameTop  = -dimensions->offsetY;
+        
+        if (isEmpty) {
+            left   = frameLeft;
+            top    = frameTop;
+            right  = frameLeft + dimensions->width;
+            bottom = frameTop  + dimensions->height;
+            isEmpty = FALSE;
+        } else {
+            left   = Min(left,   frameLeft);
+            top    = Min(top,    frameTop);
+            right  = Max(right,  frameLeft + dimensions->width);
+            bottom = Max(bottom, frameTop  + dimensions->height);
+        }
+    }
+    
+    u32 width  = right - left;
+    u32 height = bottom - top;
+    
+    if (isEmpty) {
+        memArenaEndTemp(variantScope);
+        return;
+    }
+    
+    if ((width > ANIM_PREVIEW_MAX_SIZE) || (height > ANIM_PREVIEW_MAX_SIZE)) {
+        fprintf(stderr, "WARNING: Variant %d of animation %d needs a %ux%u preview, skipping it.\n",
+                variantId, animId, width, height);
+        memArenaEndTemp(variantScope);
+        return;
+    }
+    
+    // A loop back to the start repeats the whole preview.
+    // Other loops get played ANIM_PREVIEW_LOOP_COUNT times, variants that end stop at their last frame.
+    u32 playCount = (timeline.kind == ANIM_TIMELINE_ENDS) ? 1 : 0;
+    u32 loopLength = segmentCount - timeline.loopSegment;
+    u32 stepCount = segmentCount;
+    
+    if ((timeline.kind == ANIM_TIMELINE_LOOPS) && (timeline.loopSegment > 0))
+        stepCount += (ANIM_PREVIEW_LOOP_COUNT - 1) * loopLength;
+    
+    // Every rendered frame gets put onto a canvas of the whole area once, steps showing it share that canvas.
+    PreviewFrame* frames = thread->frames.memory;
+    u32 frameCount = (u32)(thread->frames.offset / sizeof(PreviewFrame));
+    u32** canvases = memArenaPushArray(scratch, u32*, frameCount);
+    u32* emptyCanvas = NULL;
+    
+    ApngFrame* apngFrames = memArenaPushArrayNoZero(scratch, ApngFrame, stepCount);
+    u32 apngFrameCount = 0;
+    u32 totalTicks = 0;
+    
+    for (u32 step = 0; (step < stepCount) && (totalTicks < ANIM_PREVIEW_MAX_TICKS); step++) {
+        u32 i = (step < segmentCount) ? step : timeline.loopSegment + (step - segmentCount) % loopLength;
+        u32 endTick = (i + 1 < segmentCount) ? segments[i + 1].startTick : timeline.totalTicks;
+        u32 ticks = Min(endTick - segments[i].startTick, ANIM_PREVIEW_MAX_TICKS - totalTicks);
+        
+        s32 frameId = segmentFrames[i];
+        u32** canvas = (frameId >= 0) ? &canvases[frameId] : &emptyCanvas;
+        
+        if (*canvas == NULL) {
+            *canvas = memArenaPushArray(scratch, u32, width * height);
             
-            generateSprite(rom, &fullTileImage, spriteTables, &fdi, debugFile_FrameComposition, script, tile_script, incbin, animId, framePath, docsPath, palettePath);
+            if (frameId >= 0) {
+                PreviewFrame* frame = &frames[frameId];
+                SpriteOffset* dimensions = frame->source.dimensions;
+                u32 x = -left - dimensions->offsetX;
+                u32 y = -top  - dimensions->offsetY;
+                
+                for (u32 row = 0; row < dimensions->height; row++) {
+                    memcpy(&(*canvas)[(y + row) * width + x], &frame->pixels[row * dimensions->width],
+                           dimensions->width * sizeof(u32));
+                }
+            }
         }
+        
+        apngFrames[apngFrameCount].pixels = *canvas;
+        apngFrames[apngFrameCount].delay  = (u16)ticks;
+        apngFrameCount++;
+        totalTicks += ticks;
     }
     
-    memArenaFree(&fullTileImage);
+    u8* png;
+    u64 pngSize = pngEncodeAnimated(scratch, &png, apngFrames, apngFrameCount, width, height, 60, playCount);
+    
+    char filePath[256];
+    sprintf(filePath, "%s/a%04d_v%02d.png", thread->previewPath, animId, variantId);
+    manifestWriteFile(&ctx->manifest, filePath, png, pngSize);
+    thread->variantsWritten++;
+    
+    memArenaEndTemp(variantScope);
+}
+
+// Write the previews of one animation after another, until none are left
+static void
+writeAnimatedPreviewsThread(void* params) {
+    PreviewThread* thread = params;
+    DynTable* dynTable = &thread->ctx->dynTable;
     
-    fclose(debugFile_FrameComposition);
-    fclose(script);
-    fclose(tile_script);
-    fclose(spriteImagesScript);
+    for (;;) {
+        u32 animId = atomicFetchAddU32(thread->nextAnim, 1);
+        if (animId >= thread->animCount)
+            break;
+        
+        memArenaRestore(&thread->frames, 0);
+        memArenaRestore(&thread->framePixels, 0);
+        
+        for (u16 variantId = 0; variantId < dynTable->variantCounts[animId]; variantId++)
+            writeAnimatedPreview(thread, animId, variantId);
+    }
+}
+
+static void
+writeAnimatedPreviews(ExporterContext* ctx, char* previewPath) {
+#if BENCHMARK_PREVIEWS
+    double previewStart = getWallClockSeconds();
+#endif
+    DynTable* dynTable = &ctx->dynTable;
+    u32 animCount = ctx->animTable.entryCount;
+    
+    // The threads can't grow the manifest's list of files themselves.
+    u32 variantCount = 0;
+    for (u32 animId = 0; animId < animCount; animId++)
+        variantCount += dynTable->variantCounts[animId];
+    manifestReserve(&ctx->manifest, variantCount);
+    
+    u32 threadCount = (PREVIEW_THREAD_COUNT > 0) ? PREVIEW_THREAD_COUNT : getProcessorCount();
+    threadCount = Min(threadCount, MAX_THREADS);
+    threadCount = Max(threadCount, 1);
+    
+    MemArena scratch;
+    memArenaInit(&scratch);
+    
+    PreviewThread* threads = memArenaPushArray(&scratch, PreviewThread, threadCount);
+    volatile u32 nextAnim = 0;
+    
+    for (u32 i = 0; i < threadCount; i++) {
+        PreviewThread* thread = &threads[i];
+        thread->ctx = ctx;
+        thread->previewPath = previewPath;
+        thread->animCount = animCount;
+        thread->nextAnim = &nextAnim;
+        
+        memArenaInit(&thread->frames);
+        memArenaInit(&thread->framePixels);
+        memArenaInit(&thread->scratch);
+    }
+    
+    runThreads(writeAnimatedPreviewsThread, threads, sizeof(PreviewThread), threadCount);
+    
+    u32 variantsWritten = 0;
+    u32 framesRendered = 0;
+    for (u32 i = 0; i < threadCount; i++) {
+        variantsWritten += threads[i].variantsWritten;
+        framesRendered  += threads[i].framesRendered;
+        
+        memArenaFree(&threads[i].frames);
+        memArenaFree(&threads[i].framePixels);
+        memArenaFree(&threads[i].scratch);
+    }
+    memArenaFree(&scratch);
+    
+#if BENCHMARK_PREVIEWS
+    fprintf(stderr, "Writing animated previews: %.3f ms (%u variants, %u frames rendered, %u threads)\n",
+            (getWallClockSeconds() - previewStart) * 1000.0, variantsWritten, framesRendered, threadCount);
+#endif
+}
+
+// Plays every variant with the VM and puts all of their timelines into 'variants' and 'segments'.
+// Aliases get timelines of their own, since they show their own frames.
+static void
+buildAnimationTimelines(ExporterContext* ctx, MemArena* variants, MemArena* segments) {
+    DynTable* dynTable = &ctx->dynTable;
+    u32 animCount = ctx->animTable.entryCount;
+    
+    for (u32 animId = 0; animId < animCount; animId++) {
+        for (u16 variantId = 0; variantId < dynTable->variantCounts[animId]; variantId++) {
+            u32 firstSegment = (u32)(segments->offset / sizeof(AnimTimelineSegment));
+            
+            // The segments of every timeline end up right behind the ones of the previous one
+            AnimTimeline timeline;
+            animTimelineBuild(segments, dynTable, animCount, animId, variantId, &timeline);
+            
+            AnimTimelineVariant* variant = memArenaPushArrayNoZero(variants, AnimTimelineVariant, 1);
+            variant->animId           = animId;
+            variant->variantId        = variantId;
+            variant->firstSegment     = firstSegment;
+            variant->segmentCount     = timeline.segmentCount;
+            variant->totalTicks       = timeline.totalTicks;
+            variant->loopSegment      = timeline.loopSegment;
+            variant->kind             = timeline.kind;
+            variant->loopTileBytes    = timeline.loopTileBytes;
+            variant->loopPaletteBytes = timeline.loopPaletteBytes;
+        }
+    }
+}
+
+#if OUTPUT_ANIMATION_TIMELINES
+static void
+writeAnimationTimelines(ExporterContext* ctx, char* filePath, MemArena* variants, MemArena* segments) {
+    MemArenaTemp fileScope = memArenaBeginTemp(&ctx->output);
+    
+    u8* file;
+    u64 fileSize = animTimelineFileBuild(&ctx->output, &file,
+                                         variants->memory, (u32)(variants->offset / sizeof(AnimTimelineVariant)),
+                                         segments->memory, (u32)(segments->offset / sizeof(AnimTimelineSegment)));
+    manifestWriteFile(&ctx->manifest, filePath, file, fileSize);
+    
+    memArenaEndTemp(fileScope);
+}
+#endif
+
+#if OUTPUT_DMA_REPORT
+// What the frame changes of a variant copy, once it got going
+typedef struct {
+    u16 animId;
+    u16 variantId;
+    u32 peakBytes;     // Most bytes before a single frame
+    u32 peakTick;      // Where that frame starts
+    u32 framesOverBudget;
+    u64 cycleBytes;    // Over the loop, or the whole variant if it doesn't loop
+    u32 cycleTicks;
+} DmaVariantLoad;
+
+static double
+dmaBytesPerTick(const DmaVariantLoad* load) {
+    return (double)load->cycleBytes / load->cycleTicks;
+}
+
+// Most bytes in a single frame first, then most bytes per tick
+static int
+compareDmaPeak(const void* _a, const void* _b) {
+    const DmaVariantLoad* a = (const DmaVariantLoad*)_a;
+    const DmaVariantLoad* b = (const DmaVariantLoad*)_b;
+    
+    if (a->peakBytes != b->peakBytes)
+        return (a->peakBytes < b->peakBytes) ? 1 : -1;
+    if (dmaBytesPerTick(a) != dmaBytesPerTick(b))
+        return (dmaBytesPerTick(a) < dmaBytesPerTick(b)) ? 1 : -1;
+    
+    return (a < b) ? -1 : (a > b);
+}
+
+// Most bytes per tick first, then most bytes in a single frame
+static int
+compareDmaAverage(const void* _a, const void* _b) {
+    const DmaVariantLoad* a = (const DmaVariantLoad*)_a;
+    const DmaVariantLoad* b = (const DmaVariantLoad*)_b;
+    
+    if (dmaBytesPerTick(a) != dmaBytesPerTick(b))
+        return (dmaBytesPerTick(a) < dmaBytesPerTick(b)) ? 1 : -1;
+    if (a->peakBytes != b->peakBytes)
+        return (a->peakBytes < b->peakBytes) ? 1 : -1;
+    
+    return (a < b) ? -1 : (a > b);
+}
+
+static void
+printWorstDmaLoads(OutBuffer* out, DmaVariantLoad* loads, u32 loadCount) {
+    for (u32 i = 0; i < Min(loadCount, DMA_REPORT_WORST_COUNT); i++) {
+        DmaVariantLoad* load = &loads[i];
+        outFormat(out, "  a%04d_v%02d  peak %6u bytes (%5.1f%%) at tick %-5u  average %8.1f bytes/tick (%5.1f%%)\n",
+                  load->animId, load->variantId, load->peakBytes, (100.0 * load->peakBytes) / DMA_VBLANK_BUDGET_BYTES,
+                  load->peakTick, dmaBytesPerTick(load), (100.0 * dmaBytesPerTick(load)) / DMA_VBLANK_BUDGET_BYTES);
+    }
+}
+
+// Replays the timelines and writes what the game has to copy whenever a frame changes:
+// 'dma_frames.csv' has every shown frame, 'dma_variants.csv' every variant and 'dma_summary.txt' the worst ones.
+// Aliases are left out, they copy the same as the animation they point at.
+static void
+writeDmaReport(ExporterContext* ctx, char* docsPath, MemArena* variants, MemArena* segments) {
+    DynTable* dynTable = &ctx->dynTable;
+    AnimTimelineVariant* variantList = variants->memory;
+    AnimTimelineSegment* segmentList = segments->memory;
+    u32 variantCount = (u32)(variants->offset / sizeof(AnimTimelineVariant));
+    
+    MemArena loadArena;
+    memArenaInit(&loadArena);
+    DmaVariantLoad* loads = memArenaPushArray(&loadArena, DmaVariantLoad, variantCount);
+    u32 loadCount = 0;
+    
+    Document frameReport, variantReport;
+    documentBegin(&frameReport, addToPath(&ctx->paths, docsPath, "dma_frames.csv"));
+    documentBegin(&variantReport, addToPath(&ctx->paths, docsPath, "dma_variants.csv"));
+    outLiteral(&frameReport.out, "anim,variant,segment,start_tick,ticks,shown_anim,frame,tile_bytes,palette_bytes,"
+               "budget_percent\n");
+    outLiteral(&variantReport.out, "anim,variant,kind,frames,ticks,loop_start_tick,peak_bytes,peak_tick,"
+               "frames_over_budget,cycle_bytes,cycle_ticks,bytes_per_tick\n");
+    
+    const char* kindNames[] = { "ends", "loops", "truncated" };
+    u64 totalBytes = 0;
+    u64 totalTicks = 0;
+    u32 totalFrames = 0;
+    u32 totalOverBudget = 0;
+    
+    for (u32 v = 0; v < variantCount; v++) {
+        AnimTimelineVariant* variant = &variantList[v];
+        AnimTimelineSegment* timeline = &segmentList[variant->firstSegment];
+        
+        if ((dynTable->animations[variant->animId].offsetVariants < 0) || (variant->totalTicks == 0))
+            continue;
+        
+        DmaVariantLoad* load = &loads[loadCount++];
+        load->animId    = variant->animId;
+        load->variantId = variant->variantId;
+        
+        // Only the loop counts for the average, since that's what keeps running
+        bool isLooping = (variant->kind == ANIM_TIMELINE_LOOPS);
+        u32 cycleStart = isLooping ? variant->loopSegment : 0;
+        load->cycleTicks = variant->totalTicks - timeline[cycleStart].startTick;
+        
+        for (u32 i = 0; i < variant->segmentCount; i++) {
+            AnimTimelineSegment* segment = &timeline[i];
+            u32 endTick = (i + 1 < variant->segmentCount) ? timeline[i + 1].startTick : variant->totalTicks;
+            u32 bytes = segment->tileBytes + segment->paletteBytes;
+            
+            outFormat(&frameReport.out, "%u,%u,%u,%u,%u,%u,%u,%u,%u,%.1f\n", variant->animId, variant->variantId, i,
+                      segment->startTick, endTick - segment->startTick, segment->state.animId,
+                      segment->state.frameIndex, segment->tileBytes, segment->paletteBytes,
+                      (100.0 * bytes) / DMA_VBLANK_BUDGET_BYTES);
+            
+            if (bytes > load->peakBytes) {
+                load->peakBytes = bytes;
+                load->peakTick  = segment->startTick;
+            }
+            
+            load->framesOverBudget += (bytes > DMA_VBLANK_BUDGET_BYTES);
+            
+            if (i > cycleStart)
+                load->cycleBytes += bytes;
+        }
+        
+        // The loop gets into its first frame from its last one, which can copy something else
+        // than the way in from the start of the variant did.
+        if (isLooping) {
+            u32 loopBytes = variant->loopTileBytes + variant->loopPaletteBytes;
+            load->cycleBytes += loopBytes;
+            
+            if (loopBytes > load->peakBytes) {
+                load->peakBytes = loopBytes;
+                load->peakTick  = variant->totalTicks;
+            }
+            
+            load->framesOverBudget += (loopBytes > DMA_VBLANK_BUDGET_BYTES);
+        } else {
+            load->cycleBytes += timeline[0].tileBytes + timeline[0].paletteBytes;
+        }
+        
+        outFormat(&variantReport.out, "%u,%u,%s,%u,%u,%d,%u,%u,%u,%llu,%u,%.2f\n", variant->animId,
+                  variant->variantId, kindNames[variant->kind], variant->segmentCount, variant->totalTicks,
+                  isLooping ? (s32)timeline[cycleStart].startTick : -1, load->peakBytes, load->peakTick,
+                  load->framesOverBudget, load->cycleBytes, load->cycleTicks, dmaBytesPerTick(load));
+        
+        totalBytes      += load->cycleBytes;
+        totalTicks      += load->cycleTicks;
+        totalFrames     += variant->segmentCount;
+        totalOverBudget += load->framesOverBudget;
+    }
+    
+    Document summary;
+    documentBegin(&summary, addToPath(&ctx->paths, docsPath, "dma_summary.txt"));
+    OutBuffer* out = &summary.out;
+    
+    outLiteral(out, "--- DMA LOAD ---\n");
+    outFormat(out, "Budget per frame:  %u bytes (DMA_VBLANK_BUDGET_BYTES)\n", DMA_VBLANK_BUDGET_BYTES);
+    outFormat(out, "Variants:          %u\n", loadCount);
+    outFormat(out, "Shown frames:      %u\n", totalFrames);
+    outFormat(out, "Over budget:       %u frames\n", totalOverBudget);
+    
+    if (loadCount > 0) {
+        qsort(loads, loadCount, sizeof(DmaVariantLoad), compareDmaPeak);
+        outFormat(out, "Peak:              %u bytes (a%04d_v%02d)\n", loads[0].peakBytes, loads[0].animId,
+                  loads[0].variantId);
+        outFormat(out, "Average:           %.1f bytes/tick over all variants\n", (double)totalBytes / totalTicks);
+        
+        outFormat(out, "\nMost bytes in a single frame:\n");
+        printWorstDmaLoads(out, loads, loadCount);
+        
+        qsort(loads, loadCount, sizeof(DmaVariantLoad), compareDmaAverage);
+        outFormat(out, "\nMost bytes per tick while running:\n");
+        printWorstDmaLoads(out, loads, loadCount);
+    }
+    
+    documentEnd(&summary, &ctx->manifest);
+    documentEnd(&variantReport, &ctx->manifest);
+    documentEnd(&frameReport, &ctx->manifest);
+    memArenaFree(&loadArena);
+}
+#endif
+
+// Restores the decoded animations from a cache entry.
+// The name of the entry already contains ROM hash and version, but a file could've been
+// replaced or damaged since it was written, so it only gets used if its content checks out.
+static bool
+loadCachedAnimations(ExporterContext* ctx, char* cacheFilePath) {
+    AnimDb db;
+    if (!animDbOpen(&db, cacheFilePath))
+        return FALSE;
+    
+    bool isValid = (db.header->romHash == ctx->romHash)
+                && (db.header->exporterVersion == EXPORTER_VERSION)
+                && (db.header->game == ctx->game)
+                && (db.header->animCount == ctx->animTable.entryCount)
+                && animDbVerify(&db);
+    
+    if (isValid) {
+        animDbRestore(&db, &ctx->mtable, &ctx->dynTable, &ctx->strings, &ctx->stringOffsets, &ctx->labels);
+    } else {
+        fprintf(stderr, "Ignoring stale cache entry '%s'.\n", cacheFilePath);
+    }
+    
+    animDbClose(&db);
+    return isValid;
+}
+
+void exporterContextInit(ExporterContext* ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+    
+    memArenaInit(&ctx->paths);
+    memArenaInit(&ctx->animTableIndex);
+    memArenaInit(&ctx->mtable);
+    memArenaInit(&ctx->strings);
+    memArenaInit(&ctx->stringOffsets);
+    memArenaInit(&ctx->tileRanges);
+    memArenaInit(&ctx->frameData);
+    memArenaInit(&ctx->fullTileImage);
+    memArenaInit(&ctx->output);
+    
+    frameStoreInit(&ctx->frameStore);
+    
+    manifestInit(&ctx->manifest, INCREMENTAL_OUTPUT);
+    atlasInit(&ctx->atlas);
+}
+
+void exporterContextFree(ExporterContext* ctx) {
+    memArenaFree(&ctx->paths);
+    memArenaFree(&ctx->animTableIndex);
+    memArenaFree(&ctx->mtable);
+    memArenaFree(&ctx->strings);
+    memArenaFree(&ctx->stringOffsets);
+    memArenaFree(&ctx->tileRanges);
+    memArenaFree(&ctx->frameData);
+    memArenaFree(&ctx->fullTileImage);
+    memArenaFree(&ctx->output);
+    frameStoreFree(&ctx->frameStore);
+    manifestFree(&ctx->manifest);
+    atlasFree(&ctx->atlas);
 }
 
 int main(int argCount, char** args) {
-    if((argCount < 2) || (argCount > 2)
+    if((argCount < 2)
        || (!strcmp(args[1], "-h"))
        || (!strcmp(args[1], "--help"))) {
         printHelp(args[0]);
         exit(-1);
     }
     
-    u8* rom = NULL;
+    // Output formats that were selected after the ROM path
+    const Emitter* emitters[MAX_EMITTERS];
+    u32 emitterCount = 0;
+    eAtlasMode atlasMode = ATLAS_OFF;
+    for (int argId = 2; argId < argCount; argId++) {
+        if (!strcmp(args[argId], "--atlas")) {
+            atlasMode = ATLAS_PER_ANIMATION;
+            continue;
+        } else if (!strcmp(args[argId], "--atlas-game")) {
+            atlasMode = ATLAS_PER_GAME;
+            continue;
+        }
+        
+        const Emitter* selected = NULL;
+        for (int i = 0; i < SizeofArray(availableEmitters); i++) {
+            if ((args[argId][0] == '-') && (args[argId][1] == '-')
+                && !strcmp(&args[argId][2], availableEmitters[i]->name)) {
+                selected = availableEmitters[i];
+            }
+        }
+        
+        if (selected == NULL) {
+            printHelp(args[0]);
+            exit(-1);
+        }
+        
+        bool alreadySelected = FALSE;
+        for (u32 e = 0; e < emitterCount; e++)
+            alreadySelected |= (emitters[e] == selected);
+        
+        if (!alreadySelected)
+            emitters[emitterCount++] = selected;
+    }
+    
+    // C is the default output
+    if (emitterCount == 0)
+        emitters[emitterCount++] = &emitterC;
+    
+#if BENCHMARK_ROM_LOADERS
+    benchmarkRomLoaders(args[1]);
+#endif
+#if BENCHMARK_ARENA
+    benchmarkArena();
+#endif
+    
+    RomFile romFile = { 0 };
+    
+    ExporterContext ctx;
+    exporterContextInit(&ctx);
     
     eGame game;
-    tryLoadingRom(args[1], &rom, &game);
+    tryLoadingRom(args[1], &romFile, &game);
+    ctx.game = game;
     
-    // TODO: Make this a program parameter
-    bool outputC = TRUE;
+    // GBA ROMs can't be bigger than 32MB, anything after that can't be addressed.
+    ctx.rom.base = romFile.data;
+    ctx.rom.size = (u32)Min(romFile.size, 32*1024*1024);
+    RomView* rom = &ctx.rom;
     
-    SpriteTables spriteTables;
-    getSpriteTables(rom, game, &spriteTables);
+    // Identifies the ROM in files that are derived from it
+    ctx.romHash = hash64(romFile.data, romFile.size, 0);
     
-    AnimationTable animTable = { 0 };
-    animTable.data = spriteTables.animations;
-    animTable.entryCount = g_TotalAnimationCount[game];
+    SpriteTables* spriteTables = &ctx.spriteTables;
+    if (!getSpriteTables(rom, game, spriteTables)) {
+        fprintf(stderr, "Could not find the sprite tables inside the ROM. Closing...\n");
+        exit(-4);
+    }
+    
+    AnimationTable* animTable = &ctx.animTable;
+    animTable->data = spriteTables->animations;
+    animTable->entryCount = g_TotalAnimationCount[game];
+    
+    // Validate the per-animation tables once, so their entries can be read without checks
+    u64 tableSize = animTable->entryCount * sizeof(RomPointer);
+    if (!romViewContains(rom, spriteTables->animations, tableSize)
+        || !romViewContains(rom, spriteTables->dimensions, tableSize)
+        || !romViewContains(rom, spriteTables->oamData, tableSize)) {
+        fprintf(stderr, "The animation tables don't fit inside the ROM. Closing...\n");
+        exit(-4);
+    }
     
-    OutFiles files = { stdout, stdout };
+    // Resolves which entries of the table point at the same animation
+    buildAnimationTableIndex(&ctx.animTableIndex, animTable);
+    
+    OutFiles files[MAX_EMITTERS];
+    for (u32 e = 0; e < emitterCount; e++) {
+        files[e].header    = NULL;
+        files[e].animTable = NULL;
+    }
 #if !PRINT_TO_STDOUT
     // Create output directories
-    MemArena paths;
-    memArenaInit(&paths);
+    MemArena* paths = &ctx.paths;
     
     // Directory paths
-    char* outPath       = updateDirectory(&paths, "out", NULL);
-    char* gameAssetPath = updateDirectory(&paths, outPath, gameFolderName(rom));
-    char* palettePath   = updateDirectory(&paths, gameAssetPath, "palettes");
-    char* framePath     = updateDirectory(&paths, gameAssetPath, "frames");
-    char* docsPath      = updateDirectory(&paths, gameAssetPath, "documents");
+    char* outPath       = updateDirectory(paths, "out", NULL);
+    char* gameAssetPath = updateDirectory(paths, outPath, gameFolderName(rom->base));
+    char* palettePath   = updateDirectory(paths, gameAssetPath, "palettes");
+    char* framePath     = updateDirectory(paths, gameAssetPath, "frames");
+#if OUTPUT_FRAME_PREVIEWS || OUTPUT_ANIMATED_PREVIEWS
+    char* previewPath   = (atlasMode == ATLAS_OFF) ? updateDirectory(paths, gameAssetPath, "previews") : NULL;
+#else
+    char* previewPath   = NULL;
+#endif
+    if (atlasMode != ATLAS_OFF) {
+        ctx.atlas.mode = atlasMode;
+        ctx.atlas.path = updateDirectory(paths, gameAssetPath, "atlases");
+    }
+    char* docsPath      = updateDirectory(paths, gameAssetPath, "documents");
+#if USE_DECODE_CACHE || INCREMENTAL_OUTPUT
+    char* cachePath     = updateDirectory(paths, outPath, "cache");
+#endif
+#if OUTPUT_FILE_PER_ANIMATION
+    char* animationsPath = updateDirectory(paths, docsPath, "animations");
+#else
+    char* animationsPath = NULL;
+#endif
     
     // File paths
-    char* headerFilePath          = addToPath(&paths, docsPath, "macros.inc");
-    char* animationTableFilePath  = addToPath(&paths, docsPath, "animation_table.inc");
-    char* gfxIncFilePath          = addToPath(&paths, docsPath, "obj_tiles.inc");
-    char* paletteFilePath         = addToPath(&paths, docsPath, "obj_palettes.inc");
-    char* genFramesScriptFilePath = addToPath(&paths, docsPath, "gen_frames.sh");
-    
-    files.header    = fopen(headerFilePath, "w");
-    files.animTable = fopen(animationTableFilePath, "w");
+    char* gfxIncFilePath          = addToPath(paths, docsPath, "obj_tiles.inc");
+    char* paletteFilePath         = addToPath(paths, docsPath, "obj_palettes.inc");
+    char* genFramesScriptFilePath = addToPath(paths, docsPath, "gen_frames.sh");
+    
+    // Every emitter gets its own files
+    for (u32 e = 0; e < emitterCount; e++) {
+        char fileName[64];
+        
+        sprintf(fileName, "macros%s", emitters[e]->fileExtension);
+        files[e].header = addToPath(paths, docsPath, fileName);
+        
+        sprintf(fileName, "animation_table%s", emitters[e]->fileExtension);
+        files[e].animTable = addToPath(paths, docsPath, fileName);
+    }
+    
+#if INCREMENTAL_OUTPUT
+    char manifestFileName[64];
+    sprintf(manifestFileName, "%s.manifest", gameFolderName(rom->base));
+    char* manifestFilePath = addToPath(paths, cachePath, manifestFileName);
+    
+    manifestLoad(&ctx.manifest, manifestFilePath);
+#endif
 #endif
-    // For determining multiple writes of the same tiles
-    writtenTiles.writtenCount = 0;
-    writtenTiles.lastAnim = -1;
-    memArenaInit(&writtenTiles.arena);
+    DynTable* dynTable = &ctx.dynTable;
+    LabelStrings* labels = &ctx.labels;
     
-    MemArena mtableArena;
-    memArenaInit(&mtableArena);
+#if BENCHMARK_DECODE
+    double decodeStart = getWallClockSeconds();
+#endif
+    bool wasCached = FALSE;
+#if USE_DECODE_CACHE && !PRINT_TO_STDOUT
+    char cacheFileName[64];
+    sprintf(cacheFileName, "%016llX_v%u.animdb", ctx.romHash, EXPORTER_VERSION);
+    char* cacheFilePath = addToPath(paths, cachePath, cacheFileName);
+    
+    wasCached = loadCachedAnimations(&ctx, cacheFilePath);
+#endif
     
-    MemArena stringOffsetArena;
-    memArenaInit(&stringOffsetArena);
+    if (!wasCached) {
+        createDynamicAnimTable(&ctx.mtable, rom, animTable, dynTable);
+        
+        // Generates the names for the animations themselves
+        createAnimLabels(dynTable, animTable->entryCount, labels, &ctx.strings, &ctx.stringOffsets);
+        
+#if USE_DECODE_CACHE && !PRINT_TO_STDOUT
+        animDbWrite(cacheFilePath, ctx.romHash, EXPORTER_VERSION, game, dynTable, ctx.mtable.offset,
+                    animTable->entryCount, labels, ctx.strings.offset);
+#endif
+    }
+#if BENCHMARK_DECODE
+    fprintf(stderr, "%s the animations: %.3f ms\n", (wasCached) ? "Loading" : "Decoding",
+            (getWallClockSeconds() - decodeStart) * 1000.0);
+#endif
     
-    MemArena stringArena;
-    memArenaInit(&stringArena);
+#if BENCHMARK_OUTPUT
+    double outputStart = getWallClockSeconds();
+#endif
+#if OUTPUT_ANIMATION_DATABASE && !PRINT_TO_STDOUT
+    // Written before the labels of the commands get assigned, so it doesn't depend on the selected emitters.
+    MemArenaTemp animDbScope = memArenaBeginTemp(&ctx.output);
     
-    DynTable dynTable = { 0 };
-    createDynamicAnimTable(&mtableArena, rom, &animTable, &dynTable);
+    u8* animDbData;
+    u64 animDbSize = animDbBuild(&ctx.output, &animDbData, ctx.romHash, EXPORTER_VERSION, game, dynTable,
+                                 ctx.mtable.offset, animTable->entryCount, labels, ctx.strings.offset);
+    manifestWriteFile(&ctx.manifest, addToPath(paths, docsPath, "animations.animdb"), animDbData, animDbSize);
     
-    // Generates the names for the animations themselves
-    LabelStrings labels = { 0 };
-    createAnimLabels(&dynTable, animTable.entryCount, &labels, &stringArena, &stringOffsetArena);
+    memArenaEndTemp(animDbScope);
+#endif
+#if (OUTPUT_ANIMATION_TIMELINES || OUTPUT_DMA_REPORT) && !PRINT_TO_STDOUT
+    {
+        MemArena timelineVariants, timelineSegments;
+        memArenaInit(&timelineVariants);
+        memArenaInit(&timelineSegments);
+        buildAnimationTimelines(&ctx, &timelineVariants, &timelineSegments);
+        
+#if OUTPUT_ANIMATION_TIMELINES
+        writeAnimationTimelines(&ctx, addToPath(paths, docsPath, "animations.timeline"),
+                                &timelineVariants, &timelineSegments);
+#endif
+#if OUTPUT_DMA_REPORT
+        writeDmaReport(&ctx, docsPath, &timelineVariants, &timelineSegments);
+#endif
+        
+        memArenaFree(&timelineVariants);
+        memArenaFree(&timelineSegments);
+    }
+#endif
     
 #if 1
-    printAnimationDataFile(files.header, &dynTable, &labels, &stringArena, &stringOffsetArena, animTable.entryCount, &files, outputC);
-    printAnimationTable(files.animTable, &dynTable, &animTable, &labels, outputC);
+#if BENCHMARK_EMIT
+    double emitStart = getWallClockSeconds();
 #endif
-    MemArena tileRanges;
-    memArenaInit(&tileRanges);
+    Document headerDocs[MAX_EMITTERS];
+    OutBuffer headerOuts[MAX_EMITTERS];
+    for (u32 e = 0; e < emitterCount; e++) {
+        documentBegin(&headerDocs[e], files[e].header);
+        
+        // 'printAnimationDataFile' wants the buffers next to each other
+        headerOuts[e] = headerDocs[e].out;
+    }
     
+    printAnimationDataFile(headerOuts, emitters, emitterCount, dynTable, labels, &ctx.strings, &ctx.stringOffsets,
+                           animTable->entryCount, animationsPath, &ctx.manifest);
+    
+    for (u32 e = 0; e < emitterCount; e++) {
+        headerDocs[e].out = headerOuts[e];
+        documentEnd(&headerDocs[e], &ctx.manifest);
+        
+        Document animTableDoc;
+        documentBegin(&animTableDoc, files[e].animTable);
+        emitters[e]->printAnimationTable(&animTableDoc.out, dynTable, animTable, labels);
+        documentEnd(&animTableDoc, &ctx.manifest);
+    }
+#if BENCHMARK_EMIT
+    fprintf(stderr, "Emitting macros and animation table: %.3f ms\n",
+            (getWallClockSeconds() - emitStart) * 1000.0);
+#endif
+#endif
     TileInfo tileInfo = { 0 };
-    tileInfo.tileRanges = &tileRanges;
+    tileInfo.tileRanges = &ctx.tileRanges;
     
 #if 01
-    generateSprites(rom, &dynTable, &spriteTables, 0, animTable.entryCount,
-                    framePath, docsPath, palettePath, genFramesScriptFilePath, gfxIncFilePath);
+    generateSprites(&ctx, &tileInfo, 0, animTable->entryCount,
+                    framePath, previewPath, docsPath, palettePath, genFramesScriptFilePath, gfxIncFilePath);
+#endif
+#if BENCHMARK_TILE_CONVERT
+    benchmarkTileConvert(&ctx.frameStore);
+#endif
+#if OUTPUT_ANIMATED_PREVIEWS
+    // Like the still previews, these are left out with sprite sheets
+    if (previewPath)
+        writeAnimatedPreviews(&ctx, previewPath);
 #endif
     
 #define OUTPUT_PALETTES 1
@@ -1813,36 +4330,41 @@ int main(int argCount, char** args) {
     u16 paletteBuffer[16 * 16];
     int colorsPerPalette = 16;
     int paletteCount = (game == SA3 || game == KATAM)
-        ? ((spriteTables.sa3OnlyData - (u8*)spriteTables.palettes) / (2*colorsPerPalette))
-        : ((spriteTables.tiles_4bpp  - (u8*)spriteTables.palettes) / (2*colorsPerPalette));
+        ? ((spriteTables->sa3OnlyData - (u8*)spriteTables->palettes) / (2*colorsPerPalette))
+        : ((spriteTables->tiles_4bpp  - (u8*)spriteTables->palettes) / (2*colorsPerPalette));
     
-    FILE* paletteInc = fopen(paletteFilePath, "w");
+    Document paletteInc;
+    documentBegin(&paletteInc, paletteFilePath);
     
-    char* filePath = addToPath(&paths, palettePath, "pal_XXXXXX.gbapal");
+    char* filePath = addToPath(paths, palettePath, "pal_XXXXXX.gbapal");
     char* fileName = lastString(filePath, "pal_");
     // Output every palette as its own file.
     for (int i = 0; i < paletteCount; i++) {
         
-        u16* pal = spriteTables.palettes + colorsPerPalette * i;
+        u16* pal = spriteTables->palettes + colorsPerPalette * i;
         
         memcpy(&paletteBuffer, pal, 2 * 16);
         
         sprintf(fileName, "pal_%03d.gbapal", i);
-        FILE* palFile = fopen(filePath, "wb");
-        fwrite(paletteBuffer, 2, 16, palFile);
-        fclose(palFile);
+        manifestWriteFile(&ctx.manifest, filePath, paletteBuffer, 2 * 16);
         
-        fprintf(paletteInc, "./gbagfx \"palettes/%s\" \"palettes/pal_%03d.pal\"\n", fileName, i);
+        outFormat(&paletteInc.out, "./gbagfx \"palettes/%s\" \"palettes/pal_%03d.pal\"\n", fileName, i);
     }
-    fclose(paletteInc);
+    documentEnd(&paletteInc, &ctx.manifest);
 #endif
     
+#if BENCHMARK_OUTPUT
+    fprintf(stderr, "Writing frames, palettes and documents: %.3f ms (%u files written, %u unchanged)\n",
+            (getWallClockSeconds() - outputStart) * 1000.0, ctx.manifest.writtenCount, ctx.manifest.skippedCount);
+#endif
     
-    if(files.animTable && files.animTable != stdout)
-        fclose(files.animTable);
+#if INCREMENTAL_OUTPUT && !PRINT_TO_STDOUT
+    // Only a run that got this far can vouch for the files in the manifest.
+    manifestSave(&ctx.manifest, manifestFilePath);
+#endif
     
-    if (files.header && files.header != stdout)
-        fclose(files.header);
+    exporterContextFree(&ctx);
+    unloadRom(&romFile);
     
     return 0;
 }
@@ -6,13 +6,29 @@ typedef enum {
     SA1     = 1,
     SA2     = 2,
     SA3     = 3,
-
+    
     KATAM   = 10, // Kirby & the Amazing Mirror
 } eGame;
 
+typedef struct {
+    u8* data;
+    u64 size;
+    bool isMapped; // 'data' is a read-only file mapping, not a heap copy
+} RomFile;
+
+// Bounds-aware view of a loaded ROM, every pointer translation goes through this
+typedef struct {
+    u8* base;
+    u32 size;
+} RomView;
+
 typedef struct {
     RomPointer* data;
     s32 entryCount;
+    
+    // Index of the first entry pointing at the same animation as entry i (i itself if there is none).
+    // Set up by 'buildAnimationTableIndex'.
+    s32* firstReference;
 } AnimationTable;
 
 typedef struct {
@@ -28,6 +44,9 @@ typedef struct {
     StringId name;
 } DynTableAnim;
 
+// Resolves a self-relative offset (in bytes) into a pointer
+#define OffsetPointer(ptrToOffset) (((u8*)(ptrToOffset)) + *(ptrToOffset))
+
 typedef struct {
     DynTableAnim* animations;
     u16* variantCounts;
@@ -39,9 +58,10 @@ typedef struct {
     s32 subCount; // There can be multiple "sub animations" in one entry.
 } AnimationData;
 
+// NULL prints to stdout
 typedef struct {
-    FILE* header;
-    FILE* animTable;
+    char* header;
+    char* animTable;
 } OutFiles;
 
 typedef struct {
@@ -64,20 +84,15 @@ typedef struct {
     bool wasInitialized;
     u16 tileCount;
     s32 tileIndex;
-
+    
     s32 paletteId;
     u16 numColors;
-
+    
     u16 animId;
     u16 variantId;
     u16 labelId;
 } FrameData;
 
-typedef struct {
-    FrameData* data;
-    u16 frameCount;
-} FrameDataInput;
-
 typedef struct  {
     /*0x00*/ u32 y : 8;
     /*0x01*/ u32 affineMode : 2;  // 0x1, 0x2 -> 0x4
@@ -85,11 +100,11 @@ typedef struct  {
     u32 mosaic : 1;      // 0x10
     u32 bpp : 1;         // 0x20
     u32 shape : 2;       // 0x40, 0x80 -> 0xC0
-
+    
     /*0x02*/ u32 x : 9;
     u32 matrixNum : 5;   // bits 3/4 are h-flip/v-flip if not in affine mode
     u32 size : 2;        // 0x4000, 0x8000 -> 0xC000
-
+    
     /*0x04*/ u16 tileNum : 10;    // 0x3FF
     u16 priority : 2;    // 0x400, 0x800 -> 0xC00
     u16 paletteNum : 4;
@@ -99,7 +114,7 @@ typedef struct {
     u8 flip;
     u8 oamIndex; // every animation has an oamData pointer, oamIndex starts at 0 for every new animation and ends at variantCount-1
     u16 numSubframes; // some sprite frames consist of multiple images (of the same size as GBA's Object Attribute Memory, e.g. 8x8, 8x32, 32x64, ...)
-
+    
     u16 width;
     u16 height;
     s16 offsetX;
@@ -115,4 +130,97 @@ typedef struct {
     /* 0x18 */ u8*   sa3OnlyData; // only in SA3 / KATAM
 } SpriteTables;
 
+// A frame that got written into its own file
+typedef struct {
+    u64 hash;       // hash64() of the composed tiles, with the tile size as the seed
+    u32 dataOffset; // Position of the composed tiles inside of 'FrameStore.data'
+    u32 size;
+    u16 tileSize;
+    u16 widthInTiles; // Of the frame that got written, frames sharing its tiles can have another one
+    char fileName[24]; // "aXXXX_fXXX.<4bpp/8bpp>"
+} StoredFrame;
+
+// Every unique frame of the whole ROM, so identical frames only get written once,
+// no matter which animation or tiles they come from.
+typedef struct {
+    StoredFrame* frames;
+    u32 frameCount;
+    
+    // Open addressing, each slot holds the index of a frame + 1 (0 = empty)
+    u32* slots;
+    u32 slotCount;
+    
+    MemArena frameArena;
+    MemArena slotArena;
+    MemArena data;
+} FrameStore;
+
+typedef enum {
+    ATLAS_OFF,           // Every frame gets its own images
+    ATLAS_PER_ANIMATION, // One set of sprite sheets per animation
+    ATLAS_PER_GAME,      // One set of sprite sheets for all animations
+} eAtlasMode;
+
+// What's needed to render a frame that goes onto a sprite sheet (or into an animated preview)
+typedef struct {
+    SpriteOffset* dimensions;
+    OamSplit* oamData;
+    u8* tiles;
+    u32 tileSize;
+    s32 paletteId;
+} AtlasSource;
+
+// Collects frames until they get packed onto sprite sheets (see Atlas.h)
+typedef struct {
+    eAtlasMode mode;
+    char* path;        // Directory of the sheets and their index
+    u32 batchStart;    // First frame that isn't on a sheet yet
+    
+    MemArena frames;   // AtlasFrame of every frame
+    MemArena sources;  // AtlasSource of every frame from 'batchStart' on
+    MemArena sheets;   // AtlasSheet of every sheet
+    MemArena scratch;
+} AtlasBuilder;
+
+// Everything one export job works with.
+// Nothing the exporter does keeps state outside of this,
+// so several jobs can run in one process, even at the same time.
+typedef struct {
+    RomView rom;
+    u64 romHash; // hash64() of the whole ROM file
+    eGame game;
+    SpriteTables spriteTables;
+    AnimationTable animTable;
+    DynTable dynTable;
+    LabelStrings labels;
+    
+    MemArena paths;
+    MemArena animTableIndex;
+    MemArena mtable;
+    MemArena strings;
+    MemArena stringOffsets;
+    MemArena tileRanges;
+    MemArena frameData;     // FrameData of the animation that's being exported
+    MemArena fullTileImage; // Scratch-memory for one full frame that should be output.
+    MemArena output;        // Scratch-memory for binary output files
+    
+    // The "Display" command occurs after the tile/palette data is set,
+    // so we store the information in the buffer, until the command occurs.
+    FrameData fdBuffer;
+    
+    // For determining multiple writes of the same frame
+    FrameStore frameStore;
+    
+    // Every output file gets written through this, so unchanged files can be skipped
+    Manifest manifest;
+    
+    AtlasBuilder atlas;
+} ExporterContext;
+
+typedef struct {
+    FrameData* data;
+    u16 frameCount;
+    ExporterContext* ctx; // 'data' grows inside of ctx->frameData
+} FrameDataInput;
+
 #endif // GUARD_ANIM_EXPORTER_H
\ No newline at end of file
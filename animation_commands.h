@@ -148,6 +148,21 @@ typedef union {
     ExCmd_JumpBack _exJump;
 } ACmd;
 
+// Identifiers
+#define AnimCmd_GetTiles        -1
+#define AnimCmd_GetPalette      -2
+#define AnimCmd_JumpBack        -3
+#define AnimCmd_End             -4
+#define AnimCmd_PlaySoundEffect -5
+#define AnimCmd_AddHitbox       -6
+#define AnimCmd_TranslateSprite -7
+#define AnimCmd_8               -8
+#define AnimCmd_SetIdAndVariant -9
+#define AnimCmd_10              -10
+#define AnimCmd_SetSpritePriority              -11
+#define AnimCmd_12              -12
+#define AnimCmd_DisplayFrame    (AnimCmd_12-1)
+
 /* Flags are only for use with exporter, not in-game! */
 #define ACMD_FLAG__IS_START_OF_ANIM 0x1
 #define ACMD_FLAG__IS_POINTED_TO  0x2
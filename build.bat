@@ -1,7 +1,7 @@
 @echo off
 
 REM Debug version - creates a PDB file
-cl /Od /Zi animExporter.c ArenaAlloc.c
+cl /Od /Zi animExporter.c ArenaAlloc.c Threads.c OutBuffer.c Hash.c AnimDb.c Manifest.c TileIndex.c Png.c TileConvert.c OamRender.c Atlas.c AnimVm.c
 
 REM Release version
-REM cl /O2 animExporter.c ArenaAlloc.c
+REM cl /O2 animExporter.c ArenaAlloc.c Threads.c OutBuffer.c Hash.c AnimDb.c Manifest.c TileIndex.c Png.c TileConvert.c OamRender.c Atlas.c AnimVm.c
@@ -1,2 +1,2 @@
 #!/bin/sh
-gcc -O2 animExporter.c ArenaAlloc.c -o animExporter
+gcc -O2 animExporter.c ArenaAlloc.c Threads.c OutBuffer.c Hash.c AnimDb.c Manifest.c TileIndex.c Png.c TileConvert.c OamRender.c Atlas.c AnimVm.c -o animExporter -pthread